@@ -0,0 +1,241 @@
+// Headless decode benchmark, built with `make benchmark`.
+// Decodes every file listed in BENCHMARK_LIST_PATH as fast as possible through
+// the player's codec setup and writes the results to BENCHMARK_RESULT_PATH.
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <jansson.h>
+#include <SDL2/SDL.h>
+#include <whb/proc.h>
+#include <coreinit/time.h>
+#include <coreinit/thread.h>
+#include <coreinit/memheap.h>
+#include <coreinit/memexpheap.h>
+extern "C" {
+    #include <libavformat/avformat.h>
+    #include <libavcodec/avcodec.h>
+    #include <libavutil/imgutils.h>
+    #include <libavutil/pixdesc.h>
+}
+
+#include "main.hpp"
+#include "core_thread.hpp"
+#include "demuxer.hpp"
+#include "video_player.hpp"
+#include "settings.hpp"
+#include "probe_cache.hpp"
+
+// One file per line, relative to MEDIA_PATH unless it starts with '/' or is a URL
+#define BENCHMARK_LIST_PATH "/vol/external01/wiiu/apps/cafemp/benchmark.txt"
+
+struct benchmark_result {
+    uint32_t frames = 0;
+    uint64_t total_us = 0;
+    uint64_t demux_us = 0;
+    uint64_t decode_us = 0;
+    uint64_t convert_us = 0;
+    uint32_t peak_memory = 0;
+};
+
+static MEMHeapHandle benchmark_heap = nullptr;
+static uint32_t benchmark_heap_free = 0;
+
+static void benchmark_sample_memory(benchmark_result& result) {
+    uint32_t free_size = MEMGetTotalFreeSizeForExpHeap(benchmark_heap);
+    if (free_size < benchmark_heap_free && benchmark_heap_free - free_size > result.peak_memory) {
+        result.peak_memory = benchmark_heap_free - free_size;
+    }
+}
+
+static std::vector<std::string> benchmark_read_list() {
+    std::vector<std::string> files;
+
+    FILE* list = fopen(BENCHMARK_LIST_PATH, "r");
+    if (!list) {
+        printf("[Benchmark] No file list at %s\n", BENCHMARK_LIST_PATH);
+        return files;
+    }
+
+    char line[1024];
+    while (fgets(line, sizeof(line), list)) {
+        std::string path = line;
+        while (!path.empty() && (path.back() == '\n' || path.back() == '\r' || path.back() == ' ')) path.pop_back();
+        if (path.empty() || path[0] == '#') continue;
+
+        if (path[0] != '/' && path.find("://") == std::string::npos) path = std::string(MEDIA_PATH) + path;
+        files.push_back(path);
+    }
+    fclose(list);
+    return files;
+}
+
+// Same work the copy path does per frame: the plane copy SDL_UpdateYUVTexture makes
+// and the YUV to RGB conversion of SDL's software YUV textures
+static void benchmark_convert(AVFrame* frame, std::vector<uint8_t>& planes, std::vector<uint8_t>& rgb) {
+    if (frame->format != AV_PIX_FMT_YUV420P) return;
+
+    int planes_size = av_image_get_buffer_size(AV_PIX_FMT_YUV420P, frame->width, frame->height, 1);
+    if ((int)planes.size() < planes_size) planes.resize(planes_size);
+    if ((int)rgb.size() < frame->width * frame->height * 4) rgb.resize(frame->width * frame->height * 4);
+
+    uint8_t* dst_data[4];
+    int dst_linesize[4];
+    av_image_fill_arrays(dst_data, dst_linesize, planes.data(), AV_PIX_FMT_YUV420P, frame->width, frame->height, 1);
+    av_image_copy(dst_data, dst_linesize, (const uint8_t**)frame->data, frame->linesize, AV_PIX_FMT_YUV420P, frame->width, frame->height);
+
+    SDL_ConvertPixels(frame->width, frame->height, SDL_PIXELFORMAT_IYUV, planes.data(), frame->width,
+                      SDL_PIXELFORMAT_ARGB8888, rgb.data(), frame->width * 4);
+}
+
+static json_t* benchmark_file(const std::string& path) {
+    json_t* entry = json_object();
+    json_object_set_new(entry, "path", json_string(path.c_str()));
+
+    demuxer* demux = demuxer_open(path.c_str(), nullptr);
+    if (!demux) {
+        json_object_set_new(entry, "error", json_string("open failed"));
+        return entry;
+    }
+    AVFormatContext* fmt_ctx = demux->fmt_ctx;
+
+    int stream_index = av_find_best_stream(fmt_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+    AVCodecContext* codec_ctx = stream_index >= 0 ? video_player_create_codec_context(fmt_ctx, stream_index) : nullptr;
+    if (!codec_ctx) {
+        json_object_set_new(entry, "error", json_string(stream_index < 0 ? "no video stream" : "codec open failed"));
+        demuxer_close(demux);
+        return entry;
+    }
+
+    AVCodecParameters* codecpar = fmt_ctx->streams[stream_index]->codecpar;
+    const char* profile = avcodec_profile_name(codecpar->codec_id, codecpar->profile);
+    const char* pix_fmt = av_get_pix_fmt_name((AVPixelFormat)codecpar->format);
+    json_object_set_new(entry, "codec", json_string(avcodec_get_name(codecpar->codec_id)));
+    json_object_set_new(entry, "profile", json_string(profile ? profile : "unknown"));
+    json_object_set_new(entry, "level", json_integer(codecpar->level));
+    json_object_set_new(entry, "pix_fmt", json_string(pix_fmt ? pix_fmt : "unknown"));
+    json_object_set_new(entry, "width", json_integer(codecpar->width));
+    json_object_set_new(entry, "height", json_integer(codecpar->height));
+    // What the decode pre-flight needs to match these timings against its cost model
+    json_object_set_new(entry, "bit_rate", json_integer(codecpar->bit_rate > 0 ? codecpar->bit_rate : fmt_ctx->bit_rate));
+    json_object_set_new(entry, "frame_rate", json_real(av_q2d(fmt_ctx->streams[stream_index]->avg_frame_rate)));
+
+    // Nothing else is demuxed, like the player with audio disabled
+    for (unsigned int i = 0; i < fmt_ctx->nb_streams; ++i) {
+        if ((int)i != stream_index) fmt_ctx->streams[i]->discard = AVDISCARD_ALL;
+    }
+
+    benchmark_result result;
+    std::vector<uint8_t> planes;
+    std::vector<uint8_t> rgb;
+    AVPacket* pkt = av_packet_alloc();
+    AVFrame* frame = av_frame_alloc();
+    bool eof = false;
+
+    OSTime start_ticks = OSGetSystemTime();
+    while (WHBProcIsRunning()) {
+        OSTime stage_ticks = OSGetSystemTime();
+        if (!eof && av_read_frame(fmt_ctx, pkt) < 0) eof = true;
+        result.demux_us += OSTicksToMicroseconds(OSGetSystemTime() - stage_ticks);
+
+        if (!eof && pkt->stream_index != stream_index) {
+            av_packet_unref(pkt);
+            continue;
+        }
+
+        // A null packet at the end drains the frame threads
+        stage_ticks = OSGetSystemTime();
+        avcodec_send_packet(codec_ctx, eof ? nullptr : pkt);
+        av_packet_unref(pkt);
+        result.decode_us += OSTicksToMicroseconds(OSGetSystemTime() - stage_ticks);
+
+        while (true) {
+            stage_ticks = OSGetSystemTime();
+            int ret = avcodec_receive_frame(codec_ctx, frame);
+            result.decode_us += OSTicksToMicroseconds(OSGetSystemTime() - stage_ticks);
+            if (ret < 0) break;
+
+            stage_ticks = OSGetSystemTime();
+            benchmark_convert(frame, planes, rgb);
+            result.convert_us += OSTicksToMicroseconds(OSGetSystemTime() - stage_ticks);
+
+            result.frames++;
+            av_frame_unref(frame);
+            benchmark_sample_memory(result);
+        }
+        // Draining returns every remaining frame in one pass
+        if (eof) break;
+    }
+    result.total_us = OSTicksToMicroseconds(OSGetSystemTime() - start_ticks);
+
+    double seconds = result.total_us / 1e6;
+    double frames = result.frames ? (double)result.frames : 1.0;
+    json_object_set_new(entry, "frames", json_integer(result.frames));
+    json_object_set_new(entry, "seconds", json_real(seconds));
+    json_object_set_new(entry, "fps", json_real(seconds > 0 ? result.frames / seconds : 0.0));
+    json_object_set_new(entry, "us_per_frame", json_real(result.total_us / frames));
+    json_object_set_new(entry, "peak_memory", json_integer(result.peak_memory));
+
+    json_t* stages = json_object();
+    json_object_set_new(stages, "demux_us", json_real(result.demux_us / frames));
+    json_object_set_new(stages, "decode_us", json_real(result.decode_us / frames));
+    json_object_set_new(stages, "convert_us", json_real(result.convert_us / frames));
+    json_object_set_new(entry, "stages_per_frame", stages);
+
+    printf("[Benchmark] %s: %u frames, %.1f fps, demux %.0f decode %.0f convert %.0f us/frame, peak %u KB\n",
+        path.c_str(), (unsigned int)result.frames, seconds > 0 ? result.frames / seconds : 0.0,
+        result.demux_us / frames, result.decode_us / frames, result.convert_us / frames,
+        (unsigned int)(result.peak_memory / 1024));
+
+    av_frame_free(&frame);
+    av_packet_free(&pkt);
+    avcodec_free_context(&codec_ctx);
+    demuxer_close(demux);
+    return entry;
+}
+
+int main(int argc, char** argv) {
+    WHBProcInit();
+
+    // Decode where the player decodes, the frame threads spread from there
+    core_thread_pin_current(CORE_VIDEO);
+
+    printf("=======================BENCHMARK=======================\n");
+
+    // Measure with the decoder threads the player is set up with
+    settings_load();
+    probe_cache_init();
+
+    benchmark_heap = MEMGetBaseHeapHandle(MEM_BASE_HEAP_MEM2);
+
+    json_t* root = json_object();
+    json_t* files = json_array();
+    json_object_set_new(root, "decode_threads", json_integer(settings_get(SETTINGS_DECODE_THREADS)));
+
+    for (const std::string& path : benchmark_read_list()) {
+        if (!WHBProcIsRunning()) break;
+        // Memory is measured against what was free before each file
+        benchmark_heap_free = MEMGetTotalFreeSizeForExpHeap(benchmark_heap);
+        json_array_append_new(files, benchmark_file(path));
+    }
+    json_object_set_new(root, "files", files);
+
+    FILE* file = fopen(BENCHMARK_RESULT_PATH, "w");
+    if (file) {
+        json_dumpf(root, file, JSON_INDENT(4));
+        fclose(file);
+        printf("[Benchmark] Results written to %s\n", BENCHMARK_RESULT_PATH);
+    } else {
+        printf("[Benchmark] Failed to save %s\n", BENCHMARK_RESULT_PATH);
+    }
+    json_decref(root);
+    probe_cache_shutdown();
+
+    printf("=======================END=======================\n");
+
+    // Stay up until the user leaves through the HOME menu
+    while (WHBProcIsRunning()) OSSleepTicks(OSMillisecondsToTicks(100));
+
+    WHBProcShutdown();
+    return 0;
+}
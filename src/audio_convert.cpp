@@ -0,0 +1,52 @@
+#include <cmath>
+
+#include "audio_convert.hpp"
+
+// The 750CL quantizes on paired-single stores: with GQR7 set to S16 and a scale
+// of 2^15, psq_st converts, clamps and stores two samples at once
+#if defined(__WIIU__)
+#define AUDIO_CONVERT_PAIRED_SINGLES 1
+// LD_TYPE float, ST_TYPE s16 (7), ST_SCALE 15
+#define AUDIO_CONVERT_GQR_S16 0x00000F07u
+#endif
+
+static inline int16_t audio_convert_sample(float sample) {
+    float scaled = sample * 32768.0f;
+    if (scaled >= 32767.0f) return 32767;
+    if (scaled <= -32768.0f) return -32768;
+    return (int16_t)lrintf(scaled);
+}
+
+void audio_convert_fltp_s16_stereo(int16_t* out, const float* const* planes, int channels, int samples) {
+    const float* left = planes[0];
+    const float* right = channels > 1 ? planes[1] : planes[0];
+    int i = 0;
+
+#ifdef AUDIO_CONVERT_PAIRED_SINGLES
+    uint32_t saved_gqr;
+    asm volatile("mfspr %0, 919" : "=r"(saved_gqr));
+    asm volatile("mtspr 919, %0" : : "r"(AUDIO_CONVERT_GQR_S16));
+
+    // Two frames per iteration: (L0 L1) (R0 R1) -> (L0 R0) (L1 R1)
+    for (; i + 2 <= samples; i += 2) {
+        double l, r, first, second;
+        asm volatile(
+            "psq_l %0, 0(%4), 0, 7\n\t"
+            "psq_l %1, 0(%5), 0, 7\n\t"
+            "ps_merge00 %2, %0, %1\n\t"
+            "ps_merge11 %3, %0, %1\n\t"
+            "psq_st %2, 0(%6), 0, 7\n\t"
+            "psq_st %3, 4(%6), 0, 7\n\t"
+            : "=&f"(l), "=&f"(r), "=&f"(first), "=&f"(second)
+            : "b"(left + i), "b"(right + i), "b"(out + i * 2)
+            : "memory");
+    }
+
+    asm volatile("mtspr 919, %0" : : "r"(saved_gqr));
+#endif
+
+    for (; i < samples; ++i) {
+        out[i * 2] = audio_convert_sample(left[i]);
+        out[i * 2 + 1] = audio_convert_sample(right[i]);
+    }
+}
@@ -0,0 +1,10 @@
+#ifndef AUDIO_CONVERT_H
+#define AUDIO_CONVERT_H
+
+#include <cstdint>
+
+// Planar float to interleaved S16, mono is duplicated to both output channels.
+// Only ever writes `samples * 2` values, clamps everything outside [-1, 1].
+void audio_convert_fltp_s16_stereo(int16_t* out, const float* const* planes, int channels, int samples);
+
+#endif
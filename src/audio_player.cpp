@@ -1,96 +1,421 @@
 
 #include <mutex>
+#include <string>
+#include <vector>
+#include <condition_variable>
 #include <cstdio>
-#include <thread>
 #include <atomic>
 #include <cstring>
+#include <coreinit/time.h>
 
 #include "audio_player.hpp"
+#include "demuxer.hpp"
+#include "core_thread.hpp"
+#include "player_session.hpp"
+#include "pcm_ring.hpp"
+#include "audio_convert.hpp"
+#include "settings.hpp"
+#include "log.hpp"
 
 static SDL_AudioDeviceID audio_device = 0;
 static SDL_AudioSpec audio_spec;
 
-static AVFormatContext* fmt_ctx = nullptr;
+static demuxer* demux = nullptr;
+static bool owns_demuxer = false;
+static int audio_serial = -1;
 static AVCodecContext* audio_codec_ctx = nullptr;
 static SwrContext* swr_ctx = nullptr;
 static AVFrame* audio_frame = nullptr;
 static AVPacket* audio_packet = nullptr;
 
 static int audio_stream_index = -1;
-static std::thread audio_thread;
+static double audio_total_time = 0.0;
+
+// A track opened ahead of time, its demuxer is already filling the packet queue
+struct audio_track {
+    demuxer* demux = nullptr;
+    AVCodecContext* codec_ctx = nullptr;
+    SwrContext* swr_ctx = nullptr;
+    int stream_index = -1;
+    double total_time = 0.0;
+    uint64_t codec_open_us = 0;
+};
+static audio_track next_track;
+
+// Queued tracks open here, the main thread never waits on a demuxer or a codec
+static core_thread queue_thread;
+static std::atomic<bool> queue_running = false;
+static std::mutex queue_mutex;
+static std::condition_variable queue_cv;
+// Next file to open, empty when nothing was asked for since the last open
+static std::string queue_path;
+// Requested and not installed in next_track yet
+static bool queue_busy = false;
+// Decoder and resampler emptied after the demuxer hit the end
+static std::atomic<bool> audio_track_drained = false;
+
+static core_thread audio_thread;
 static std::atomic<bool> audio_thread_running = false;
-static std::atomic<float> current_play_time(0.0f);
 bool audio_enabled = false;
 static bool audio_playing = false;
 
 static int out_channels = 2;
-static int out_sample_rate = 48000;
+static int out_sample_rate = AUDIO_OUTPUT_SAMPLE_RATE;
 
 static std::mutex audio_mutex;
 static std::atomic<bool> switching_audio_stream = false;
 
-static void audio_decode_loop() {
+static pcm_ring audio_ring;
+// Decode thread only, grows to the largest frame seen
+static std::vector<int16_t> convert_buffer;
+static std::atomic<uint32_t> audio_underruns = 0;
+
+// Ring write position and the stream time it corresponds to
+static std::mutex audio_clock_mutex;
+// Time to first sound for files the audio player opens itself
+static uint64_t audio_start_ticks = 0;
+static uint64_t audio_codec_open_us = 0;
+static std::atomic<bool> audio_first_samples = true;
+
+static size_t audio_clock_pos = 0;
+static double audio_clock_pts = 0.0;
+
+// Until the callback reaches the boundary the ring still plays the previous track
+static bool audio_boundary_pending = false;
+static size_t audio_boundary_pos = 0;
+static size_t audio_prev_clock_pos = 0;
+static double audio_prev_clock_pts = 0.0;
+static double audio_prev_total_time = 0.0;
+static int audio_track_changes = 0;
+
+// Caller holds audio_clock_mutex
+static bool audio_boundary_ahead() {
+    if (audio_boundary_pending && (ptrdiff_t)(audio_boundary_pos - audio_ring.read_pos.load()) > 0) return true;
+    audio_boundary_pending = false;
+    return false;
+}
+
+static void audio_clock_set(size_t pos, double pts) {
+    std::lock_guard<std::mutex> lock(audio_clock_mutex);
+    audio_clock_pos = pos;
+    audio_clock_pts = pts;
+}
+
+static void audio_callback(void*, Uint8* stream, int len) {
+    size_t wanted = len / sizeof(int16_t);
+    size_t got = pcm_ring_read(audio_ring, reinterpret_cast<int16_t*>(stream), wanted);
+
+    // Underrun, play silence instead of stale data
+    if (got < wanted) {
+        memset(stream + got * sizeof(int16_t), 0, (wanted - got) * sizeof(int16_t));
+        if (audio_thread_running) audio_underruns++;
+    }
+}
+
+static void audio_ring_flush() {
+    SDL_LockAudioDevice(audio_device);
+    pcm_ring_flush(audio_ring);
+    SDL_UnlockAudioDevice(audio_device);
+
+    std::lock_guard<std::mutex> lock(audio_clock_mutex);
+    audio_clock_pos = audio_ring.write_pos.load();
+}
+
+// Returns false once the samples went stale (seek, stream switch or shutdown)
+static bool audio_ring_push(const int16_t* data, size_t count) {
+    while (count) {
+        if (!audio_thread_running || switching_audio_stream) return false;
+
+        if (pcm_ring_filled(audio_ring) >= AUDIO_RING_HIGH_WATERMARK / sizeof(int16_t)) {
+            // Let the callback drain down to the low watermark before decoding more
+            while (pcm_ring_filled(audio_ring) > AUDIO_RING_LOW_WATERMARK / sizeof(int16_t) &&
+                   audio_thread_running && !switching_audio_stream) {
+                SDL_Delay(AUDIO_RING_POLL_MS);
+            }
+            continue;
+        }
+
+        size_t written = pcm_ring_write(audio_ring, data, count);
+        data += written;
+        count -= written;
+    }
+    return true;
+}
+
+static double audio_stream_duration(AVFormatContext* fmt_ctx, int stream_index) {
+    AVStream* stream = fmt_ctx->streams[stream_index];
+    if (stream->duration != AV_NOPTS_VALUE) return (double)stream->duration * av_q2d(stream->time_base);
+    if (fmt_ctx->duration != AV_NOPTS_VALUE) return (double)fmt_ctx->duration / AV_TIME_BASE;
+    return 0.0;
+}
+
+// Codec and resampler to the fixed device format for one audio stream
+static bool audio_decoder_open(AVStream* stream, AVCodecContext** codec_ctx, SwrContext** swr, uint64_t* open_us = nullptr) {
+    const AVCodec* codec = avcodec_find_decoder(stream->codecpar->codec_id);
+    if (!codec) {
+    #ifdef DEBUG_AUDIO
+        log_debug("[Audio player] Unsupported codec\n");
+    #endif
+        return false;
+    }
+    #ifdef DEBUG_AUDIO
+    log_debug("[Audio player] Codec found: %s\n", codec->name);
+    #endif
+
+    *codec_ctx = avcodec_alloc_context3(codec);
+    if (!*codec_ctx || avcodec_parameters_to_context(*codec_ctx, stream->codecpar) < 0) {
+    #ifdef DEBUG_AUDIO
+        log_debug("[Audio player] Failed to copy codec parameters\n");
+    #endif
+        return false;
+    }
+
+    uint64_t codec_ticks = OSGetSystemTime();
+    if (avcodec_open2(*codec_ctx, codec, nullptr) < 0) {
+    #ifdef DEBUG_AUDIO
+        log_debug("[Audio player] Failed to open codec\n");
+    #endif
+        return false;
+    }
+    if (open_us) *open_us = OSTicksToMicroseconds(OSGetSystemTime() - codec_ticks);
+
+    *swr = swr_alloc_set_opts(
+        nullptr,
+        av_get_default_channel_layout(out_channels),
+        AV_SAMPLE_FMT_S16,
+        out_sample_rate,
+        av_get_default_channel_layout((*codec_ctx)->channels),
+        (*codec_ctx)->sample_fmt,
+        (*codec_ctx)->sample_rate,
+        0, nullptr
+    );
+    if (!*swr || swr_init(*swr) < 0) {
+    #ifdef DEBUG_AUDIO
+        log_debug("[Audio player] Failed to initialize resampler\n");
+    #endif
+        return false;
+    }
+    return true;
+}
+
+static void audio_track_close(audio_track& track) {
+    if (track.swr_ctx) swr_free(&track.swr_ctx);
+    if (track.codec_ctx) avcodec_free_context(&track.codec_ctx);
+    if (track.demux) demuxer_close(track.demux);
+    track = audio_track();
+}
+
+static int16_t* audio_convert_reserve(int samples) {
+    size_t needed = (size_t)samples * out_channels;
+    if (convert_buffer.size() < needed) convert_buffer.resize(needed);
+    return convert_buffer.data();
+}
+
+// Turns the decoded frame into device samples, caller holds audio_mutex. Frames already in
+// the device format are used as they are, planar float only needs interleaving
+static int audio_convert_frame(const int16_t*& out) {
+    int channels = audio_codec_ctx->channels;
+    bool same_rate = audio_frame->sample_rate == out_sample_rate;
+
+    if (same_rate && channels == out_channels && audio_frame->format == AV_SAMPLE_FMT_S16) {
+        out = reinterpret_cast<const int16_t*>(audio_frame->data[0]);
+        return audio_frame->nb_samples;
+    }
+
+    if (same_rate && (channels == 1 || channels == 2) && audio_frame->format == AV_SAMPLE_FMT_FLTP) {
+        int16_t* buffer = audio_convert_reserve(audio_frame->nb_samples);
+        audio_convert_fltp_s16_stereo(buffer, reinterpret_cast<const float* const*>(audio_frame->extended_data),
+                                      channels, audio_frame->nb_samples);
+        out = buffer;
+        return audio_frame->nb_samples;
+    }
+
+    // Whole frame in one call, plus whatever the resampler still holds
+    int16_t* buffer = audio_convert_reserve(swr_get_out_samples(swr_ctx, audio_frame->nb_samples));
+    uint8_t* out_buffers[] = { reinterpret_cast<uint8_t*>(buffer) };
+    out = buffer;
+    return swr_convert(
+        swr_ctx,
+        out_buffers,
+        (int)(convert_buffer.size() / out_channels),
+        (const uint8_t**)audio_frame->extended_data,
+        audio_frame->nb_samples
+    );
+}
+
+// Converts and queues whatever the codec has ready, false once the output went stale
+static bool audio_receive_frames(double& skip_until) {
+    while (true) {
+        const int16_t* out_data = nullptr;
+        int out_samples = 0;
+        double pts_time = -1.0;
+        {
+            std::lock_guard<std::mutex> lock(audio_mutex);
+            if (avcodec_receive_frame(audio_codec_ctx, audio_frame) != 0) return true;
+
+            out_samples = audio_convert_frame(out_data);
+
+            if (audio_frame->pts != AV_NOPTS_VALUE && out_samples > 0) {
+                AVRational time_base = demux->fmt_ctx->streams[audio_stream_index]->time_base;
+                // Stream time right after the last converted sample
+                pts_time = (double)audio_frame->pts * av_q2d(time_base) + (double)out_samples / out_sample_rate;
+            }
+        }
+
+        if (out_samples <= 0) continue;
+
+        // The demuxer lands on the video keyframe before the target, skip up to it
+        if (skip_until >= 0 && pts_time >= 0) {
+            if (pts_time <= skip_until) continue;
+            skip_until = -1.0;
+        }
+
+        // Pass-through data lives in audio_frame, only this thread replaces it
+        if (!audio_ring_push(out_data, out_samples * out_channels)) return false;
+
+        if (!audio_first_samples) {
+            audio_first_samples = true;
+            printf("[Audio player] Open %llu ms, probe %llu ms%s, codec %llu ms, first samples after %llu ms\n",
+                (unsigned long long)demux->open_us / 1000,
+                (unsigned long long)demux->probe_us / 1000, demux->probe_cached ? " (cached)" : "",
+                (unsigned long long)audio_codec_open_us / 1000,
+                (unsigned long long)OSTicksToMilliseconds(OSGetSystemTime() - audio_start_ticks));
+        }
+
+        if (pts_time >= 0) audio_clock_set(audio_ring.write_pos.load(), pts_time);
+    }
+}
+
+// End of file, get the last frames out of the decoder and the resampler's delay line
+static void audio_drain_track(double& skip_until) {
+    {
+        std::lock_guard<std::mutex> lock(audio_mutex);
+        avcodec_send_packet(audio_codec_ctx, nullptr);
+    }
+    if (!audio_receive_frames(skip_until)) return;
+
+    int out_samples = 0;
+    {
+        std::lock_guard<std::mutex> lock(audio_mutex);
+        int pending = swr_get_out_samples(swr_ctx, 0);
+        if (pending > 0) {
+            uint8_t* out_buffers[] = { reinterpret_cast<uint8_t*>(audio_convert_reserve(pending)) };
+            out_samples = swr_convert(swr_ctx, out_buffers, pending, nullptr, 0);
+        }
+    }
+    if (out_samples > 0) audio_ring_push(convert_buffer.data(), out_samples * out_channels);
+}
+
+// Continue with the queued track, its samples follow the current ones in the ring
+static bool audio_next_track() {
+    demuxer* finished = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(audio_mutex);
+        if (!next_track.demux || !owns_demuxer) return false;
+
+        if (swr_ctx) swr_free(&swr_ctx);
+        if (audio_codec_ctx) avcodec_free_context(&audio_codec_ctx);
+        finished = demux;
+
+        double prev_total_time = audio_total_time;
+        demux = next_track.demux;
+        audio_codec_ctx = next_track.codec_ctx;
+        swr_ctx = next_track.swr_ctx;
+        audio_stream_index = next_track.stream_index;
+        audio_total_time = next_track.total_time;
+        audio_serial = -1;
+        next_track = audio_track();
+        audio_track_drained = false;
+
+        std::lock_guard<std::mutex> clock_lock(audio_clock_mutex);
+        audio_prev_clock_pos = audio_clock_pos;
+        audio_prev_clock_pts = audio_clock_pts;
+        audio_prev_total_time = prev_total_time;
+        audio_boundary_pos = audio_ring.write_pos.load();
+        audio_boundary_pending = true;
+        audio_clock_pos = audio_boundary_pos;
+        audio_clock_pts = 0.0;
+        audio_track_changes++;
+    }
+
+    demuxer_close(finished);
+    #ifdef DEBUG_AUDIO
+    log_debug("[Audio player] Continuing with the queued track\n");
+    #endif
+    return true;
+}
+
+static void audio_decode_loop(void*) {
+    // Samples before this (seconds) only lead up to a seek target
+    double skip_until = -1.0;
+
     while (audio_thread_running.load()) {
         if (switching_audio_stream.load()) {
             SDL_Delay(5); // Let main thread do the switching
             continue;
         }
 
-        std::lock_guard<std::mutex> lock(audio_mutex);
+        if (!demux || !audio_enabled || !audio_playing) {
+            SDL_Delay(10);
+            continue;
+        }
 
-        if (!fmt_ctx || !audio_enabled || !audio_playing) {
+        int serial = 0;
+        packet_queue_result result = packet_queue_pop(demux, demux->audio_queue, audio_packet, &serial, true);
+        if (result == PACKET_QUEUE_ABORTED) break;
+        if (result == PACKET_QUEUE_EOF) {
+            if (!audio_track_drained) {
+                audio_drain_track(skip_until);
+                audio_track_drained = true;
+            }
+            if (!audio_next_track()) SDL_Delay(10);
+            continue;
+        }
+        if (result != PACKET_QUEUE_OK) {
             SDL_Delay(10);
             continue;
         }
 
-        if (av_read_frame(fmt_ctx, audio_packet) >= 0) {
-            if (audio_packet->stream_index == audio_stream_index) {
-                if (avcodec_send_packet(audio_codec_ctx, audio_packet) == 0) {
-                    while (avcodec_receive_frame(audio_codec_ctx, audio_frame) == 0) {
-                        uint8_t temp_buffer[8192];
-                        uint8_t* out_buffers[] = { temp_buffer };
-
-                        int out_samples = swr_convert(
-                            swr_ctx,
-                            out_buffers,
-                            sizeof(temp_buffer) / (out_channels * av_get_bytes_per_sample(AV_SAMPLE_FMT_S16)),
-                            (const uint8_t**)audio_frame->data,
-                            audio_frame->nb_samples
-                        );
-
-                        if (out_samples <= 0) continue;
-
-                        int data_size = out_samples * out_channels * av_get_bytes_per_sample(AV_SAMPLE_FMT_S16);
-
-                        if (audio_playing) {
-                            SDL_QueueAudio(audio_device, temp_buffer, data_size);
-                        }
-
-                        if (audio_frame->pts != AV_NOPTS_VALUE) {
-                            AVRational time_base = fmt_ctx->streams[audio_stream_index]->time_base;
-                            double pts_time = (double)audio_frame->pts * av_q2d(time_base);
-                            if (pts_time >= 0) {
-                                current_play_time.store((float)pts_time);
-                            }
-                        }
-                    }
+        bool sent = false;
+        {
+            // Only held while the codec is in use, never while waiting on the ring
+            std::lock_guard<std::mutex> lock(audio_mutex);
+
+            if (serial != audio_serial) {
+                // First packet after a seek, drop everything decoded before it
+                if (audio_serial >= 0) {
+                    avcodec_flush_buffers(audio_codec_ctx);
+                    audio_ring_flush();
+                    // Throw away the resampler's delay line instead of rebuilding its filters
+                    int stale = swr_ctx ? swr_get_out_samples(swr_ctx, 0) : 0;
+                    if (stale > 0) swr_drop_output(swr_ctx, stale);
                 }
+                audio_serial = serial;
+                audio_track_drained = false;
+
+                int64_t seek_target = packet_queue_seek_target(demux->audio_queue);
+                skip_until = seek_target != AV_NOPTS_VALUE ? seek_target / (double)AV_TIME_BASE : -1.0;
             }
-            av_packet_unref(audio_packet);
-        } else {
-            SDL_Delay(10);
+
+            sent = audio_packet->stream_index == audio_stream_index &&
+                   avcodec_send_packet(audio_codec_ctx, audio_packet) == 0;
         }
+        av_packet_unref(audio_packet);
+
+        if (sent) audio_receive_frames(skip_until);
     }
 }
 
 #ifdef DEBUG_AUDIO
 void print_audio_tracks() {
-    if (!fmt_ctx) {
-        printf("[Audio Player] Error: Format context not initialized.\n");
+    if (!demux) {
+        log_debug("[Audio Player] Error: Format context not initialized.\n");
         return;
     }
 
-    printf("[Audio Player] Available audio tracks:\n");
+    AVFormatContext* fmt_ctx = demux->fmt_ctx;
+
+    log_debug("[Audio Player] Available audio tracks:\n");
 
     for (unsigned int i = 0; i < fmt_ctx->nb_streams; ++i) {
         AVStream* stream = fmt_ctx->streams[i];
@@ -98,7 +423,7 @@ void print_audio_tracks() {
             AVDictionaryEntry* lang = av_dict_get(stream->metadata, "language", NULL, 0);
             const char* language = lang ? lang->value : "und";
 
-            printf("[Audio Player]  Stream %d: Codec: %s | Channels: %d | Sample Rate: %d | Language: %s\n",
+            log_debug("[Audio Player]  Stream %d: Codec: %s | Channels: %d | Sample Rate: %d | Language: %s\n",
                 i,
                 avcodec_get_name(stream->codecpar->codec_id),
                 stream->codecpar->channels,
@@ -109,169 +434,253 @@ void print_audio_tracks() {
 }
 #endif
 
-int audio_player_init(const char* filepath) {
-    #ifdef DEBUG_AUDIO
-    printf("[Audio player] Starting Audio Player...\n");
-    #endif
-
-    if (SDL_WasInit(SDL_INIT_AUDIO) == 0) {
-        if (SDL_InitSubSystem(SDL_INIT_AUDIO) != 0) {
-    #ifdef DEBUG_AUDIO
-            printf("[Audio player] SDL_InitSubSystem failed: %s\n", SDL_GetError());
-    #endif
-            return -1;
-        }
-    #ifdef DEBUG_AUDIO
-        printf("[Audio player] SDL audio subsystem initialized\n");
-    #endif
-    } else {
-    #ifdef DEBUG_AUDIO
-        printf("[Audio player] SDL audio subsystem already initialized\n");
-    #endif
+// Undoes a half finished open, the stream must not stay enabled or its queue
+// fills up with nobody reading it and the demuxer stalls the video with it
+static int audio_player_open_failed() {
+    audio_enabled = false;
+    if (audio_frame) av_frame_free(&audio_frame);
+    if (audio_packet) av_packet_free(&audio_packet);
+    if (swr_ctx) swr_free(&swr_ctx);
+    if (audio_codec_ctx) avcodec_free_context(&audio_codec_ctx);
+    if (demux) {
+        std::lock_guard<std::mutex> lock(demux->audio_queue.mutex);
+        demux->audio_queue.stream_index = -1;
     }
+    demux = nullptr;
+    owns_demuxer = false;
+    return -1;
+}
 
+static int audio_player_open(demuxer* source, bool owned) {
     #ifdef DEBUG_AUDIO
-    printf("[Audio player] Opening file %s\n", filepath);
-    #endif
-    if (avformat_open_input(&fmt_ctx, filepath, nullptr, nullptr) != 0) {
-    #ifdef DEBUG_AUDIO
-        printf("[Audio player] Could not open input: %s\n", filepath);
-    #endif
-        return -1;
-    }
-    #ifdef DEBUG_AUDIO
-    printf("[Audio player] File opened successfully\n");
+    log_debug("[Audio player] Starting Audio Player...\n");
     #endif
 
-    if (avformat_find_stream_info(fmt_ctx, nullptr) < 0) {
+    // The device lives for the whole run, sessions only attach to it
+    if (!audio_device) {
     #ifdef DEBUG_AUDIO
-        printf("[Audio player] Could not find stream info\n");
+        log_debug("[Audio player] Audio output not open\n");
     #endif
         return -1;
     }
-    #ifdef DEBUG_AUDIO
-    printf("[Audio player] Stream info loaded\n");
-    #endif
+
+    demux = source;
+    owns_demuxer = owned;
+    audio_serial = -1;
+    AVFormatContext* fmt_ctx = demux->fmt_ctx;
 
     audio_stream_index = av_find_best_stream(fmt_ctx, AVMEDIA_TYPE_AUDIO, -1, -1, nullptr, 0);
     if (audio_stream_index < 0) {
     #ifdef DEBUG_AUDIO
-        printf("[Audio player] No audio stream found\n");
+        log_debug("[Audio player] No audio stream found\n");
     #endif
         audio_enabled = false;
+        if (owns_demuxer) demuxer_close(demux);
+        demux = nullptr;
+        owns_demuxer = false;
         return 0;
     }
     #ifdef DEBUG_AUDIO
-    printf("[Audio player] Audio stream found: index %d\n", audio_stream_index);
+    log_debug("[Audio player] Audio stream found: index %d\n", audio_stream_index);
     #endif
 
-    audio_enabled = true;
+    audio_total_time = audio_stream_duration(fmt_ctx, audio_stream_index);
+    audio_track_drained = false;
 
-    AVCodecParameters* codecpar = fmt_ctx->streams[audio_stream_index]->codecpar;
-    const AVCodec* codec = avcodec_find_decoder(codecpar->codec_id);
-    if (!codec) {
-    #ifdef DEBUG_AUDIO
-        printf("[Audio player] Unsupported codec\n");
-    #endif
-        return -1;
+    // Decoder first, the stream is only enabled once something can read it
+    if (!audio_decoder_open(fmt_ctx->streams[audio_stream_index], &audio_codec_ctx, &swr_ctx, &audio_codec_open_us)) {
+        return audio_player_open_failed();
     }
     #ifdef DEBUG_AUDIO
-    printf("[Audio player] Codec found: %s\n", codec->name);
+    log_debug("[Audio player] Codec and resampler ready\n");
     #endif
 
-    audio_codec_ctx = avcodec_alloc_context3(codec);
-    if (avcodec_parameters_to_context(audio_codec_ctx, codecpar) < 0) {
+    audio_frame = av_frame_alloc();
+    audio_packet = av_packet_alloc();
+    if (!audio_frame || !audio_packet) {
     #ifdef DEBUG_AUDIO
-        printf("[Audio player] Failed to copy codec parameters\n");
+        log_debug("[Audio player] Failed to allocate frame or packet\n");
     #endif
-        return -1;
+        return audio_player_open_failed();
     }
-
-    if (avcodec_open2(audio_codec_ctx, codec, nullptr) < 0) {
     #ifdef DEBUG_AUDIO
-        printf("[Audio player] Failed to open codec\n");
+    log_debug("[Audio player] Frame and packet allocated\n");
     #endif
-        return -1;
+
+    audio_enabled = true;
+    demuxer_enable_stream(demux, AVMEDIA_TYPE_AUDIO, audio_stream_index);
+
+    // Leftovers of the previous session must not play before the new file
+    audio_ring_flush();
+    audio_clock_set(audio_ring.write_pos.load(), 0.0);
+    audio_underruns = 0;
+    {
+        std::lock_guard<std::mutex> lock(audio_clock_mutex);
+        audio_boundary_pending = false;
+        audio_track_changes = 0;
     }
+
     #ifdef DEBUG_AUDIO
-    printf("[Audio player] Codec opened successfully\n");
+    print_audio_tracks();
     #endif
 
-    SDL_AudioSpec wanted_spec;
-    SDL_zero(wanted_spec);
-    wanted_spec.freq = out_sample_rate;
-    wanted_spec.format = AUDIO_S16SYS;
-    wanted_spec.channels = out_channels;
-    wanted_spec.samples = 4096;
-    wanted_spec.callback = nullptr;
-
-    audio_device = SDL_OpenAudioDevice(nullptr, 0, &wanted_spec, &audio_spec, 0);
-    if (!audio_device) {
+    SDL_PauseAudioDevice(audio_device, 0);
     #ifdef DEBUG_AUDIO
-        printf("[Audio player] SDL_OpenAudioDevice failed: %s\n", SDL_GetError());
+    log_debug("[Audio player] Audio playback started\n");
     #endif
-        return -1;
+
+    audio_thread_running = true;
+    if (!core_thread_start(audio_thread, "cafemp audio", audio_decode_loop, nullptr, CORE_AUDIO, PRIORITY_AUDIO)) {
+        audio_thread_running = false;
+        return audio_player_open_failed();
     }
     #ifdef DEBUG_AUDIO
-    printf("[Audio player] SDL audio device opened\n");
+    log_debug("[Audio player] Decode thread started\n");
     #endif
 
-    swr_ctx = swr_alloc_set_opts(
-        nullptr,
-        av_get_default_channel_layout(out_channels),
-        AV_SAMPLE_FMT_S16,
-        out_sample_rate,
-        av_get_default_channel_layout(audio_codec_ctx->channels),
-        audio_codec_ctx->sample_fmt,
-        audio_codec_ctx->sample_rate,
-        0, nullptr
-    );
-    if (!swr_ctx || swr_init(swr_ctx) < 0) {
-    #ifdef DEBUG_AUDIO
-        printf("[Audio player] Failed to initialize resampler\n");
-    #endif
-        return -1;
-    }
+    return 0;
+}
+
+int audio_player_init(const char* filepath) {
     #ifdef DEBUG_AUDIO
-    printf("[Audio player] Resampler initialized\n");
+    log_debug("[Audio player] Opening file %s\n", filepath);
     #endif
-
-    audio_frame = av_frame_alloc();
-    audio_packet = av_packet_alloc();
-    if (!audio_frame || !audio_packet) {
+    audio_start_ticks = OSGetSystemTime();
+    demuxer* file_demux = demuxer_open(filepath, nullptr);
+    if (!file_demux) {
     #ifdef DEBUG_AUDIO
-        printf("[Audio player] Failed to allocate frame or packet\n");
+        log_debug("[Audio player] Could not open input: %s\n", filepath);
     #endif
         return -1;
     }
     #ifdef DEBUG_AUDIO
-    printf("[Audio player] Frame and packet allocated\n");
+    log_debug("[Audio player] File opened successfully\n");
     #endif
 
-    #ifdef DEBUG_AUDIO
-    print_audio_tracks();
-    #endif
+    int ret = audio_player_open(file_demux, true);
+    if (ret < 0) {
+        if (demux == file_demux) demux = nullptr;
+        owns_demuxer = false;
+        demuxer_close(file_demux);
+        return ret;
+    }
 
-    SDL_ClearQueuedAudio(audio_device);
-    SDL_PauseAudioDevice(audio_device, 0);
-    #ifdef DEBUG_AUDIO
-    printf("[Audio player] Audio playback started\n");
-    #endif
+    // Video reports its own time to first frame
+    audio_first_samples = !demux;
+    if (demux) demuxer_start(demux);
+    return ret;
+}
 
-    audio_thread_running = true;
-    audio_thread = std::thread(audio_decode_loop);
+int audio_player_attach(demuxer* source) {
+    if (!source) return -1;
+    return audio_player_open(source, false);
+}
+
+// Queue thread, everything a track needs before its first packet is decoded
+static bool audio_track_open(const char* filepath, audio_track& track) {
+    track.demux = demuxer_open(filepath, nullptr);
+    if (!track.demux) return false;
+
+    track.stream_index = av_find_best_stream(track.demux->fmt_ctx, AVMEDIA_TYPE_AUDIO, -1, -1, nullptr, 0);
+    if (track.stream_index < 0 ||
+        !audio_decoder_open(track.demux->fmt_ctx->streams[track.stream_index], &track.codec_ctx, &track.swr_ctx, &track.codec_open_us)) {
+        return false;
+    }
+    track.total_time = audio_stream_duration(track.demux->fmt_ctx, track.stream_index);
+
+    // Start reading now so packets are waiting by the time the current track ends
+    demuxer_enable_stream(track.demux, AVMEDIA_TYPE_AUDIO, track.stream_index);
+    demuxer_start(track.demux);
+    return true;
+}
+
+static void audio_queue_loop(void*) {
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    while (true) {
+        queue_cv.wait(lock, [] { return !queue_running || !queue_path.empty(); });
+        if (!queue_running) break;
+
+        std::string path;
+        path.swap(queue_path);
+        lock.unlock();
+
+        audio_track track;
+        bool opened = audio_track_open(path.c_str(), track);
     #ifdef DEBUG_AUDIO
-    printf("[Audio player] Decode thread started\n");
+        if (opened) {
+            log_debug("[Audio player] Queued %s, open %llu ms, codec %llu ms\n", path.c_str(),
+                (unsigned long long)track.demux->open_us / 1000, (unsigned long long)track.codec_open_us / 1000);
+        } else {
+            log_debug("[Audio player] Could not queue %s\n", path.c_str());
+        }
     #endif
 
+        audio_track replaced;
+        lock.lock();
+        // Stopping, or a newer request came in while this one opened
+        bool stale = !queue_running || !queue_path.empty();
+        if (opened && !stale) {
+            std::lock_guard<std::mutex> track_lock(audio_mutex);
+            replaced = next_track;
+            next_track = track;
+        } else {
+            replaced = track;
+        }
+        if (!stale) queue_busy = false;
+        lock.unlock();
+
+        audio_track_close(replaced);
+        lock.lock();
+    }
+}
+
+int audio_player_queue(const char* filepath) {
+    // Only files the audio player opened itself can be followed by another one
+    if (!audio_enabled || !owns_demuxer) return -1;
+
+    if (!queue_running) {
+        queue_running = true;
+        if (!core_thread_start(queue_thread, "cafemp audio queue", audio_queue_loop, nullptr, CORE_IO, PRIORITY_AUDIO_QUEUE)) {
+            queue_running = false;
+            return -1;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        queue_path = filepath;
+        queue_busy = true;
+    }
+    queue_cv.notify_one();
     return 0;
 }
 
+int audio_player_get_track_changes() {
+    std::lock_guard<std::mutex> lock(audio_clock_mutex);
+    return audio_boundary_ahead() ? audio_track_changes - 1 : audio_track_changes;
+}
+
+bool audio_player_is_finished() {
+    if (!audio_enabled) return true;
+    if (!audio_track_drained) return false;
+
+    // Busy is only cleared once next_track holds the track, check it first
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        if (queue_busy) return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(audio_mutex);
+        if (next_track.demux) return false;
+    }
+    return pcm_ring_filled(audio_ring) == 0;
+}
+
 bool audio_player_switch_audio_stream(int new_stream_index) {
-    if (!fmt_ctx || new_stream_index < 0 || new_stream_index >= (int)fmt_ctx->nb_streams)
+    if (!demux || new_stream_index < 0 || new_stream_index >= (int)demux->fmt_ctx->nb_streams)
         return false;
 
-    AVStream* new_stream = fmt_ctx->streams[new_stream_index];
+    AVStream* new_stream = demux->fmt_ctx->streams[new_stream_index];
     if (new_stream->codecpar->codec_type != AVMEDIA_TYPE_AUDIO)
         return false;
 
@@ -280,7 +689,7 @@ bool audio_player_switch_audio_stream(int new_stream_index) {
 
     // Stop SDL playback temporarily
     SDL_PauseAudioDevice(audio_device, 1);
-    SDL_ClearQueuedAudio(audio_device);
+    audio_ring_flush();
 
     // Cleanup old contexts
     if (audio_codec_ctx) {
@@ -293,31 +702,15 @@ bool audio_player_switch_audio_stream(int new_stream_index) {
         swr_ctx = nullptr;
     }
 
-    // Setup new codec
-    const AVCodec* codec = avcodec_find_decoder(new_stream->codecpar->codec_id);
-    if (!codec) {
-        switching_audio_stream.store(false);
-        return false;
-    }
-
-    audio_codec_ctx = avcodec_alloc_context3(codec);
-    if (avcodec_parameters_to_context(audio_codec_ctx, new_stream->codecpar) < 0 ||
-        avcodec_open2(audio_codec_ctx, codec, nullptr) < 0) {
-        switching_audio_stream.store(false);
-        return false;
-    }
-
-    // Setup new resampler
-    swr_ctx = swr_alloc_set_opts(nullptr,
-        av_get_default_channel_layout(out_channels), AV_SAMPLE_FMT_S16, out_sample_rate,
-        av_get_default_channel_layout(audio_codec_ctx->channels), audio_codec_ctx->sample_fmt, audio_codec_ctx->sample_rate,
-        0, nullptr);
-    if (!swr_ctx || swr_init(swr_ctx) < 0) {
+    // Setup new codec and resampler
+    if (!audio_decoder_open(new_stream, &audio_codec_ctx, &swr_ctx)) {
         switching_audio_stream.store(false);
         return false;
     }
 
     audio_stream_index = new_stream_index;
+    audio_total_time = audio_stream_duration(demux->fmt_ctx, audio_stream_index);
+    demuxer_enable_stream(demux, AVMEDIA_TYPE_AUDIO, audio_stream_index);
 
     // Flush decoder buffers
     avcodec_flush_buffers(audio_codec_ctx);
@@ -333,13 +726,22 @@ bool audio_player_switch_audio_stream(int new_stream_index) {
 double audio_player_get_current_play_time() {
     if (!audio_enabled) return 0.0;
 
-    float pts = current_play_time.load();
-
-    Uint32 queued_bytes = SDL_GetQueuedAudioSize(audio_device);
+    size_t clock_pos;
+    double clock_pts;
+    {
+        std::lock_guard<std::mutex> lock(audio_clock_mutex);
+        bool previous = audio_boundary_ahead();
+        clock_pos = previous ? audio_prev_clock_pos : audio_clock_pos;
+        clock_pts = previous ? audio_prev_clock_pts : audio_clock_pts;
+    }
 
-    double queued_seconds = (double)queued_bytes / (audio_spec.freq * audio_spec.channels * (SDL_AUDIO_BITSIZE(audio_spec.format) / 8));
+    // Samples still between the callback's read position and the clock anchor,
+    // plus the buffer the callback already handed to the device
+    ptrdiff_t pending = (ptrdiff_t)(clock_pos - audio_ring.read_pos.load());
+    double pending_seconds = (double)pending / (audio_spec.freq * audio_spec.channels);
+    double device_seconds = (double)audio_spec.samples / audio_spec.freq;
 
-    double corrected_time = (double)pts - queued_seconds;
+    double corrected_time = clock_pts - pending_seconds - device_seconds;
 
     if (corrected_time < 0.0)
         corrected_time = 0.0;
@@ -348,12 +750,10 @@ double audio_player_get_current_play_time() {
 }
 
 double audio_player_get_total_play_time() {
-    if (!fmt_ctx || audio_stream_index < 0) return 0.0;
-
-    int64_t duration = fmt_ctx->streams[audio_stream_index]->duration;
+    if (!audio_enabled) return 0.0;
 
-    double total_time = (double)duration * av_q2d(fmt_ctx->streams[audio_stream_index]->time_base);
-    return total_time;
+    std::lock_guard<std::mutex> lock(audio_clock_mutex);
+    return audio_boundary_ahead() ? audio_prev_total_time : audio_total_time;
 }
 
 void audio_player_audio_play(bool state) {
@@ -370,7 +770,7 @@ bool audio_player_get_audio_play_state() {
 }
 
 void audio_player_seek(float delta_time) {
-    if (!fmt_ctx || !audio_enabled) return;
+    if (!demux || !audio_enabled) return;
 
     switching_audio_stream.store(true);
     std::lock_guard<std::mutex> lock(audio_mutex);
@@ -385,51 +785,62 @@ void audio_player_seek(float delta_time) {
     if (target_time > total_time)
         target_time = total_time;
 
-    int64_t seek_target = static_cast<int64_t>(target_time / av_q2d(fmt_ctx->streams[audio_stream_index]->time_base));
+    // The decode loop flushes the codec once packets of the new position arrive
+    demuxer_seek(demux, static_cast<int64_t>(target_time * AV_TIME_BASE));
+    audio_ring_flush();
 
-    if (av_seek_frame(fmt_ctx, audio_stream_index, seek_target, AVSEEK_FLAG_BACKWARD) < 0) {
-        printf("[Audio player] Seek failed\n");
-        switching_audio_stream.store(false);
-        return;
-    }
+    audio_clock_set(audio_ring.write_pos.load(), target_time);
 
-    avcodec_flush_buffers(audio_codec_ctx);
-    SDL_ClearQueuedAudio(audio_device);
+    switching_audio_stream.store(false);
+}
 
-    if (swr_ctx) swr_init(swr_ctx);
+void audio_player_abort() {
+    if (!audio_enabled) return;
 
-    current_play_time.store(static_cast<float>(target_time));
+    // Every wait of the decode thread polls this flag or the demuxer's queues
+    audio_thread_running = false;
+    if (owns_demuxer) demuxer_abort(demux);
 
-    switching_audio_stream.store(false);
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        queue_running = false;
+        queue_path.clear();
+        queue_busy = false;
+    }
+    queue_cv.notify_all();
 }
 
-void audio_player_cleanup() {
+bool audio_player_cleanup() {
     if (!audio_enabled) {
     #ifdef DEBUG_AUDIO
-        printf("[Audio player] Audio already disabled, cleanup skipped\n");
+        log_debug("[Audio player] Audio already disabled, cleanup skipped\n");
     #endif
-        return;
+        return true;
     }
 
     #ifdef DEBUG_AUDIO
-    printf("[Audio player] Stopping Audio Player...\n");
+    log_debug("[Audio player] Stopping Audio Player...\n");
     #endif
 
-    audio_thread_running = false;
-    if (audio_thread.joinable()) {
-        audio_thread.join();
+    audio_player_abort();
+    if (!player_session_join(audio_thread, "Audio")) {
+        // Still decoding while the app exits, its codec and demuxers stay allocated
+        return false;
+    }
     #ifdef DEBUG_AUDIO
-        printf("[Audio player] Decode thread stopped\n");
+    log_debug("[Audio player] Decode thread stopped\n");
     #endif
-    }
+
+    // An open in progress finishes first, it closes what it opened by itself
+    if (!player_session_join(queue_thread, "Audio queue")) return false;
+    audio_track_close(next_track);
 
     if (audio_device != 0) {
+        // Keep the device open for the next session, it only stops pulling samples
         SDL_PauseAudioDevice(audio_device, 1);
-        SDL_ClearQueuedAudio(audio_device);
-        SDL_CloseAudioDevice(audio_device);
-        audio_device = 0;
+        audio_ring_flush();
     #ifdef DEBUG_AUDIO
-        printf("[Audio player] SDL audio device closed\n");
+        log_debug("[Audio player] Detached from the audio output (%u underruns)\n", (unsigned int)audio_underruns.load());
     #endif
     }
 
@@ -437,7 +848,7 @@ void audio_player_cleanup() {
         av_frame_free(&audio_frame);
         audio_frame = nullptr;
     #ifdef DEBUG_AUDIO
-        printf("[Audio player] Audio frame freed\n");
+        log_debug("[Audio player] Audio frame freed\n");
     #endif
     }
 
@@ -445,7 +856,7 @@ void audio_player_cleanup() {
         av_packet_free(&audio_packet);
         audio_packet = nullptr;
     #ifdef DEBUG_AUDIO
-        printf("[Audio player] Audio packet freed\n");
+        log_debug("[Audio player] Audio packet freed\n");
     #endif
     }
 
@@ -453,7 +864,7 @@ void audio_player_cleanup() {
         swr_free(&swr_ctx);
         swr_ctx = nullptr;
     #ifdef DEBUG_AUDIO
-        printf("[Audio player] Resampler freed\n");
+        log_debug("[Audio player] Resampler freed\n");
     #endif
     }
 
@@ -461,30 +872,108 @@ void audio_player_cleanup() {
         avcodec_free_context(&audio_codec_ctx);
         audio_codec_ctx = nullptr;
     #ifdef DEBUG_AUDIO
-        printf("[Audio player] Codec context freed\n");
+        log_debug("[Audio player] Codec context freed\n");
     #endif
     }
 
-    if (fmt_ctx) {
-        avformat_close_input(&fmt_ctx);
-        fmt_ctx = nullptr;
+    if (demux) {
+        if (owns_demuxer) demuxer_close(demux);
+        demux = nullptr;
+        owns_demuxer = false;
     #ifdef DEBUG_AUDIO
-        printf("[Audio player] Format context closed\n");
+        log_debug("[Audio player] Demuxer released\n");
     #endif
     }
 
-    if (SDL_WasInit(SDL_INIT_AUDIO)) {
-        SDL_QuitSubSystem(SDL_INIT_AUDIO);
+    audio_enabled = false;
+    audio_playing = false;
+    audio_stream_index = -1;
+    audio_total_time = 0.0;
+    audio_track_drained = false;
+    audio_clock_set(audio_ring.write_pos.load(), 0.0);
+    {
+        std::lock_guard<std::mutex> lock(audio_clock_mutex);
+        audio_boundary_pending = false;
+    }
     #ifdef DEBUG_AUDIO
-        printf("[Audio player] SDL audio subsystem shut down\n");
+    log_debug("[Audio player] Cleanup complete\n");
     #endif
+    return true;
+}
+
+int audio_output_open() {
+    if (audio_device) return 0;
+
+    if (SDL_WasInit(SDL_INIT_AUDIO) == 0 && SDL_InitSubSystem(SDL_INIT_AUDIO) != 0) {
+        printf("[Audio player] SDL_InitSubSystem failed: %s\n", SDL_GetError());
+        return -1;
     }
 
-    audio_enabled = false;
-    audio_playing = false;
-    audio_stream_index = -1;
-    current_play_time.store(0.0f);
+    if (!pcm_ring_init(audio_ring, RING_BUFFER_SIZE / sizeof(int16_t))) {
+        printf("[Audio player] Failed to allocate the PCM ring\n");
+        return -1;
+    }
+
+    // Latency and rate come from settings.json, the resampler converts to them
+    out_sample_rate = settings_get(SETTINGS_AUDIO_SAMPLE_RATE);
+
+    SDL_AudioSpec wanted_spec;
+    SDL_zero(wanted_spec);
+    wanted_spec.freq = out_sample_rate;
+    wanted_spec.format = AUDIO_S16SYS;
+    wanted_spec.channels = out_channels;
+    wanted_spec.samples = settings_get(SETTINGS_AUDIO_DEVICE_SAMPLES);
+    wanted_spec.callback = audio_callback;
+
+    // Fixed format, the resampler converts every file to it
+    audio_device = SDL_OpenAudioDevice(nullptr, 0, &wanted_spec, &audio_spec, 0);
+    if (!audio_device) {
+        printf("[Audio player] SDL_OpenAudioDevice failed: %s\n", SDL_GetError());
+        pcm_ring_destroy(audio_ring);
+        return -1;
+    }
+    #ifdef DEBUG_AUDIO
+    log_debug("[Audio player] Audio output opened: %d Hz, %d channels, %d samples\n",
+        audio_spec.freq, audio_spec.channels, audio_spec.samples);
+    #endif
+
+    audio_clock_set(0, 0.0);
+    return 0;
+}
+
+int audio_output_recent(int16_t* data, int frames) {
+    int channels = audio_output_channels();
+    if (!channels || frames <= 0) return 0;
+
+    size_t got = pcm_ring_peek_played(audio_ring, data, (size_t)frames * channels);
+    // The copy ends on a frame boundary, drop a partial frame at the front
+    size_t partial = got % channels;
+    if (partial) {
+        memmove(data, data + partial, (got - partial) * sizeof(int16_t));
+        got -= partial;
+    }
+    return (int)(got / channels);
+}
+
+int audio_output_channels() {
+    return audio_device ? audio_spec.channels : 0;
+}
+
+int audio_output_sample_rate() {
+    return audio_device ? audio_spec.freq : 0;
+}
+
+void audio_output_close() {
+    audio_player_cleanup();
+    // A decode thread left running may still lock the device
+    if (!audio_device || core_thread_joinable(audio_thread)) return;
+
+    SDL_PauseAudioDevice(audio_device, 1);
+    SDL_CloseAudioDevice(audio_device);
+    audio_device = 0;
+    // The callback is gone with the device
+    pcm_ring_destroy(audio_ring);
     #ifdef DEBUG_AUDIO
-    printf("[Audio player] Cleanup complete\n");
+    log_debug("[Audio player] Audio output closed\n");
     #endif
-}
\ No newline at end of file
+}
@@ -2,6 +2,7 @@
 #define AUDIO_PLAYER_H
 
 #include "main.hpp"
+#include "demuxer.hpp"
 #include <SDL2/SDL.h>
 extern "C" {
     #include <libavformat/avformat.h>
@@ -13,14 +14,42 @@ extern "C" {
 }
 
 #define RING_BUFFER_SIZE 65536 // 64KB
+// Decoding pauses above the high watermark and resumes below the low one (bytes)
+#define AUDIO_RING_HIGH_WATERMARK (RING_BUFFER_SIZE * 3 / 4)
+#define AUDIO_RING_LOW_WATERMARK (RING_BUFFER_SIZE / 4)
+#define AUDIO_RING_POLL_MS 5
+// Samples per device callback, about 21ms at 48kHz. Both are defaults, settings.json
+// may change them for the next start
+#define AUDIO_DEVICE_SAMPLES 1024
+#define AUDIO_OUTPUT_SAMPLE_RATE 48000
+
+// Opens the shared stereo device once at startup, sessions attach to it
+int audio_output_open();
+void audio_output_close();
+// Any thread, copies the interleaved frames the device was handed last, oldest
+// first. Returns how many frames the ring still had, nothing is decoded for it.
+int audio_output_recent(int16_t* data, int frames);
+int audio_output_channels();
+int audio_output_sample_rate();
 
 int audio_player_init(const char* filepath);
+int audio_player_attach(demuxer* source);
+// Has the track that plays once the current one ends opened in the background,
+// replacing any queued one. A file that fails to open simply ends the playlist.
+int audio_player_queue(const char* filepath);
+// Counts the queued tracks that became audible since audio_player_init
+int audio_player_get_track_changes();
+bool audio_player_is_finished();
 double audio_player_get_current_play_time();
 double audio_player_get_total_play_time();
 void audio_player_audio_play(bool state);
 void audio_player_seek(float delta_time);
 bool audio_player_get_audio_play_state();
-void audio_player_cleanup();
+// Any thread, lets the decode thread wind down without waiting for it
+void audio_player_abort();
+// False when the decode thread was left running at exit, whatever it reads
+// (a shared demuxer too) must then stay allocated
+bool audio_player_cleanup();
 
 extern bool audio_enabled;
 
@@ -0,0 +1,77 @@
+#include <cstdio>
+#include <cstring>
+#include <malloc.h>
+
+#include "core_thread.hpp"
+
+static int core_thread_entry(int argc, const char** argv) {
+    core_thread* t = reinterpret_cast<core_thread*>(argv);
+    t->entry(t->arg);
+    return 0;
+}
+
+bool core_thread_start(core_thread& t, const char* name, void (*entry)(void*), void* arg, int core, int priority) {
+    if (t.thread) return false;
+
+    t.thread = static_cast<OSThread*>(memalign(16, sizeof(OSThread)));
+    t.stack = static_cast<uint8_t*>(memalign(16, CORE_THREAD_STACK_SIZE));
+    if (!t.thread || !t.stack) {
+        printf("[Thread] Failed to allocate thread %s\n", name);
+        free(t.thread);
+        free(t.stack);
+        t.thread = nullptr;
+        t.stack = nullptr;
+        return false;
+    }
+    memset(t.thread, 0, sizeof(OSThread));
+
+    t.entry = entry;
+    t.arg = arg;
+
+    // The stack grows down, Cafe OS wants its top
+    if (!OSCreateThread(t.thread, core_thread_entry, 0, reinterpret_cast<char*>(&t),
+                        t.stack + CORE_THREAD_STACK_SIZE, CORE_THREAD_STACK_SIZE,
+                        priority, static_cast<OSThreadAttributes>(1 << core))) {
+        printf("[Thread] Failed to create thread %s\n", name);
+        free(t.thread);
+        free(t.stack);
+        t.thread = nullptr;
+        t.stack = nullptr;
+        return false;
+    }
+
+    OSSetThreadName(t.thread, name);
+    OSResumeThread(t.thread);
+    return true;
+}
+
+bool core_thread_joinable(const core_thread& t) {
+    return t.thread != nullptr;
+}
+
+void core_thread_join(core_thread& t) {
+    if (!t.thread) return;
+
+    int result = 0;
+    OSJoinThread(t.thread, &result);
+
+    free(t.thread);
+    free(t.stack);
+    t.thread = nullptr;
+    t.stack = nullptr;
+}
+
+bool core_thread_join_until(core_thread& t, OSTime deadline) {
+    if (!t.thread) return true;
+
+    while (!OSIsThreadTerminated(t.thread)) {
+        if (OSGetSystemTime() >= deadline) return false;
+        OSSleepTicks(OSMillisecondsToTicks(CORE_THREAD_JOIN_POLL_MS));
+    }
+    core_thread_join(t);
+    return true;
+}
+
+void core_thread_pin_current(int core) {
+    OSSetThreadAffinity(OSGetCurrentThread(), 1 << core);
+}
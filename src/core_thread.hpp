@@ -0,0 +1,57 @@
+#ifndef CORE_THREAD_H
+#define CORE_THREAD_H
+
+#include <cstdint>
+#include <coreinit/thread.h>
+#include <coreinit/time.h>
+
+// Espresso core each thread of the pipeline runs on
+#define CORE_AUDIO 0
+#define CORE_DEMUX 0
+#define CORE_MAIN 1
+#define CORE_VIDEO 2
+#define CORE_SCAN 0
+#define CORE_IO 0
+#define CORE_SUBTITLES 0
+
+// Cafe OS priorities, lower runs first. The main thread runs at 16
+#define PRIORITY_AUDIO 14
+#define PRIORITY_DEMUX 15
+#define PRIORITY_IO 15
+#define PRIORITY_VIDEO 16
+// Cues are rasterized seconds ahead, they can wait for playback
+#define PRIORITY_SUBTITLES 20
+// The next track opens while the current one still plays for minutes
+#define PRIORITY_AUDIO_QUEUE 20
+// Resume points are written a few hundred bytes at a time
+#define PRIORITY_RESUME 22
+#define PRIORITY_PROBE_CACHE 22
+// Library scanning only uses what playback leaves over
+#define PRIORITY_SCAN 24
+#define PRIORITY_THUMBNAILS 25
+
+#define CORE_THREAD_STACK_SIZE (256 * 1024)
+// Cafe OS has no timed join, a bounded join polls for the thread to end this often
+#define CORE_THREAD_JOIN_POLL_MS 2
+
+// libavcodec worker threads used for frame and slice threaded decoding. libavcodec
+// creates them itself so they cannot be pinned and float onto CORE_MAIN too, two
+// leave the UI core room while the decode thread on CORE_VIDEO mostly waits on them
+#define VIDEO_DECODE_THREADS 2
+
+struct core_thread {
+    OSThread* thread = nullptr;
+    uint8_t* stack = nullptr;
+    void (*entry)(void*) = nullptr;
+    void* arg = nullptr;
+};
+
+bool core_thread_start(core_thread& t, const char* name, void (*entry)(void*), void* arg, int core, int priority);
+bool core_thread_joinable(const core_thread& t);
+void core_thread_join(core_thread& t);
+// Joins once the thread ended, false when it still runs at deadline (system ticks),
+// it stays joinable then
+bool core_thread_join_until(core_thread& t, OSTime deadline);
+void core_thread_pin_current(int core);
+
+#endif
@@ -0,0 +1,189 @@
+#include <cstdio>
+#include <unordered_map>
+#include <jansson.h>
+
+#include "main.hpp"
+#include "decode_preflight.hpp"
+#include "settings.hpp"
+
+struct decode_cost {
+    AVCodecID codec_id;
+    // Microseconds per frame for each megapixel and for each kbit of the frame
+    double pixel_us;
+    double kbit_us;
+    // Share of the decode time spent in the loop filter, 0 when skip_loop_filter does nothing
+    double loop_filter_share;
+};
+
+// Full decode with DECODE_COST_THREADS frame threads on the Espresso, the last
+// entry covers every codec not listed. benchmark.json scales these per codec.
+static const decode_cost decode_costs[] = {
+    { AV_CODEC_ID_H264,       30000.0, 20.0, 0.30 },
+    { AV_CODEC_ID_HEVC,       45000.0, 25.0, 0.25 },
+    { AV_CODEC_ID_VP8,        28000.0, 15.0, 0.25 },
+    { AV_CODEC_ID_VP9,        40000.0, 20.0, 0.20 },
+    { AV_CODEC_ID_MPEG4,      15000.0, 10.0, 0.00 },
+    { AV_CODEC_ID_MPEG2VIDEO, 12000.0,  8.0, 0.00 },
+    { AV_CODEC_ID_MJPEG,      20000.0, 15.0, 0.00 },
+    { AV_CODEC_ID_NONE,       30000.0, 20.0, 0.00 }
+};
+
+// Measured over estimated cost by codec, from the last benchmark run
+static std::unordered_map<int, double> calibration;
+static bool calibration_loaded = false;
+
+static const decode_cost& decode_cost_for(AVCodecID codec_id) {
+    size_t count = sizeof(decode_costs) / sizeof(decode_costs[0]);
+    for (size_t i = 0; i < count - 1; ++i) {
+        if (decode_costs[i].codec_id == codec_id) return decode_costs[i];
+    }
+    return decode_costs[count - 1];
+}
+
+static double decode_profile_factor(AVCodecID codec_id, int profile) {
+    if (codec_id != AV_CODEC_ID_H264) return 1.0;
+
+    // CAVLC only, no B-frames
+    if (profile == FF_PROFILE_H264_BASELINE || profile == FF_PROFILE_H264_CONSTRAINED_BASELINE) return 0.8;
+    // 8x8 transforms, High 10 and up also leave the 8 bit fast paths
+    if (profile == FF_PROFILE_H264_HIGH) return 1.1;
+    if (profile > FF_PROFILE_H264_HIGH) return 1.6;
+    return 1.0;
+}
+
+static double decode_estimate(AVCodecID codec_id, int profile, int width, int height, int64_t bit_rate, double fps, int threads) {
+    const decode_cost& cost = decode_cost_for(codec_id);
+    double megapixels = width * (double)height / 1e6;
+    double kbit_per_frame = bit_rate > 0 && fps > 0 ? bit_rate / fps / 1000.0 : 0.0;
+    // Frame threads overlap whole pictures, the time per frame shrinks about linearly with them
+    double thread_factor = DECODE_COST_THREADS / (double)(threads > 0 ? threads : DECODE_COST_THREADS);
+    return (cost.pixel_us * megapixels + cost.kbit_us * kbit_per_frame) * decode_profile_factor(codec_id, profile) * thread_factor;
+}
+
+static void decode_load_calibration() {
+    calibration_loaded = true;
+
+    json_error_t error;
+    json_t* root = json_load_file(BENCHMARK_RESULT_PATH, 0, &error);
+    if (!root) return;
+
+    // Results carry the thread count they were measured at, older ones ran the table's
+    json_t* threads = json_object_get(root, "decode_threads");
+    int run_threads = json_is_integer(threads) ? (int)json_integer_value(threads) : DECODE_COST_THREADS;
+
+    std::unordered_map<int, int> runs;
+    json_t* files = json_object_get(root, "files");
+    for (size_t i = 0; i < json_array_size(files); ++i) {
+        json_t* file = json_array_get(files, i);
+        json_t* codec = json_object_get(file, "codec");
+        json_t* width = json_object_get(file, "width");
+        json_t* height = json_object_get(file, "height");
+        json_t* stages = json_object_get(file, "stages_per_frame");
+        json_t* decode_us = json_object_get(stages, "decode_us");
+        if (!json_is_string(codec) || !json_is_integer(width) || !json_is_integer(height) || !json_is_number(decode_us)) continue;
+
+        const AVCodecDescriptor* desc = avcodec_descriptor_get_by_name(json_string_value(codec));
+        if (!desc) continue;
+
+        // Older results have no bit rate or frame rate, the pixel term still applies
+        json_t* bit_rate = json_object_get(file, "bit_rate");
+        json_t* frame_rate = json_object_get(file, "frame_rate");
+        double estimate = decode_estimate(desc->id, FF_PROFILE_UNKNOWN,
+            (int)json_integer_value(width), (int)json_integer_value(height),
+            json_is_integer(bit_rate) ? json_integer_value(bit_rate) : 0,
+            json_is_number(frame_rate) ? json_number_value(frame_rate) : 0.0, run_threads);
+        if (estimate <= 0) continue;
+
+        // Running mean of the ratio over every file of that codec
+        double ratio = json_number_value(decode_us) / estimate;
+        int n = ++runs[desc->id];
+        calibration[desc->id] += (ratio - calibration[desc->id]) / n;
+    }
+    json_decref(root);
+
+    for (const auto& it : calibration) {
+        printf("[Preflight] %s calibrated to %.2fx the cost table\n", avcodec_get_name((AVCodecID)it.first), it.second);
+    }
+}
+
+decode_plan decode_preflight(AVFormatContext* fmt_ctx, int stream_index) {
+    if (!calibration_loaded) decode_load_calibration();
+
+    decode_plan plan;
+    AVStream* stream = fmt_ctx->streams[stream_index];
+    AVCodecParameters* codecpar = stream->codecpar;
+
+    double fps = av_q2d(stream->avg_frame_rate);
+    if (fps <= 0) fps = av_q2d(stream->r_frame_rate);
+    if (fps <= 0) fps = 30.0;
+    int64_t bit_rate = codecpar->bit_rate > 0 ? codecpar->bit_rate : fmt_ctx->bit_rate;
+
+    plan.budget = 1e6 / fps * DECODE_BUDGET_SHARE;
+    plan.full_cost = decode_estimate(codecpar->codec_id, codecpar->profile, codecpar->width, codecpar->height, bit_rate, fps,
+        settings_get(SETTINGS_DECODE_THREADS));
+    auto scale = calibration.find(codecpar->codec_id);
+    if (scale != calibration.end()) plan.full_cost *= scale->second;
+    plan.planned_cost = plan.full_cost;
+
+    const decode_cost& cost = decode_cost_for(codecpar->codec_id);
+    const AVCodec* codec = avcodec_find_decoder(codecpar->codec_id);
+
+    if (plan.planned_cost > plan.budget && cost.loop_filter_share > 0) {
+        plan.mode = DECODE_MODE_SKIP_LOOP_FILTER;
+        plan.skip_loop_filter = true;
+        plan.planned_cost *= 1.0 - cost.loop_filter_share;
+    }
+    // Without B-frames every frame is a reference, there is nothing to skip
+    if (plan.planned_cost > plan.budget && codecpar->video_delay > 0) {
+        plan.mode = DECODE_MODE_SKIP_NONREF;
+        plan.skip_nonref = true;
+        plan.planned_cost *= 1.0 - DECODE_NONREF_SHARE;
+    }
+    if (plan.planned_cost > plan.budget && codec && codec->max_lowres > 0) {
+        plan.mode = DECODE_MODE_LOWRES;
+        plan.lowres = 1;
+        plan.planned_cost *= DECODE_LOWRES_FACTOR;
+    }
+    if (plan.planned_cost > plan.budget) plan.mode = DECODE_MODE_OVER_BUDGET;
+
+    printf("[Preflight] %s %dx%d @ %.2f fps, %lld kbit/s: %.0f us of %.0f us per frame, %s\n",
+        avcodec_get_name(codecpar->codec_id), codecpar->width, codecpar->height, fps,
+        (long long)(bit_rate / 1000), plan.planned_cost, plan.budget, decode_mode_name(plan.mode));
+
+    return plan;
+}
+
+void decode_preflight_force(decode_plan& plan, const AVCodecParameters* codecpar, decode_mode mode) {
+    const decode_cost& cost = decode_cost_for(codecpar->codec_id);
+    const AVCodec* codec = avcodec_find_decoder(codecpar->codec_id);
+
+    // Same steps the estimate escalates through, each mode includes the ones before it
+    plan.mode = mode;
+    plan.skip_loop_filter = mode >= DECODE_MODE_SKIP_LOOP_FILTER;
+    plan.skip_nonref = mode >= DECODE_MODE_SKIP_NONREF;
+    plan.lowres = mode >= DECODE_MODE_LOWRES && codec && codec->max_lowres > 0 ? 1 : 0;
+
+    plan.planned_cost = plan.full_cost;
+    if (plan.skip_loop_filter) plan.planned_cost *= 1.0 - cost.loop_filter_share;
+    if (plan.skip_nonref) plan.planned_cost *= 1.0 - DECODE_NONREF_SHARE;
+    if (plan.lowres) plan.planned_cost *= DECODE_LOWRES_FACTOR;
+
+    printf("[Preflight] %s set in settings.json\n", decode_mode_name(mode));
+}
+
+void decode_preflight_apply(AVCodecContext* codec_ctx, const decode_plan& plan) {
+    if (plan.skip_loop_filter) codec_ctx->skip_loop_filter = AVDISCARD_ALL;
+    if (plan.skip_nonref) codec_ctx->skip_frame = AVDISCARD_NONREF;
+    codec_ctx->lowres = plan.lowres;
+}
+
+const char* decode_mode_name(decode_mode mode) {
+    switch (mode) {
+        case DECODE_MODE_FULL: return "full decode";
+        case DECODE_MODE_SKIP_LOOP_FILTER: return "loop filter skipped";
+        case DECODE_MODE_SKIP_NONREF: return "non-reference frames skipped";
+        case DECODE_MODE_LOWRES: return "half resolution";
+        case DECODE_MODE_OVER_BUDGET: return "over budget";
+    }
+    return "unknown";
+}
@@ -0,0 +1,49 @@
+#ifndef DECODE_PREFLIGHT_H
+#define DECODE_PREFLIGHT_H
+
+extern "C" {
+    #include <libavformat/avformat.h>
+    #include <libavcodec/avcodec.h>
+}
+
+// Share of the frame interval decoding may take, the rest is upload and UI
+#define DECODE_BUDGET_SHARE 0.85
+// Decode threads the cost table was put together with
+#define DECODE_COST_THREADS 3
+// Share of the frames skipped as non-reference in streams with B-frames
+#define DECODE_NONREF_SHARE 0.35
+// Cost left after halving both dimensions with lowres, entropy decoding stays
+#define DECODE_LOWRES_FACTOR 0.35
+
+// Cheapest mode first, every step keeps the savings of the ones before it
+// where the codec supports them
+enum decode_mode {
+    DECODE_MODE_FULL,
+    DECODE_MODE_SKIP_LOOP_FILTER,
+    DECODE_MODE_SKIP_NONREF,
+    DECODE_MODE_LOWRES,
+    // Nothing fits, plays with every reduction and drops frames
+    DECODE_MODE_OVER_BUDGET
+};
+
+struct decode_plan {
+    decode_mode mode = DECODE_MODE_FULL;
+    bool skip_loop_filter = false;
+    bool skip_nonref = false;
+    int lowres = 0;
+    // Microseconds per frame
+    double full_cost = 0.0;
+    double planned_cost = 0.0;
+    double budget = 0.0;
+};
+
+// Estimates the decode cost of the stream from its codec, profile, resolution,
+// frame rate and bit rate, and picks the first mode that fits the frame interval
+decode_plan decode_preflight(AVFormatContext* fmt_ctx, int stream_index);
+// Replaces the picked mode with a fixed one, as far as the decoder supports it
+void decode_preflight_force(decode_plan& plan, const AVCodecParameters* codecpar, decode_mode mode);
+// Before avcodec_open2, lowres changes the dimensions the codec opens with
+void decode_preflight_apply(AVCodecContext* codec_ctx, const decode_plan& plan);
+const char* decode_mode_name(decode_mode mode);
+
+#endif
@@ -0,0 +1,482 @@
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <coreinit/time.h>
+
+#include "demuxer.hpp"
+#include "probe_cache.hpp"
+#include "perf.hpp"
+#include "settings.hpp"
+#include "log.hpp"
+#include "player_session.hpp"
+
+static void packet_queue_put(packet_queue& queue, AVPacket* pkt) {
+    AVPacket* entry = media_pool_get_packet(*queue.pool);
+    if (!entry) {
+        av_packet_unref(pkt);
+        return;
+    }
+    av_packet_move_ref(entry, pkt);
+
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.bytes += entry->size;
+        queue.packets.push({ entry, queue.serial });
+    }
+    queue.cv.notify_one();
+}
+
+static void packet_queue_clear(packet_queue& queue) {
+    while (!queue.packets.empty()) {
+        AVPacket* entry = queue.packets.front().pkt;
+        media_pool_put_packet(*queue.pool, entry);
+        queue.packets.pop();
+    }
+    queue.bytes = 0;
+}
+
+static void packet_queue_flush(packet_queue& queue, int64_t seek_target) {
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        packet_queue_clear(queue);
+        queue.serial++;
+        queue.seek_target = seek_target;
+        queue.eof = false;
+    }
+    queue.cv.notify_all();
+}
+
+static void packet_queue_set_eof(packet_queue& queue) {
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.eof = true;
+    }
+    queue.cv.notify_all();
+}
+
+static void packet_queue_abort(packet_queue& queue) {
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.abort = true;
+    }
+    queue.cv.notify_all();
+}
+
+packet_queue_result packet_queue_pop(demuxer* demux, packet_queue& queue, AVPacket* pkt, int* serial, bool block) {
+    {
+        std::unique_lock<std::mutex> lock(queue.mutex);
+        if (block) {
+            queue.cv.wait(lock, [&queue, demux] {
+                return queue.abort || queue.eof || (!queue.packets.empty() && !demux->buffering);
+            });
+        }
+
+        if (queue.abort) return PACKET_QUEUE_ABORTED;
+        if (queue.packets.empty()) {
+            // The serial that ended, a seek clears the end again
+            if (queue.eof && serial) *serial = queue.serial;
+            return queue.eof ? PACKET_QUEUE_EOF : PACKET_QUEUE_EMPTY;
+        }
+        // Network pre-roll, nothing leaves the queue until enough is buffered
+        if (demux->buffering && !queue.eof) return PACKET_QUEUE_EMPTY;
+
+        queued_packet entry = queue.packets.front();
+        queue.packets.pop();
+        queue.bytes -= entry.pkt->size;
+
+        av_packet_move_ref(pkt, entry.pkt);
+        media_pool_put_packet(*queue.pool, entry.pkt);
+        if (serial) *serial = entry.serial;
+    }
+
+    // Wake the demuxer thread in case it is waiting for free queue space
+    { std::lock_guard<std::mutex> lock(demux->mutex); }
+    demux->cv.notify_one();
+
+    return PACKET_QUEUE_OK;
+}
+
+int packet_queue_size(packet_queue& queue) {
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    return (int)queue.packets.size();
+}
+
+int64_t packet_queue_seek_target(packet_queue& queue) {
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    return queue.seek_target;
+}
+
+static void demuxer_add_keyframe(demuxer* demux, int64_t timestamp) {
+    if (timestamp == AV_NOPTS_VALUE) return;
+
+    // Packets mostly arrive in order, appending is the common case
+    if (demux->keyframes.empty() || demux->keyframes.back() < timestamp) {
+        demux->keyframes.push_back(timestamp);
+        return;
+    }
+
+    auto it = std::lower_bound(demux->keyframes.begin(), demux->keyframes.end(), timestamp);
+    if (it == demux->keyframes.end() || *it != timestamp) demux->keyframes.insert(it, timestamp);
+}
+
+static void demuxer_index_keyframes(demuxer* demux) {
+    demux->keyframes.clear();
+
+    int stream_index = demux->video_queue.stream_index;
+    if (stream_index < 0) return;
+
+    AVStream* stream = demux->fmt_ctx->streams[stream_index];
+    int count = avformat_index_get_entries_count(stream);
+    demux->keyframes.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        const AVIndexEntry* entry = avformat_index_get_entry(stream, i);
+        if (entry && (entry->flags & AVINDEX_KEYFRAME)) demuxer_add_keyframe(demux, entry->timestamp);
+    }
+}
+
+// Jump straight to the last keyframe at or before the target when we know one.
+// With to_keyframe the target moves back to that keyframe.
+static int demuxer_seek_keyframe(demuxer* demux, int64_t& target_time, bool to_keyframe) {
+    int stream_index = demux->video_queue.stream_index;
+
+    if (stream_index >= 0 && !demux->keyframes.empty()) {
+        AVRational time_base = demux->fmt_ctx->streams[stream_index]->time_base;
+        int64_t target_ts = av_rescale_q(target_time, AVRational{ 1, AV_TIME_BASE }, time_base);
+
+        auto it = std::upper_bound(demux->keyframes.begin(), demux->keyframes.end(), target_ts);
+        if (it != demux->keyframes.begin()) {
+            int64_t keyframe_ts = *(it - 1);
+            if (avformat_seek_file(demux->fmt_ctx, stream_index, INT64_MIN, keyframe_ts, keyframe_ts, 0) >= 0) {
+                if (to_keyframe) target_time = av_rescale_q(keyframe_ts, time_base, AVRational{ 1, AV_TIME_BASE });
+                return 0;
+            }
+        }
+    }
+
+    return avformat_seek_file(demux->fmt_ctx, -1, INT64_MIN, target_time, target_time, 0);
+}
+
+static size_t packet_queue_bytes(packet_queue& queue) {
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    return queue.bytes;
+}
+
+// Bytes per second the stream consumes, from the container when it knows
+static double demuxer_media_rate(demuxer* demux) {
+    return demux->fmt_ctx->bit_rate > 0 ? demux->fmt_ctx->bit_rate / 8.0 : (double)NET_DEFAULT_RATE;
+}
+
+static size_t demuxer_preroll_bytes(demuxer* demux) {
+    return std::min((size_t)(demuxer_media_rate(demux) * NET_PREROLL_SECONDS), demux->buffer_target);
+}
+
+static void demuxer_end_preroll(demuxer* demux) {
+    if (!demux->buffering) return;
+    demux->buffering = false;
+
+    // Waiters check the flag under their queue's lock
+    for (packet_queue* queue : { &demux->video_queue, &demux->audio_queue, &demux->subtitle_queue }) {
+        { std::lock_guard<std::mutex> lock(queue->mutex); }
+        queue->cv.notify_all();
+    }
+}
+
+// Sizes the buffer from the measured read bandwidth: a link with little headroom over
+// the media rate buffers more seconds, a fast one just enough to ride out hiccups
+static void demuxer_update_network(demuxer* demux, size_t bytes, uint64_t read_us) {
+    demux->window_bytes += bytes;
+    demux->window_us += read_us;
+
+    if (demux->window_bytes >= NET_BANDWIDTH_WINDOW && demux->window_us > 0) {
+        double measured = demux->window_bytes * 1e6 / demux->window_us;
+        demux->bandwidth = demux->bandwidth > 0 ? demux->bandwidth * 0.7 + measured * 0.3 : measured;
+        demux->window_bytes = 0;
+        demux->window_us = 0;
+
+        double rate = demuxer_media_rate(demux);
+        double headroom = demux->bandwidth / rate;
+        double seconds = headroom >= 2.0 ? NET_BUFFER_SECONDS_MIN :
+                         headroom <= 1.0 ? NET_BUFFER_SECONDS_MAX :
+                         NET_BUFFER_SECONDS_MAX - (headroom - 1.0) * (NET_BUFFER_SECONDS_MAX - NET_BUFFER_SECONDS_MIN);
+        demux->buffer_target = std::clamp((size_t)(rate * seconds), std::min(demux->max_queue_bytes, (size_t)NET_BUFFER_MAX_BYTES), (size_t)NET_BUFFER_MAX_BYTES);
+    }
+
+    size_t queued = packet_queue_bytes(demux->video_queue) + packet_queue_bytes(demux->audio_queue);
+    size_t preroll = demuxer_preroll_bytes(demux);
+    if (demux->buffering && queued >= preroll) demuxer_end_preroll(demux);
+
+    perf_set(PERF_GAUGE_NET_KBPS, (int32_t)(demux->bandwidth * 8 / 1000));
+    perf_set(PERF_GAUGE_NET_BUFFERED_KB, (int32_t)(queued / 1024));
+    perf_set(PERF_GAUGE_NET_TARGET_KB, (int32_t)(demux->buffer_target / 1024));
+    perf_set(PERF_GAUGE_NET_PREROLL, demux->buffering ? (int32_t)(queued * 100 / std::max<size_t>(preroll, 1)) : 100);
+}
+
+static bool packet_queue_has_enough(packet_queue& queue, size_t& total_bytes) {
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    total_bytes += queue.bytes;
+    return queue.stream_index < 0 || queue.packets.size() >= DEMUXER_MIN_QUEUE_PACKETS;
+}
+
+static bool demuxer_queues_full(demuxer* demux) {
+    size_t total_bytes = 0;
+    bool video_full = packet_queue_has_enough(demux->video_queue, total_bytes);
+    bool audio_full = packet_queue_has_enough(demux->audio_queue, total_bytes);
+    // Network sources go by bytes only, packet counts say nothing about seconds buffered
+    if (demux->network) return total_bytes >= demux->buffer_target;
+    return total_bytes > demux->max_queue_bytes || (video_full && audio_full);
+}
+
+static void demuxer_thread(void* arg) {
+    demuxer* demux = static_cast<demuxer*>(arg);
+    AVPacket* pkt = av_packet_alloc();
+    bool eof = false;
+
+    while (demux->running) {
+        bool do_seek = false;
+        bool seek_to_keyframe = false;
+        int64_t seek_target = 0;
+
+        {
+            std::unique_lock<std::mutex> lock(demux->mutex);
+            demux->cv.wait(lock, [demux, eof] {
+                return !demux->running || demux->seek_requested || (!eof && !demuxer_queues_full(demux));
+            });
+
+            if (!demux->running) break;
+
+            if (demux->seek_requested) {
+                do_seek = true;
+                seek_target = demux->seek_target;
+                seek_to_keyframe = demux->seek_to_keyframe;
+                demux->seek_requested = false;
+            }
+        }
+
+        if (do_seek) {
+            if (demuxer_seek_keyframe(demux, seek_target, seek_to_keyframe) < 0) {
+                printf("[Demuxer] Seek to %lld failed\n", (long long)seek_target);
+            }
+            // Flush even when the seek failed, decoders wait for the new serial
+            if (demux->network) demux->buffering = true;
+            packet_queue_flush(demux->video_queue, seek_target);
+            packet_queue_flush(demux->audio_queue, seek_target);
+            packet_queue_flush(demux->subtitle_queue, seek_target);
+            eof = false;
+            continue;
+        }
+
+        OSTime read_ticks = OSGetSystemTime();
+        int read_result = av_read_frame(demux->fmt_ctx, pkt);
+        uint64_t read_us = OSTicksToMicroseconds(OSGetSystemTime() - read_ticks);
+        perf_record(PERF_TIMER_DEMUX, read_us);
+
+        if (read_result < 0) {
+            eof = true;
+            packet_queue_set_eof(demux->video_queue);
+            packet_queue_set_eof(demux->audio_queue);
+            packet_queue_set_eof(demux->subtitle_queue);
+            // Whatever made it into the queues is all there is
+            demuxer_end_preroll(demux);
+            continue;
+        }
+
+        size_t packet_size = pkt->size;
+
+        if (pkt->stream_index == demux->video_queue.stream_index) {
+            if (pkt->flags & AV_PKT_FLAG_KEY) demuxer_add_keyframe(demux, pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts);
+            packet_queue_put(demux->video_queue, pkt);
+        } else if (pkt->stream_index == demux->audio_queue.stream_index) {
+            packet_queue_put(demux->audio_queue, pkt);
+        } else if (pkt->stream_index == demux->subtitle_queue.stream_index) {
+            // Sparse and tiny, never counted towards the queue limits
+            packet_queue_put(demux->subtitle_queue, pkt);
+        } else {
+            av_packet_unref(pkt);
+        }
+
+        perf_set(PERF_GAUGE_POOL_PACKETS, demux->pool.packets_high_water);
+        perf_set(PERF_GAUGE_POOL_MISSES, (int32_t)demux->pool.misses);
+
+        if (demux->network) demuxer_update_network(demux, packet_size, read_us);
+    }
+
+    av_packet_free(&pkt);
+}
+
+static int demuxer_interrupt(void* opaque) {
+    return static_cast<demuxer*>(opaque)->interrupted ? 1 : 0;
+}
+
+// Reconnects and persistent connections for HTTP, parallel segment downloads for HLS
+static void demuxer_network_options(AVDictionary** options) {
+    av_dict_set(options, "reconnect", "1", 0);
+    av_dict_set(options, "reconnect_streamed", "1", 0);
+    av_dict_set(options, "reconnect_delay_max", "5", 0);
+    av_dict_set(options, "rw_timeout", NET_TIMEOUT_US, 0);
+    av_dict_set(options, "http_persistent", "1", 0);
+    av_dict_set(options, "http_multiple", "1", 0);
+}
+
+demuxer* demuxer_open(const char* filepath, AVDictionary** options) {
+    demuxer* demux = new demuxer;
+    media_pool_init(demux->pool);
+    demux->video_queue.pool = &demux->pool;
+    demux->audio_queue.pool = &demux->pool;
+    demux->subtitle_queue.pool = &demux->pool;
+    demux->max_queue_bytes = (size_t)settings_get(SETTINGS_PACKET_QUEUE_MB) * 1024 * 1024;
+    demux->buffer_target = demux->max_queue_bytes;
+
+    uint64_t start_ticks = OSGetSystemTime();
+
+    demux->fmt_ctx = avformat_alloc_context();
+    // Lets demuxer_abort break out of a blocking network read
+    demux->fmt_ctx->interrupt_callback.callback = demuxer_interrupt;
+    demux->fmt_ctx->interrupt_callback.opaque = demux;
+
+    AVDictionary* open_options = nullptr;
+    if (options) av_dict_copy(&open_options, *options, 0);
+
+    demux->network = strstr(filepath, "://") != nullptr;
+    if (demux->network) {
+        demuxer_network_options(&open_options);
+        demux->buffering = true;
+    } else {
+        // Local files go through the read-ahead ring, libavformat only sees big buffered reads
+        demux->io = read_ahead_open(filepath);
+    }
+    if (demux->io) {
+        demux->fmt_ctx->pb = demux->io->avio;
+        demux->fmt_ctx->flags |= AVFMT_FLAG_CUSTOM_IO;
+    }
+
+    int open_result = avformat_open_input(&demux->fmt_ctx, filepath, nullptr, &open_options);
+    av_dict_free(&open_options);
+    if (open_result != 0) {
+        printf("[Demuxer] Could not open input: %s\n", filepath);
+        read_ahead_close(demux->io);
+        media_pool_destroy(demux->pool);
+        delete demux;
+        return nullptr;
+    }
+    uint64_t open_ticks = OSGetSystemTime();
+    demux->open_us = OSTicksToMicroseconds(open_ticks - start_ticks);
+
+    // Probing decodes frames of every stream, skip it for files seen before
+    demux->probe_cached = probe_cache_apply(demux->fmt_ctx, filepath);
+    if (!demux->probe_cached) {
+        if (avformat_find_stream_info(demux->fmt_ctx, nullptr) < 0) {
+            printf("[Demuxer] Could not find stream info: %s\n", filepath);
+            avformat_close_input(&demux->fmt_ctx);
+            read_ahead_close(demux->io);
+            media_pool_destroy(demux->pool);
+            delete demux;
+            return nullptr;
+        }
+    }
+    demux->probe_us = OSTicksToMicroseconds(OSGetSystemTime() - open_ticks);
+    if (!demux->probe_cached) probe_cache_store(demux->fmt_ctx, filepath);
+
+    return demux;
+}
+
+void demuxer_enable_stream(demuxer* demux, AVMediaType type, int stream_index) {
+    if (!demux || stream_index < 0 || stream_index >= (int)demux->fmt_ctx->nb_streams) return;
+
+    packet_queue& queue = type == AVMEDIA_TYPE_VIDEO ? demux->video_queue :
+                          type == AVMEDIA_TYPE_SUBTITLE ? demux->subtitle_queue : demux->audio_queue;
+
+    bool changed = false;
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        changed = queue.stream_index >= 0 && queue.stream_index != stream_index;
+        queue.stream_index = stream_index;
+    }
+    demux->fmt_ctx->streams[stream_index]->discard = AVDISCARD_DEFAULT;
+
+    // Packets of the previous stream are useless to the new decoder
+    if (changed) packet_queue_flush(queue, AV_NOPTS_VALUE);
+}
+
+void demuxer_start(demuxer* demux) {
+    if (!demux || demux->running) return;
+
+    // Let libavformat skip the streams nobody decodes
+    for (unsigned int i = 0; i < demux->fmt_ctx->nb_streams; ++i) {
+        if ((int)i != demux->video_queue.stream_index && (int)i != demux->audio_queue.stream_index &&
+            (int)i != demux->subtitle_queue.stream_index) {
+            demux->fmt_ctx->streams[i]->discard = AVDISCARD_ALL;
+        }
+    }
+
+    demuxer_index_keyframes(demux);
+    #ifdef DEBUG_VIDEO
+    log_debug("[Demuxer] %d keyframes indexed\n", (int)demux->keyframes.size());
+    #endif
+
+    demux->running = true;
+    if (!core_thread_start(demux->thread, "cafemp demuxer", demuxer_thread, demux, CORE_DEMUX, PRIORITY_DEMUX)) {
+        demux->running = false;
+    }
+}
+
+void demuxer_seek(demuxer* demux, int64_t target_time, bool to_keyframe) {
+    if (!demux) return;
+
+    {
+        std::lock_guard<std::mutex> lock(demux->mutex);
+        demux->seek_requested = true;
+        demux->seek_target = target_time;
+        demux->seek_to_keyframe = to_keyframe;
+    }
+    demux->cv.notify_one();
+}
+
+void demuxer_abort(demuxer* demux) {
+    if (!demux) return;
+
+    packet_queue_abort(demux->video_queue);
+    packet_queue_abort(demux->audio_queue);
+    packet_queue_abort(demux->subtitle_queue);
+    // A read blocked on the SD card or the network must not hold up the demuxer thread
+    read_ahead_abort(demux->io);
+    demux->interrupted = true;
+
+    {
+        std::lock_guard<std::mutex> lock(demux->mutex);
+        demux->running = false;
+    }
+    demux->cv.notify_all();
+}
+
+void demuxer_close(demuxer*& demux) {
+    if (!demux) return;
+
+    demuxer_abort(demux);
+    if (!player_session_join(demux->thread, "Demuxer")) {
+        // Still inside a read while the app exits, never free under it
+        demux = nullptr;
+        return;
+    }
+
+    packet_queue_clear(demux->video_queue);
+    packet_queue_clear(demux->audio_queue);
+    packet_queue_clear(demux->subtitle_queue);
+    media_pool_destroy(demux->pool);
+
+    if (demux->fmt_ctx) {
+        avformat_close_input(&demux->fmt_ctx);
+    }
+    // Custom I/O outlives the format context, libavformat never frees it
+    read_ahead_close(demux->io);
+
+    if (demux->network) {
+        perf_set(PERF_GAUGE_NET_KBPS, 0);
+        perf_set(PERF_GAUGE_NET_BUFFERED_KB, 0);
+        perf_set(PERF_GAUGE_NET_TARGET_KB, 0);
+        perf_set(PERF_GAUGE_NET_PREROLL, 0);
+    }
+
+    delete demux;
+    demux = nullptr;
+}
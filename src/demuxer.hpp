@@ -0,0 +1,117 @@
+#ifndef DEMUXER_H
+#define DEMUXER_H
+
+#include <queue>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+extern "C" {
+    #include <libavformat/avformat.h>
+    #include <libavcodec/avcodec.h>
+}
+
+#include "core_thread.hpp"
+#include "read_ahead.hpp"
+#include "media_pool.hpp"
+
+// Upper bound for the bytes held by all packet queues of one demuxer
+#define DEMUXER_MAX_QUEUE_BYTES (8 * 1024 * 1024)
+// Each active queue holding this many packets counts as "full enough"
+#define DEMUXER_MIN_QUEUE_PACKETS 32
+
+// Network sources buffer this many seconds of media, more the closer the link
+// bandwidth gets to the media rate
+#define NET_BUFFER_SECONDS_MIN 5
+#define NET_BUFFER_SECONDS_MAX 20
+#define NET_BUFFER_MAX_BYTES (32 * 1024 * 1024)
+// Decoders wait for this much media after opening or seeking a network source
+#define NET_PREROLL_SECONDS 2
+// Media rate assumed while the container does not tell (bytes per second)
+#define NET_DEFAULT_RATE (512 * 1024)
+// Bytes read between two bandwidth estimates
+#define NET_BANDWIDTH_WINDOW (256 * 1024)
+// A connection stalled for this long is given up (microseconds)
+#define NET_TIMEOUT_US "10000000"
+
+enum packet_queue_result {
+    PACKET_QUEUE_OK,
+    PACKET_QUEUE_EMPTY,
+    PACKET_QUEUE_EOF,
+    PACKET_QUEUE_ABORTED
+};
+
+struct queued_packet {
+    AVPacket* pkt;
+    int serial;
+};
+
+struct packet_queue {
+    std::queue<queued_packet> packets;
+    std::mutex mutex;
+    std::condition_variable cv;
+    size_t bytes = 0;
+    int stream_index = -1;
+    int serial = 0;
+    // Where the seek that started the current serial wanted to land (AV_TIME_BASE units)
+    int64_t seek_target = AV_NOPTS_VALUE;
+    bool eof = false;
+    bool abort = false;
+    // Entries come from and go back to their demuxer's pool
+    media_pool* pool = nullptr;
+};
+
+struct demuxer {
+    AVFormatContext* fmt_ctx = nullptr;
+    read_ahead* io = nullptr;
+    media_pool pool;
+    packet_queue video_queue;
+    packet_queue audio_queue;
+    packet_queue subtitle_queue;
+
+    core_thread thread;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::atomic<bool> running = false;
+
+    bool seek_requested = false;
+    int64_t seek_target = 0;
+    // Start decoding at the keyframe itself instead of skipping up to the target
+    bool seek_to_keyframe = false;
+
+    // Sorted video keyframe timestamps (stream time base), from the container
+    // index and extended by every keyframe the demuxer reads. Demuxer thread only.
+    std::vector<int64_t> keyframes;
+
+    // Network sources only fill up to buffer_target and hold the decoders back
+    // while buffering (after opening and after every seek). Demuxer thread only
+    // except for the atomics.
+    bool network = false;
+    std::atomic<bool> buffering = false;
+    std::atomic<bool> interrupted = false;
+    // Local sources stop reading past this, from settings.json
+    size_t max_queue_bytes = DEMUXER_MAX_QUEUE_BYTES;
+    size_t buffer_target = DEMUXER_MAX_QUEUE_BYTES;
+    double bandwidth = 0.0; // Bytes per second while reading
+    size_t window_bytes = 0;
+    uint64_t window_us = 0;
+
+    // Time to first frame instrumentation, microseconds
+    uint64_t open_us = 0;
+    uint64_t probe_us = 0;
+    bool probe_cached = false;
+};
+
+demuxer* demuxer_open(const char* filepath, AVDictionary** options);
+void demuxer_enable_stream(demuxer* demux, AVMediaType type, int stream_index);
+void demuxer_start(demuxer* demux);
+void demuxer_seek(demuxer* demux, int64_t target_time, bool to_keyframe = false);
+void demuxer_abort(demuxer* demux);
+void demuxer_close(demuxer*& demux);
+
+// serial is the packet's, or on PACKET_QUEUE_EOF the serial that ran out
+packet_queue_result packet_queue_pop(demuxer* demux, packet_queue& queue, AVPacket* pkt, int* serial, bool block);
+int64_t packet_queue_seek_target(packet_queue& queue);
+int packet_queue_size(packet_queue& queue);
+
+#endif
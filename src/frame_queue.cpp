@@ -0,0 +1,98 @@
+#include "frame_queue.hpp"
+
+bool frame_queue_init(frame_queue& queue, int capacity) {
+    std::lock_guard<std::mutex> lock(queue.mutex);
+
+    if (capacity < 1) capacity = 1;
+    if (capacity > FRAME_QUEUE_MAX_SIZE) capacity = FRAME_QUEUE_MAX_SIZE;
+
+    for (int i = 0; i < capacity; ++i) {
+        if (!queue.frames[i]) queue.frames[i] = av_frame_alloc();
+        if (!queue.frames[i]) return false;
+    }
+
+    queue.capacity = capacity;
+    queue.read_index = 0;
+    queue.write_index = 0;
+    queue.size = 0;
+    queue.abort = false;
+    return true;
+}
+
+void frame_queue_destroy(frame_queue& queue) {
+    std::lock_guard<std::mutex> lock(queue.mutex);
+
+    for (int i = 0; i < FRAME_QUEUE_MAX_SIZE; ++i) {
+        if (queue.frames[i]) av_frame_free(&queue.frames[i]);
+    }
+
+    queue.capacity = 0;
+    queue.read_index = 0;
+    queue.write_index = 0;
+    queue.size = 0;
+}
+
+AVFrame* frame_queue_peek_writable(frame_queue& queue) {
+    std::unique_lock<std::mutex> lock(queue.mutex);
+    queue.cv.wait(lock, [&queue] { return queue.abort || queue.size < queue.capacity; });
+
+    if (queue.abort) return nullptr;
+    return queue.frames[queue.write_index];
+}
+
+void frame_queue_push(frame_queue& queue) {
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.write_index = (queue.write_index + 1) % queue.capacity;
+        queue.size++;
+    }
+    queue.cv.notify_one();
+}
+
+AVFrame* frame_queue_peek(frame_queue& queue) {
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.size < 1) return nullptr;
+    return queue.frames[queue.read_index];
+}
+
+AVFrame* frame_queue_peek_next(frame_queue& queue) {
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.size < 2) return nullptr;
+    return queue.frames[(queue.read_index + 1) % queue.capacity];
+}
+
+void frame_queue_pop(frame_queue& queue) {
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.size < 1) return;
+        av_frame_unref(queue.frames[queue.read_index]);
+        queue.read_index = (queue.read_index + 1) % queue.capacity;
+        queue.size--;
+    }
+    queue.cv.notify_one();
+}
+
+int frame_queue_size(frame_queue& queue) {
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    return queue.size;
+}
+
+void frame_queue_flush(frame_queue& queue) {
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        while (queue.size > 0) {
+            av_frame_unref(queue.frames[queue.read_index]);
+            queue.read_index = (queue.read_index + 1) % queue.capacity;
+            queue.size--;
+        }
+    }
+    queue.cv.notify_one();
+}
+
+void frame_queue_abort(frame_queue& queue) {
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.abort = true;
+    }
+    queue.cv.notify_all();
+}
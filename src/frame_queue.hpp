@@ -0,0 +1,38 @@
+#ifndef FRAME_QUEUE_H
+#define FRAME_QUEUE_H
+
+#include <mutex>
+#include <condition_variable>
+extern "C" {
+    #include <libavutil/frame.h>
+}
+
+#define FRAME_QUEUE_MAX_SIZE 16
+
+// Fixed capacity ring of preallocated frames shared by one producer and one consumer.
+// The producer fills the slot returned by frame_queue_peek_writable() and publishes it
+// with frame_queue_push(); the consumer reads frame_queue_peek() and releases it with
+// frame_queue_pop(). Slots are only touched outside the lock by the side that owns them.
+struct frame_queue {
+    AVFrame* frames[FRAME_QUEUE_MAX_SIZE] = {};
+    int capacity = 0;
+    int read_index = 0;
+    int write_index = 0;
+    int size = 0;
+    bool abort = false;
+    std::mutex mutex;
+    std::condition_variable cv;
+};
+
+bool frame_queue_init(frame_queue& queue, int capacity);
+void frame_queue_destroy(frame_queue& queue);
+AVFrame* frame_queue_peek_writable(frame_queue& queue);
+void frame_queue_push(frame_queue& queue);
+AVFrame* frame_queue_peek(frame_queue& queue);
+AVFrame* frame_queue_peek_next(frame_queue& queue);
+void frame_queue_pop(frame_queue& queue);
+int frame_queue_size(frame_queue& queue);
+void frame_queue_flush(frame_queue& queue);
+void frame_queue_abort(frame_queue& queue);
+
+#endif
@@ -10,6 +10,9 @@
 #include "media_files.hpp"
 #include "audio_player.hpp"
 #include "video_player.hpp"
+#include "perf.hpp"
+#include "subtitles.hpp"
+#include "menu.hpp"
 #include "input.hpp"
 
 bool use_wpad_pro = false;
@@ -18,7 +21,7 @@ float touch_y = 0.0f;
 bool touched = false;
 
 void input_menu(VPADStatus* vpad_status, WPADStatusProController* wpad_status, int& current_page_file_browser, int& selected_index) {
-    int total_items = static_cast<int>(get_media_files().size());
+    int total_items = static_cast<int>(get_media_files()->size());
     int total_pages = (total_items + ITEMS_PER_PAGE - 1) / ITEMS_PER_PAGE;
 
     int start = current_page_file_browser * ITEMS_PER_PAGE;
@@ -90,9 +93,28 @@ void input_menu(VPADStatus* vpad_status, WPADStatusProController* wpad_status, i
     } else if(vpad_status->trigger == VPAD_BUTTON_PLUS
                 || wpad_status->buttons == WPAD_PRO_BUTTON_PLUS) {
             app_state_set(STATE_SETTINGS);
+    } else if (ui_background_audio_active()
+                && (vpad_status->trigger == VPAD_BUTTON_B || wpad_status->buttons == WPAD_PRO_BUTTON_B)) {
+        ui_stop_background_audio();
     }
 }
 
+// Background audio controls, shared by the file browser and the settings
+static bool input_mini_player(VPADStatus* vpad_status, WPADStatusProController* wpad_status) {
+    if (!ui_background_audio_active()) return false;
+
+    if (vpad_status->trigger == VPAD_BUTTON_X
+        || wpad_status->buttons == WPAD_PRO_BUTTON_X) {
+        audio_player_audio_play(!audio_player_get_audio_play_state());
+        return true;
+    } else if (vpad_status->trigger == VPAD_BUTTON_ZR
+        || wpad_status->buttons == WPAD_PRO_TRIGGER_ZR) {
+        ui_open_audio_player();
+        return true;
+    }
+    return false;
+}
+
 void input_use_wpad(bool state) {
     use_wpad_pro = state;
 }
@@ -137,17 +159,16 @@ void input_video_player(VPADStatus* vpad_status, WPADStatusProController* wpad_s
         video_player_play(!video_player_is_playing());
     } else if (vpad_status->trigger == VPAD_BUTTON_B
         || wpad_status->buttons == WPAD_PRO_BUTTON_B) {
-        audio_player_audio_play(true);
-        video_player_play(true);
         video_player_cleanup();
-        audio_player_audio_play(false);
-        video_player_play(false);
         scan_directory(MEDIA_PATH);
         app_state_set(STATE_MENU);
     } else if (vpad_status->trigger == VPAD_BUTTON_LEFT) {
-        // video_player_seek(-5.0f);
+        video_player_seek(-VIDEO_SEEK_STEP);
     } else if (vpad_status->trigger == VPAD_BUTTON_RIGHT) {
-        // video_player_seek(5.0f);
+        video_player_seek(VIDEO_SEEK_STEP);
+    } else if (vpad_status->trigger == VPAD_BUTTON_X
+        || wpad_status->buttons == WPAD_PRO_BUTTON_X) {
+        subtitles_toggle();
     }
 }
 
@@ -157,9 +178,8 @@ void input_audio_player(VPADStatus* vpad_status, WPADStatusProController* wpad_s
         audio_player_audio_play(!audio_player_get_audio_play_state());
     } else if (vpad_status->trigger == VPAD_BUTTON_B
         || wpad_status->buttons == WPAD_PRO_BUTTON_B) {
-        audio_player_cleanup();
-        scan_directory(MEDIA_PATH);
-        app_state_set(STATE_MENU);
+        // Keeps playing under the file browser, see input_mini_player
+        ui_leave_audio_player();
     } else if (vpad_status->trigger == VPAD_BUTTON_LEFT) {
         audio_player_seek(-5.0f);
     } else if (vpad_status->trigger == VPAD_BUTTON_RIGHT) {
@@ -190,10 +210,22 @@ void input_update(int& current_page_file_browser, int& selected_index, nk_contex
         nk_input_button(ctx, NK_BUTTON_LEFT, (int)touch_x, (int)touch_y, touched);
     }
     
+    // Y toggles the performance overlay everywhere, the Pro Controller only reports held buttons
+    static bool wpad_y_held = false;
+    bool wpad_y = wpad_status.buttons & WPAD_PRO_BUTTON_Y;
+    if (vpad_status.trigger == VPAD_BUTTON_Y || (wpad_y && !wpad_y_held)) {
+        perf_toggle_overlay();
+    }
+    wpad_y_held = wpad_y;
+
     switch(app_state_get()) {
         case STATE_PLAYING_VIDEO: input_video_player(&vpad_status, &wpad_status); break;
         case STATE_PLAYING_AUDIO: input_audio_player(&vpad_status, &wpad_status); break;
-        case STATE_MENU: input_menu(&vpad_status, &wpad_status, current_page_file_browser, selected_index); break;
-        case STATE_SETTINGS: input_settings(&vpad_status, &wpad_status); break;
+        case STATE_MENU:
+        if (!input_mini_player(&vpad_status, &wpad_status)) input_menu(&vpad_status, &wpad_status, current_page_file_browser, selected_index);
+        break;
+        case STATE_SETTINGS:
+        if (!input_mini_player(&vpad_status, &wpad_status)) input_settings(&vpad_status, &wpad_status);
+        break;
     }
 }
\ No newline at end of file
@@ -0,0 +1,25 @@
+#include <cstdio>
+#include <cstdarg>
+#include <atomic>
+
+#include "log.hpp"
+
+// Decoder threads check it for every trace, the main thread changes it
+static std::atomic<int> current_level = LOG_LEVEL_INFO;
+
+void log_set_level(log_level level) {
+    if (current_level.exchange(level) != level) printf("[Log] Level %d\n", (int)level);
+}
+
+log_level log_get_level() {
+    return (log_level)current_level.load(std::memory_order_relaxed);
+}
+
+void log_debug(const char* format, ...) {
+    if (current_level.load(std::memory_order_relaxed) < LOG_LEVEL_DEBUG) return;
+
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+}
@@ -0,0 +1,15 @@
+#ifndef LOG_H
+#define LOG_H
+
+enum log_level {
+    LOG_LEVEL_INFO,
+    // Also prints the traces built in with DEBUG_AUDIO and DEBUG_VIDEO
+    LOG_LEVEL_DEBUG
+};
+
+void log_set_level(log_level level);
+log_level log_get_level();
+// printf for the DEBUG_AUDIO and DEBUG_VIDEO blocks, silent below LOG_LEVEL_DEBUG
+void log_debug(const char* format, ...) __attribute__((format(printf, 1, 2)));
+
+#endif
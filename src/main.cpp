@@ -1,7 +1,10 @@
 #include <SDL2/SDL.h>
 #include <whb/proc.h>
+#include <coreinit/time.h>
 #include "main.hpp"
 #include "menu.hpp"
+#include "core_thread.hpp"
+#include "perf.hpp"
 
 SDL_Window* main_window;
 SDL_Renderer* main_renderer;
@@ -26,6 +29,9 @@ int init_sdl() {
 int main(int argc, char **argv) {
     WHBProcInit();
 
+    // UI and rendering stay on their own core, decoding runs on the others
+    core_thread_pin_current(CORE_MAIN);
+
     printf("=======================BEGIN=======================\n");
 
     if (init_sdl() != 0) return -1;
@@ -39,8 +45,20 @@ int main(int argc, char **argv) {
     ui_init(main_window, main_renderer, main_texture);
 
     while (WHBProcIsRunning()) {
-        ui_render();
-        SDL_RenderPresent(main_renderer);
+        OSTime frame_start = OSGetSystemTime();
+        if (ui_render()) {
+            {
+                perf_scope present_scope(PERF_TIMER_PRESENT);
+                SDL_RenderPresent(main_renderer);
+            }
+
+            // Leave the rest of the frame budget to the audio session
+            int frame_ms = (int)OSTicksToMilliseconds(OSGetSystemTime() - frame_start);
+            if (frame_ms < ui_min_frame_ms()) SDL_Delay(ui_min_frame_ms() - frame_ms);
+        } else {
+            // Static screen, poll input at a low rate and leave the cores to decoding
+            SDL_Delay(ui_idle_delay_ms());
+        }
     }
 
     ui_shutdown();
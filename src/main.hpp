@@ -15,9 +15,25 @@
 #define AMBIANCE_PATH "/vol/content/769925__lightmister__game-main-menu-fluids.mp3"
 #define MEDIA_PATH "/vol/external01/wiiu/apps/cafemp/"
 #define SETTINGS_PATH "/vol/external01/wiiu/apps/cafemp/settings.json"
+#define LIBRARY_CACHE_PATH "/vol/external01/wiiu/apps/cafemp/library.json"
+#define THUMBNAIL_ATLAS_PATH "/vol/external01/wiiu/apps/cafemp/thumbnails.bin"
+#define PROBE_CACHE_PATH "/vol/external01/wiiu/apps/cafemp/probe_cache.json"
+// Where each video was left, kept apart from settings.json so saving it stays cheap
+#define RESUME_STORE_PATH "/vol/external01/wiiu/apps/cafemp/resume.bin"
+// Written by the benchmark build, calibrates the decode pre-flight
+#define BENCHMARK_RESULT_PATH "/vol/external01/wiiu/apps/cafemp/benchmark.json"
+// One stream URL per line, listed after the local files
+#define STREAMS_PATH "/vol/external01/wiiu/apps/cafemp/streams.m3u"
 
 #define VERSION_STRING "café media player v0.4.6 " __DATE__ " " __TIME__
 
+// Input polling interval while the UI has nothing new to draw
+#define UI_IDLE_FRAME_MS 50
+// Frame interval the browser keeps to while music decodes behind it
+#define UI_AUDIO_FRAME_MS 33
+// How long a video started in reduced quality says so
+#define DECODE_NOTICE_MS 4000
+
 #define TOOLTIP_BAR_HEIGHT (48)
 #define GRID_COLS 4
 #define GRID_ROWS 3
@@ -26,6 +42,9 @@
 
 struct frame_info {
     SDL_Texture* texture;
+    // Visible picture inside the texture
+    int crop_x;
+    int crop_y;
     int frame_width;
     int frame_height;
     int64_t total_time;
@@ -0,0 +1,90 @@
+#include <cmath>
+#include <mutex>
+extern "C" {
+    #include <libavutil/time.h>
+}
+
+#include "media_clock.hpp"
+#include "audio_player.hpp"
+
+static std::mutex clock_mutex;
+
+// System clock, anchored at base_time when av_gettime_relative() was base_us
+static double base_time = 0.0;
+static int64_t base_us = 0;
+static bool paused = false;
+
+static bool audio_synced = false;
+static double last_audio_time = -1.0;
+static int64_t last_audio_change_us = 0;
+
+static double media_clock_system_time_locked(int64_t now_us) {
+    if (paused) return base_time;
+    return base_time + (now_us - base_us) / 1e6;
+}
+
+void media_clock_set(double time) {
+    std::lock_guard<std::mutex> lock(clock_mutex);
+    int64_t now_us = av_gettime_relative();
+
+    base_time = time;
+    base_us = now_us;
+
+    // Wait for the audio clock to reach the new position before following it again
+    audio_synced = false;
+    last_audio_time = -1.0;
+    last_audio_change_us = now_us;
+}
+
+void media_clock_set_paused(bool new_paused) {
+    std::lock_guard<std::mutex> lock(clock_mutex);
+    if (paused == new_paused) return;
+
+    int64_t now_us = av_gettime_relative();
+    base_time = media_clock_system_time_locked(now_us);
+    base_us = now_us;
+    last_audio_change_us = now_us;
+    paused = new_paused;
+}
+
+double media_clock_get_system_time() {
+    std::lock_guard<std::mutex> lock(clock_mutex);
+    return media_clock_system_time_locked(av_gettime_relative());
+}
+
+double media_clock_get_master_time() {
+    if (!audio_enabled) return media_clock_get_system_time();
+
+    double audio_time = audio_player_get_current_play_time();
+
+    std::lock_guard<std::mutex> lock(clock_mutex);
+    int64_t now_us = av_gettime_relative();
+    double system_time = media_clock_system_time_locked(now_us);
+
+    if (audio_time != last_audio_time) {
+        last_audio_time = audio_time;
+        last_audio_change_us = now_us;
+
+        if (!audio_synced && std::fabs(audio_time - system_time) < MEDIA_CLOCK_RESYNC_THRESHOLD) {
+            audio_synced = true;
+        }
+
+        // The audio position only moves in device buffer sized steps,
+        // so re-anchor the system clock on every step and extrapolate in between
+        if (audio_synced) {
+            base_time = audio_time;
+            base_us = now_us;
+            return audio_time;
+        }
+    } else if (!paused && now_us - last_audio_change_us > MEDIA_CLOCK_AUDIO_STALL_US) {
+        // Audio ran out (or underruns badly), keep going on the system clock
+        audio_synced = false;
+    }
+
+    return system_time;
+}
+
+bool media_clock_is_audio_master() {
+    std::lock_guard<std::mutex> lock(clock_mutex);
+    return audio_enabled && audio_synced;
+}
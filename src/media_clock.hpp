@@ -0,0 +1,15 @@
+#ifndef MEDIA_CLOCK_H
+#define MEDIA_CLOCK_H
+
+// Audio and system clock further apart than this are not treated as in sync
+#define MEDIA_CLOCK_RESYNC_THRESHOLD 0.5
+// Audio clock that has not moved for this long while playing is considered stalled
+#define MEDIA_CLOCK_AUDIO_STALL_US 500000
+
+void media_clock_set(double time);
+void media_clock_set_paused(bool paused);
+double media_clock_get_system_time();
+double media_clock_get_master_time();
+bool media_clock_is_audio_master();
+
+#endif
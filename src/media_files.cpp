@@ -1,28 +1,26 @@
-#include <vector>
-#include <string>
 #include <mutex>
 
-static std::vector<std::string> media_files;
+#include "media_files.hpp"
+
+static media_list_ptr media_files = std::make_shared<const media_list>();
 static std::mutex media_files_mutex;
 
-std::vector<std::string> get_media_files() {
-    std::lock_guard<std::mutex> lock(media_files_mutex);
-    return media_files;
+void media_list_add(media_list& list, const std::string& path) {
+    list.offsets.push_back(static_cast<uint32_t>(list.arena.size()));
+    list.arena.append(path);
+    list.arena.push_back('\0');
 }
 
-void set_media_files(const std::vector<std::string>& new_files) {
+media_list_ptr get_media_files() {
+    // Only the pointer is copied under the lock
     std::lock_guard<std::mutex> lock(media_files_mutex);
-    media_files = new_files;
+    return media_files;
 }
 
-void add_media_file(const std::string& file) {
-    std::lock_guard<std::mutex> lock(media_files_mutex);
-    media_files.push_back(file);
-}
+void set_media_files(media_list_ptr new_files) {
+    if (!new_files) new_files = std::make_shared<const media_list>();
 
-void remove_media_file(size_t index) {
+    // The old list dies outside the lock, with its last reader
     std::lock_guard<std::mutex> lock(media_files_mutex);
-    if (index < media_files.size()) {
-        media_files.erase(media_files.begin() + index);
-    }
+    media_files.swap(new_files);
 }
@@ -1,9 +1,27 @@
 #ifndef MEDIA_FILES_H
 #define MEDIA_FILES_H
 
-std::vector<std::string> get_media_files();
-void set_media_files(const std::vector<std::string>& new_files);
-void add_media_file(const std::string& file);
-void remove_media_file(size_t index);
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
 
-#endif
\ No newline at end of file
+// Immutable list of media paths. All paths live back to back in one arena,
+// NUL terminated, so a big library is two allocations instead of one per file.
+struct media_list {
+    std::string arena;
+    std::vector<uint32_t> offsets;
+
+    size_t size() const { return offsets.size(); }
+    const char* path(size_t index) const { return index < offsets.size() ? arena.c_str() + offsets[index] : nullptr; }
+};
+
+typedef std::shared_ptr<const media_list> media_list_ptr;
+
+void media_list_add(media_list& list, const std::string& path);
+
+// Readers grab one snapshot per frame, the scanner swaps in whole new lists
+media_list_ptr get_media_files();
+void set_media_files(media_list_ptr new_files);
+
+#endif
@@ -0,0 +1,352 @@
+#include <jansson.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <coreinit/time.h>
+#include <cstdio>
+#include <cctype>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <unordered_map>
+
+#include "main.hpp"
+#include "utils.hpp"
+#include "media_files.hpp"
+#include "media_library.hpp"
+#include "core_thread.hpp"
+#include "player_session.hpp"
+
+struct cached_directory {
+    int64_t mtime = 0;
+    std::vector<std::string> subdirs;
+    std::vector<media_entry> files;
+};
+
+struct scan_state {
+    std::string root;
+    std::unordered_map<std::string, cached_directory> directories;
+    media_list found;
+    size_t published = 0;
+    bool progressive = false;
+    int rescanned = 0;
+};
+
+// Directory listings keyed by path relative to the root, scanner thread only
+static std::unordered_map<std::string, cached_directory> library_cache;
+static std::string cache_root;
+static bool cache_loaded = false;
+
+static std::mutex scan_mutex;
+static core_thread scan_thread;
+static std::atomic<bool> scan_running = false;
+static std::atomic<bool> scan_abort = false;
+static bool rescan_requested = false;
+static std::string scan_root;
+
+static bool media_library_type(const std::string& name, media_type& type) {
+    size_t dot = name.find_last_of('.');
+    if (dot == std::string::npos) return false;
+
+    std::string ext = name.substr(dot + 1);
+    for (auto& c : ext) c = std::tolower(c);
+
+    if (valid_video_endings.count(ext)) {
+        type = MEDIA_TYPE_VIDEO;
+        return true;
+    }
+    if (valid_audio_endings.count(ext)) {
+        type = MEDIA_TYPE_AUDIO;
+        return true;
+    }
+    return false;
+}
+
+static void media_library_load_cache() {
+    library_cache.clear();
+
+    json_error_t error;
+    json_t* root = json_load_file(LIBRARY_CACHE_PATH, 0, &error);
+    if (!root) {
+        printf("[Library] No library cache, doing a full scan\n");
+        return;
+    }
+
+    json_t* version = json_object_get(root, "version");
+    json_t* cached_root = json_object_get(root, "root");
+    json_t* directories = json_object_get(root, "directories");
+    if (!json_is_integer(version) || json_integer_value(version) != LIBRARY_CACHE_VERSION ||
+        !json_is_string(cached_root) || !json_is_array(directories)) {
+        printf("[Library] Library cache outdated, ignoring it\n");
+        json_decref(root);
+        return;
+    }
+    cache_root = json_string_value(cached_root);
+
+    for (size_t i = 0; i < json_array_size(directories); ++i) {
+        json_t* dir = json_array_get(directories, i);
+        json_t* path = json_object_get(dir, "path");
+        json_t* mtime = json_object_get(dir, "mtime");
+        json_t* subdirs = json_object_get(dir, "subdirs");
+        json_t* files = json_object_get(dir, "files");
+        if (!json_is_string(path) || !json_is_integer(mtime) || !json_is_array(subdirs) || !json_is_array(files)) continue;
+
+        cached_directory& entry = library_cache[json_string_value(path)];
+        entry.mtime = json_integer_value(mtime);
+
+        for (size_t j = 0; j < json_array_size(subdirs); ++j) {
+            json_t* sub = json_array_get(subdirs, j);
+            if (json_is_string(sub)) entry.subdirs.push_back(json_string_value(sub));
+        }
+
+        for (size_t j = 0; j < json_array_size(files); ++j) {
+            json_t* file = json_array_get(files, j);
+            json_t* file_path = json_object_get(file, "path");
+            json_t* size = json_object_get(file, "size");
+            json_t* file_mtime = json_object_get(file, "mtime");
+            json_t* type = json_object_get(file, "type");
+            if (!json_is_string(file_path) || !json_is_integer(size) || !json_is_integer(file_mtime) || !json_is_integer(type)) continue;
+
+            entry.files.push_back({
+                json_string_value(file_path),
+                (uint64_t)json_integer_value(size),
+                (int64_t)json_integer_value(file_mtime),
+                json_integer_value(type) == MEDIA_TYPE_AUDIO ? MEDIA_TYPE_AUDIO : MEDIA_TYPE_VIDEO
+            });
+        }
+    }
+
+    json_decref(root);
+    printf("[Library] Loaded %d cached folders\n", (int)library_cache.size());
+}
+
+static void media_library_save_cache(const std::string& root_path) {
+    json_t* root = json_object();
+    json_t* directories = json_array();
+
+    json_object_set_new(root, "version", json_integer(LIBRARY_CACHE_VERSION));
+    json_object_set_new(root, "root", json_string(root_path.c_str()));
+
+    for (const auto& it : library_cache) {
+        json_t* dir = json_object();
+        json_t* subdirs = json_array();
+        json_t* files = json_array();
+
+        for (const auto& sub : it.second.subdirs) json_array_append_new(subdirs, json_string(sub.c_str()));
+        for (const auto& file : it.second.files) {
+            json_t* entry = json_object();
+            json_object_set_new(entry, "path", json_string(file.path.c_str()));
+            json_object_set_new(entry, "size", json_integer(file.size));
+            json_object_set_new(entry, "mtime", json_integer(file.mtime));
+            json_object_set_new(entry, "type", json_integer(file.type));
+            json_array_append_new(files, entry);
+        }
+
+        json_object_set_new(dir, "path", json_string(it.first.c_str()));
+        json_object_set_new(dir, "mtime", json_integer(it.second.mtime));
+        json_object_set_new(dir, "subdirs", subdirs);
+        json_object_set_new(dir, "files", files);
+        json_array_append_new(directories, dir);
+    }
+    json_object_set_new(root, "directories", directories);
+
+    // Write next to the old cache first, a pulled SD card never leaves half a file
+    std::string temp_path = std::string(LIBRARY_CACHE_PATH) + ".tmp";
+    FILE* file = fopen(temp_path.c_str(), "w");
+    if (file) {
+        json_dumpf(root, file, JSON_COMPACT);
+        fclose(file);
+        remove(LIBRARY_CACHE_PATH);
+        rename(temp_path.c_str(), LIBRARY_CACHE_PATH);
+    } else {
+        printf("[Library] Failed to save library cache.\n");
+    }
+
+    json_decref(root);
+}
+
+static void media_library_publish(scan_state& state) {
+    set_media_files(std::make_shared<const media_list>(state.found));
+    state.published = state.found.size();
+}
+
+// Stream URLs from the playlist, comments (#EXTM3U, #EXTINF) and local paths are skipped
+static void media_library_add_streams(scan_state& state) {
+    FILE* file = fopen(STREAMS_PATH, "r");
+    if (!file) return;
+
+    char line[1024];
+    int streams = 0;
+    while (fgets(line, sizeof(line), file)) {
+        std::string url(line);
+        while (!url.empty() && std::isspace((unsigned char)url.back())) url.pop_back();
+        size_t start = url.find_first_not_of(" \t");
+        if (start == std::string::npos || url[start] == '#') continue;
+        url = url.substr(start);
+        if (!is_network_path(url)) continue;
+
+        media_list_add(state.found, url);
+        streams++;
+    }
+    fclose(file);
+
+    printf("[Library] %d streams from the playlist\n", streams);
+}
+
+static void media_library_read_directory(const std::string& full_path, const std::string& relative, cached_directory& dir) {
+    DIR* handle = opendir(full_path.c_str());
+    if (!handle) return;
+
+    struct dirent* ent;
+    while ((ent = readdir(handle)) != NULL && !scan_abort) {
+        std::string name(ent->d_name);
+        if (name.empty() || name[0] == '.') continue;
+
+        std::string entry_path = full_path + name;
+        bool is_dir = ent->d_type == DT_DIR;
+        struct stat entry_stat;
+        bool have_stat = false;
+
+        if (ent->d_type == DT_UNKNOWN) {
+            have_stat = stat(entry_path.c_str(), &entry_stat) == 0;
+            is_dir = have_stat && S_ISDIR(entry_stat.st_mode);
+        }
+
+        if (is_dir) {
+            dir.subdirs.push_back(name);
+            continue;
+        }
+
+        media_type type;
+        if (!media_library_type(name, type)) continue;
+        if (!have_stat && stat(entry_path.c_str(), &entry_stat) != 0) continue;
+
+        dir.files.push_back({ relative + name, (uint64_t)entry_stat.st_size, (int64_t)entry_stat.st_mtime, type });
+    }
+    closedir(handle);
+}
+
+static void media_library_walk(scan_state& state, const std::string& relative, int depth) {
+    if (scan_abort || depth > LIBRARY_MAX_DEPTH) return;
+
+    std::string full_path = state.root + relative;
+    struct stat dir_stat;
+    if (stat(full_path.c_str(), &dir_stat) != 0) return;
+
+    cached_directory dir;
+    auto cached = library_cache.find(relative);
+    if (cached != library_cache.end() && cached->second.mtime == (int64_t)dir_stat.st_mtime) {
+        // Folder untouched since the last scan, reuse its listing
+        dir = cached->second;
+    } else {
+        dir.mtime = dir_stat.st_mtime;
+        media_library_read_directory(full_path, relative, dir);
+        state.rescanned++;
+    }
+
+    for (const auto& file : dir.files) media_list_add(state.found, file.path);
+    if (state.progressive && state.found.size() - state.published >= LIBRARY_SCAN_BATCH) {
+        media_library_publish(state);
+    }
+
+    // Nested folders keep their own mtime, check them even when this one is unchanged
+    for (const auto& sub : dir.subdirs) {
+        media_library_walk(state, relative + sub + "/", depth + 1);
+    }
+
+    state.directories[relative] = std::move(dir);
+}
+
+static void media_library_publish_cache(const std::string& root) {
+    scan_state state;
+    state.root = root;
+
+    // Same walk order as a real scan, straight from the cache
+    std::vector<std::string> pending = { "" };
+    while (!pending.empty()) {
+        std::string relative = pending.back();
+        pending.pop_back();
+
+        auto it = library_cache.find(relative);
+        if (it == library_cache.end()) continue;
+
+        for (const auto& file : it->second.files) media_list_add(state.found, file.path);
+        for (auto sub = it->second.subdirs.rbegin(); sub != it->second.subdirs.rend(); ++sub) {
+            pending.push_back(relative + *sub + "/");
+        }
+    }
+
+    media_library_add_streams(state);
+    media_library_publish(state);
+}
+
+static void media_library_scan_thread(void*) {
+    while (!scan_abort) {
+        scan_state state;
+        {
+            std::lock_guard<std::mutex> lock(scan_mutex);
+            state.root = scan_root;
+            rescan_requested = false;
+        }
+
+        if (!cache_loaded) {
+            media_library_load_cache();
+            cache_loaded = true;
+            if (cache_root != state.root) library_cache.clear();
+            if (!library_cache.empty()) media_library_publish_cache(state.root);
+        } else if (cache_root != state.root) {
+            library_cache.clear();
+        }
+
+        uint64_t start_ticks = OSGetSystemTime();
+        state.progressive = library_cache.empty();
+        media_library_walk(state, "", 0);
+        if (scan_abort) break;
+
+        library_cache.swap(state.directories);
+        cache_root = state.root;
+        media_library_add_streams(state);
+        media_library_publish(state);
+        media_library_save_cache(state.root);
+
+        printf("[Library] %d files, %d of %d folders read in %llu ms\n",
+            (int)state.found.size(), state.rescanned, (int)library_cache.size(),
+            (unsigned long long)OSTicksToMilliseconds(OSGetSystemTime() - start_ticks));
+
+        std::lock_guard<std::mutex> lock(scan_mutex);
+        if (!rescan_requested) {
+            scan_running = false;
+            return;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(scan_mutex);
+    scan_running = false;
+}
+
+void media_library_scan(const char* root) {
+    std::lock_guard<std::mutex> lock(scan_mutex);
+    scan_root = root;
+
+    // Already walking, have it go once more when done
+    if (scan_running) {
+        rescan_requested = true;
+        return;
+    }
+
+    if (core_thread_joinable(scan_thread)) core_thread_join(scan_thread);
+
+    scan_abort = false;
+    scan_running = true;
+    if (!core_thread_start(scan_thread, "cafemp scanner", media_library_scan_thread, nullptr, CORE_SCAN, PRIORITY_SCAN)) {
+        scan_running = false;
+    }
+}
+
+bool media_library_is_scanning() {
+    return scan_running;
+}
+
+void media_library_shutdown() {
+    scan_abort = true;
+    player_session_join(scan_thread, "Library scan");
+}
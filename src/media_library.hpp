@@ -0,0 +1,30 @@
+#ifndef MEDIA_LIBRARY_H
+#define MEDIA_LIBRARY_H
+
+#include <string>
+#include <cstdint>
+
+#define LIBRARY_CACHE_VERSION 1
+// Folders below the media root the scanner descends into
+#define LIBRARY_MAX_DEPTH 8
+// A first scan without a cache publishes every this many files
+#define LIBRARY_SCAN_BATCH 64
+
+enum media_type {
+    MEDIA_TYPE_VIDEO,
+    MEDIA_TYPE_AUDIO
+};
+
+struct media_entry {
+    std::string path; // Relative to the scanned root
+    uint64_t size;
+    int64_t mtime;
+    media_type type;
+};
+
+// Starts (or queues) a background scan of root, the cached list is published first
+void media_library_scan(const char* root);
+bool media_library_is_scanning();
+void media_library_shutdown();
+
+#endif
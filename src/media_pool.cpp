@@ -0,0 +1,66 @@
+#include <cstdio>
+
+#include "media_pool.hpp"
+#include "log.hpp"
+
+void media_pool_init(media_pool& pool) {
+    media_pool_destroy(pool);
+
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    pool.free_packets.reserve(MEDIA_POOL_MAX_FREE_PACKETS);
+}
+
+void media_pool_destroy(media_pool& pool) {
+    std::lock_guard<std::mutex> lock(pool.mutex);
+
+    for (AVPacket* pkt : pool.free_packets) av_packet_free(&pkt);
+    pool.free_packets.clear();
+
+    #ifdef DEBUG_VIDEO
+    if (pool.packets_high_water > 0) {
+        log_debug("[Media pool] %d packets at most, %u misses\n",
+            pool.packets_high_water.load(), pool.misses.load());
+    }
+    #endif
+
+    pool.packets_in_use = 0;
+    pool.packets_high_water = 0;
+    pool.misses = 0;
+}
+
+AVPacket* media_pool_get_packet(media_pool& pool) {
+    AVPacket* pkt = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        if (!pool.free_packets.empty()) {
+            pkt = pool.free_packets.back();
+            pool.free_packets.pop_back();
+        }
+    }
+
+    if (!pkt) {
+        pkt = av_packet_alloc();
+        if (!pkt) return nullptr;
+        pool.misses++;
+    }
+
+    int in_use = ++pool.packets_in_use;
+    if (in_use > pool.packets_high_water) pool.packets_high_water = in_use;
+    return pkt;
+}
+
+void media_pool_put_packet(media_pool& pool, AVPacket*& pkt) {
+    if (!pkt) return;
+    av_packet_unref(pkt);
+    pool.packets_in_use--;
+
+    {
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        if (pool.free_packets.size() < MEDIA_POOL_MAX_FREE_PACKETS) {
+            pool.free_packets.push_back(pkt);
+            pkt = nullptr;
+            return;
+        }
+    }
+    av_packet_free(&pkt);
+}
@@ -0,0 +1,36 @@
+#ifndef MEDIA_POOL_H
+#define MEDIA_POOL_H
+
+#include <mutex>
+#include <atomic>
+#include <vector>
+extern "C" {
+    #include <libavcodec/avcodec.h>
+}
+
+// Spare AVPacket structs kept around, more than any queue limit lets through
+#define MEDIA_POOL_MAX_FREE_PACKETS 1024
+
+// Recycles the packet structs of one demuxer, so queueing a packet never
+// allocates once the session is warm. Payloads stay the buffers libavformat
+// allocated, they move into the queued struct by reference and are never copied.
+struct media_pool {
+    std::mutex mutex;
+    std::vector<AVPacket*> free_packets;
+
+    // Stats, all threads read them
+    std::atomic<int> packets_in_use = 0;
+    std::atomic<int> packets_high_water = 0;
+    // Allocations a warm pool would have avoided
+    std::atomic<uint32_t> misses = 0;
+};
+
+void media_pool_init(media_pool& pool);
+void media_pool_destroy(media_pool& pool);
+
+// Empty packet, from the free list when there is one
+AVPacket* media_pool_get_packet(media_pool& pool);
+// Unreferences the packet and keeps the struct for the next get
+void media_pool_put_packet(media_pool& pool, AVPacket*& pkt);
+
+#endif
@@ -5,6 +5,9 @@
 #include <SDL2/SDL_ttf.h>
 
 #include <coreinit/time.h>
+extern "C" {
+    #include <libavformat/avformat.h>
+}
 
 #define NK_INCLUDE_FIXED_TYPES
 #define NK_INCLUDE_STANDARD_IO
@@ -26,8 +29,16 @@
 #include "main.hpp"
 #include "video_player.hpp"
 #include "audio_player.hpp"
+#include "media_library.hpp"
+#include "thumbnails.hpp"
+#include "perf.hpp"
 #include "input.hpp"
 #include "menu.hpp"
+#include "subtitles.hpp"
+#include "resume_store.hpp"
+#include "probe_cache.hpp"
+#include "visualizer.hpp"
+#include "player_session.hpp"
 
 int current_page_file_browser = 0;
 int selected_index = 0;
@@ -40,9 +51,21 @@ SDL_Texture* ui_texture;
 struct nk_context *ctx;
 SDL_Rect dest_rect = (SDL_Rect){0, 0, 0, 0};
 bool dest_rect_initialised = false;
+static int dest_rect_source_width = 0;
+static int dest_rect_source_height = 0;
+// Kept apart from the list, a rescan may reorder it while playing
+std::string playing_name;
 
 bool ambiance_playing = false;
+// Music left playing while the file browser or the settings are up
+static bool background_audio = false;
 static int background_music_enabled = 1;
+// Track opened ahead for the gapless transition, and the transitions already handled
+static std::string queued_name;
+static int track_changes_seen = 0;
+static OSTime video_started_ticks = 0;
+
+static bool ui_update_audio_session();
 
 void ui_init(SDL_Window* _window, SDL_Renderer* _renderer, SDL_Texture* &_texture) {
     WPADInit();
@@ -56,16 +79,18 @@ void ui_init(SDL_Window* _window, SDL_Renderer* _renderer, SDL_Texture* &_textur
 
     try {
         settings_load();
-        background_music_enabled = *static_cast<int*>(settings_get_value(SETTINGS_BKG_MUSIC_ENABLED));
+        background_music_enabled = settings_get(SETTINGS_BKG_MUSIC_ENABLED);
     } catch(...) {
         printf("[Menu] Unable to load settings.\n");
     }
 
-    if(!background_music_enabled) {
-        audio_player_init("/vol/content/empty.mp3");
-        audio_player_audio_play(true);
-        audio_player_cleanup();
-        audio_player_audio_play(false);
+    // Sockets and TLS for stream URLs, once for the whole run
+    avformat_network_init();
+    // Subtitle cues are rasterized with SDL_ttf, Nuklear keeps its own font atlas
+    if (TTF_Init() != 0) printf("[Menu] SDL_ttf unavailable, text subtitles stay hidden.\n");
+
+    if (audio_output_open() != 0) {
+        printf("[Menu] Audio output unavailable, playing without sound.\n");
     }
 
     ctx = nk_sdl_init(ui_window, ui_renderer);
@@ -84,63 +109,118 @@ void ui_init(SDL_Window* _window, SDL_Renderer* _renderer, SDL_Texture* &_textur
 
     // Scan local directories
     scan_directory(MEDIA_PATH);
+    thumbnails_init();
+    resume_store_init();
+    probe_cache_init();
 }
 
 void start_file(int index) {
-    if (ambiance_playing) {
+    if (ambiance_playing || background_audio) {
         audio_player_cleanup();
         ambiance_playing = false;
+        background_audio = false;
     }
 
-    std::string full_path = std::string(MEDIA_PATH) + get_media_files()[index];
-    std::string extension = full_path.substr(full_path.find_last_of('.') + 1);
-    
-    for (auto& c : extension) c = std::tolower(c);
+    media_list_ptr files = get_media_files();
+    if (!files->path(index)) return;
 
-    if (valid_video_endings.count(extension)) {
-        start_selected_video(index);
-    } else if (valid_audio_endings.count(extension)) {
+    std::string extension = media_extension(files->path(index));
+
+    if (valid_audio_endings.count(extension)) {
         start_selected_audio(index);
+    } else if (valid_video_endings.count(extension) || is_network_path(files->path(index))) {
+        // Stream URLs rarely end in a media extension, let the video player probe them
+        start_selected_video(index);
     } else {
         printf("[Menu] Unsupported file type: %s\n", extension.c_str());
     }
 }
 
 void start_selected_video(int selected_index) {
-    std::string full_path = std::string(MEDIA_PATH) + get_media_files()[selected_index];
-    video_player_start(full_path.c_str(), *ui_renderer, ui_texture);
+    media_list_ptr files = get_media_files();
+    if (!files->path(selected_index)) return;
+
+    playing_name = files->path(selected_index);
+    std::string full_path = media_full_path(playing_name);
+    video_player_start(full_path.c_str(), *ui_renderer);
+    video_started_ticks = OSGetSystemTime();
     audio_player_audio_play(true);
     video_player_play(true);
     app_state_set(STATE_PLAYING_VIDEO);
 }
 
+// Next audio file after the given one in the current listing, empty at the end
+static std::string ui_next_audio_file(const std::string& name) {
+    media_list_ptr files = get_media_files();
+
+    size_t index = 0;
+    while (index < files->size() && name != files->path(index)) ++index;
+
+    for (++index; index < files->size(); ++index) {
+        std::string path = files->path(index);
+        if (valid_audio_endings.count(media_extension(path))) return path;
+    }
+    return "";
+}
+
+static void ui_queue_next_audio() {
+    queued_name = ui_next_audio_file(playing_name);
+    if (queued_name.empty()) return;
+
+    std::string full_path = media_full_path(queued_name);
+    if (audio_player_queue(full_path.c_str()) < 0) queued_name.clear();
+}
+
 void start_selected_audio(int selected_index) {
+    media_list_ptr files = get_media_files();
+    if (!files->path(selected_index)) return;
 
-    std::string full_path = std::string(MEDIA_PATH) + get_media_files()[selected_index];
+    playing_name = files->path(selected_index);
+    std::string full_path = media_full_path(playing_name);
     audio_player_init(full_path.c_str());
     audio_player_audio_play(true);
+    track_changes_seen = 0;
+    ui_queue_next_audio();
     app_state_set(STATE_PLAYING_AUDIO);
 }
 
 void ui_handle_ambiance() {
+    // The music the user picked plays instead
+    if (background_audio) return;
+
     if (!ambiance_playing && background_music_enabled) {
         audio_player_init(AMBIANCE_PATH);
         audio_player_audio_play(true);
+        // Loop by queueing the same file behind itself
+        audio_player_queue(AMBIANCE_PATH);
+        track_changes_seen = 0;
         ambiance_playing = true;
-    } else if((int)audio_player_get_current_play_time() == (int)audio_player_get_total_play_time() && ambiance_playing && background_music_enabled) {
-        audio_player_audio_play(true);
-        audio_player_cleanup();
-        audio_player_audio_play(false);
-        audio_player_init(AMBIANCE_PATH);
-        audio_player_audio_play(true);
+    } else if(ambiance_playing && background_music_enabled) {
+        int track_changes = audio_player_get_track_changes();
+        if (track_changes != track_changes_seen) {
+            track_changes_seen = track_changes;
+            audio_player_queue(AMBIANCE_PATH);
+        }
     } else if(ambiance_playing && !background_music_enabled) {
-        audio_player_audio_play(true);
         audio_player_cleanup();
-        audio_player_audio_play(false);
+        ambiance_playing = false;
     }
 }
 
-void ui_render() {
+// Nuklear commands of the last frame that was drawn, empty forces the next redraw
+static std::vector<uint8_t> last_commands;
+
+// Compares this frame's commands with the ones on screen and keeps them when they differ
+static bool ui_commands_changed() {
+    const uint8_t* commands = static_cast<const uint8_t*>(nk_buffer_memory_const(&ctx->memory));
+    nk_size size = ctx->memory.allocated;
+
+    if (size == last_commands.size() && memcmp(commands, last_commands.data(), size) == 0) return false;
+    last_commands.assign(commands, commands + size);
+    return true;
+}
+
+bool ui_render() {
     nk_input_begin(ctx);
 
     input_check_wpad_pro_connection();
@@ -148,6 +228,8 @@ void ui_render() {
 
     nk_input_end(ctx);
 
+    if (background_audio && !ui_update_audio_session()) background_audio = false;
+
     switch(app_state_get()) {
         case STATE_PLAYING_VIDEO:
         SDL_RenderClear(ui_renderer);
@@ -167,7 +249,84 @@ void ui_render() {
         break;
     }
 
-    nk_sdl_render(NK_ANTI_ALIASING_ON);
+    if (perf_overlay_visible()) ui_render_perf_overlay();
+    ui_render_network_status();
+
+    // Video draws outside of Nuklear every frame, everything else only when the UI changed
+    if (app_state_get() == STATE_PLAYING_VIDEO) {
+        last_commands.clear();
+    } else if (!ui_commands_changed()) {
+        nk_clear(ctx);
+        perf_update();
+        return false;
+    }
+
+    {
+        perf_scope ui_scope(PERF_TIMER_UI);
+        nk_sdl_render(settings_get(SETTINGS_UI_ANTI_ALIASING) ? NK_ANTI_ALIASING_ON : NK_ANTI_ALIASING_OFF);
+    }
+    perf_update();
+    return true;
+}
+
+void ui_render_perf_overlay() {
+    bool network = perf_get_gauge(PERF_GAUGE_NET_TARGET_KB) > 0;
+    int rows = PERF_TIMER_COUNT + (network ? 4 : 3);
+    struct nk_rect overlay_rect = nk_rect(0, 0, 620 * UI_SCALE, rows * 34 * UI_SCALE + 16);
+    if (nk_begin(ctx, "Performance", overlay_rect, NK_WINDOW_NO_SCROLLBAR | NK_WINDOW_BACKGROUND | NK_WINDOW_BORDER | NK_WINDOW_NO_INPUT)) {
+        nk_layout_row_dynamic(ctx, 30 * UI_SCALE, 1);
+        char line[128];
+
+        for (int i = 0; i < PERF_TIMER_COUNT; ++i) {
+            perf_stats stats = perf_get_stats((perf_timer)i);
+            snprintf(line, sizeof(line), "%s: %u / %u / %u us",
+                perf_timer_name((perf_timer)i), (unsigned int)stats.p50, (unsigned int)stats.p95, (unsigned int)stats.p99);
+            nk_label(ctx, line, NK_TEXT_LEFT);
+        }
+
+        snprintf(line, sizeof(line), "Frames: %u shown, %u late, %u dropped",
+            (unsigned int)perf_get_counter(PERF_COUNTER_FRAMES_SHOWN),
+            (unsigned int)perf_get_counter(PERF_COUNTER_FRAMES_LATE),
+            (unsigned int)perf_get_counter(PERF_COUNTER_FRAMES_DROPPED));
+        nk_label(ctx, line, NK_TEXT_LEFT);
+
+        snprintf(line, sizeof(line), "Queue: %d frames, %d packets  A/V: %d ms",
+            (int)perf_get_gauge(PERF_GAUGE_FRAME_QUEUE),
+            (int)perf_get_gauge(PERF_GAUGE_PACKET_QUEUE),
+            (int)perf_get_gauge(PERF_GAUGE_AV_OFFSET_MS));
+        nk_label(ctx, line, NK_TEXT_LEFT);
+
+        snprintf(line, sizeof(line), "Pools: %d packets, %d misses, %d surface misses",
+            (int)perf_get_gauge(PERF_GAUGE_POOL_PACKETS),
+            (int)perf_get_gauge(PERF_GAUGE_POOL_MISSES),
+            (int)perf_get_gauge(PERF_GAUGE_SURFACE_MISSES));
+        nk_label(ctx, line, NK_TEXT_LEFT);
+
+        if (network) {
+            snprintf(line, sizeof(line), "Network: %d kbit/s, %d of %d KB buffered",
+                (int)perf_get_gauge(PERF_GAUGE_NET_KBPS),
+                (int)perf_get_gauge(PERF_GAUGE_NET_BUFFERED_KB),
+                (int)perf_get_gauge(PERF_GAUGE_NET_TARGET_KB));
+            nk_label(ctx, line, NK_TEXT_LEFT);
+        }
+    }
+    nk_end(ctx);
+}
+
+void ui_render_network_status() {
+    // Only network sources set a buffer target, and only while one is open
+    if (perf_get_gauge(PERF_GAUGE_NET_TARGET_KB) <= 0) return;
+    int preroll = (int)perf_get_gauge(PERF_GAUGE_NET_PREROLL);
+    if (preroll >= 100) return;
+
+    struct nk_rect status_rect = nk_rect((SCREEN_WIDTH - 320 * UI_SCALE) / 2, (SCREEN_HEIGHT - 60 * UI_SCALE) / 2, 320 * UI_SCALE, 60 * UI_SCALE);
+    if (nk_begin(ctx, "Buffering", status_rect, NK_WINDOW_NO_SCROLLBAR | NK_WINDOW_BORDER | NK_WINDOW_NO_INPUT)) {
+        nk_layout_row_dynamic(ctx, 40 * UI_SCALE, 1);
+        char line[32];
+        snprintf(line, sizeof(line), "Buffering %d%%", preroll);
+        nk_label(ctx, line, NK_TEXT_CENTERED);
+    }
+    nk_end(ctx);
 }
 
 void ui_render_settings() {
@@ -180,7 +339,7 @@ void ui_render_settings() {
         if (nk_button_label(ctx, background_music_enabled ? "Background Music: On" : "Background Music: Off")) {
             background_music_enabled = !background_music_enabled;
 
-            settings_set(SETTINGS_BKG_MUSIC_ENABLED, &background_music_enabled);
+            settings_set(SETTINGS_BKG_MUSIC_ENABLED, background_music_enabled);
         }
         nk_end(ctx);
     }
@@ -188,8 +347,61 @@ void ui_render_settings() {
     ui_render_tooltip(current_page_file_browser);
 }
 
+void ui_render_mini_player() {
+    double current_time = audio_player_get_current_play_time();
+    double total_time = audio_player_get_total_play_time();
+    bool is_menu = app_state_get() == STATE_MENU;
+
+    std::string now_playing = audio_player_get_audio_play_state() ? "> " : "|| ";
+    now_playing += format_time(current_time) + " / " + format_time(total_time) + " ";
+    now_playing += truncate_filename(media_display_name(playing_name), 30);
+
+    nk_layout_row_begin(ctx, NK_DYNAMIC, TOOLTIP_BAR_HEIGHT * UI_SCALE, 3);
+    nk_layout_row_push(ctx, 0.45f);
+    nk_label(ctx, now_playing.c_str(), NK_TEXT_LEFT);
+    nk_layout_row_push(ctx, 0.2f);
+    // Whole seconds, the bar only changes once a second
+    nk_size progress = static_cast<nk_size>(current_time);
+    nk_progress(ctx, &progress, static_cast<nk_size>(total_time), NK_FIXED);
+    nk_layout_row_push(ctx, 0.35f);
+    nk_label(ctx, is_menu ? "(X) Pause (B) Stop (ZR) Player" : "(X) Pause (ZR) Player", NK_TEXT_RIGHT);
+    nk_layout_row_end(ctx);
+}
+
+bool ui_background_audio_active() {
+    return background_audio;
+}
+
+void ui_leave_audio_player() {
+    // The decode thread keeps going, only the screen changes
+    background_audio = true;
+    scan_directory(MEDIA_PATH);
+    app_state_set(STATE_MENU);
+}
+
+void ui_open_audio_player() {
+    background_audio = false;
+    app_state_set(STATE_PLAYING_AUDIO);
+}
+
+void ui_stop_background_audio() {
+    audio_player_cleanup();
+    background_audio = false;
+}
+
+int ui_min_frame_ms() {
+    // Decoding music behind the browser matters more than its frame rate
+    return background_audio ? UI_AUDIO_FRAME_MS : 0;
+}
+
 void ui_render_tooltip(int _current_page_file_browser) {
     if (nk_begin(ctx, "tooltip_bar", nk_rect(0, SCREEN_HEIGHT - TOOLTIP_BAR_HEIGHT * UI_SCALE, SCREEN_WIDTH, TOOLTIP_BAR_HEIGHT * UI_SCALE), NK_WINDOW_NO_SCROLLBAR | NK_WINDOW_BORDER | NK_WINDOW_BACKGROUND)) {
+        if (background_audio) {
+            ui_render_mini_player();
+            nk_end(ctx);
+            return;
+        }
+
         switch(app_state_get()) {
             case STATE_PLAYING_VIDEO:
             break;
@@ -212,17 +424,21 @@ void ui_render_tooltip(int _current_page_file_browser) {
 }
 
 void ui_render_file_browser() {
+    thumbnails_update(ui_renderer);
+
     if (nk_begin(ctx, VERSION_STRING, nk_rect(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT - TOOLTIP_BAR_HEIGHT * UI_SCALE), NK_WINDOW_NO_SCROLLBAR | NK_WINDOW_BORDER)) {
 
         nk_layout_row_dynamic(ctx, CELL_HEIGHT, GRID_COLS);
 
-        int total_files = static_cast<int>(get_media_files().size());
+        // One snapshot for the whole frame, a rescan can swap the list meanwhile
+        media_list_ptr files = get_media_files();
+        int total_files = static_cast<int>(files->size());
         int start = current_page_file_browser * ITEMS_PER_PAGE;
         int end = std::min(start + ITEMS_PER_PAGE, total_files);
 
         size_t max_name_length = 15;
         for (int i = start; i < end; ++i) {
-            std::string display_str = truncate_filename(get_media_files()[i], max_name_length);
+            std::string display_str = truncate_filename(media_display_name(files->path(i)), max_name_length);
 
             struct nk_style_button button_style = ctx->style.button;
             if (i == selected_index) {
@@ -230,7 +446,12 @@ void ui_render_file_browser() {
                 ctx->style.button.border = 4.0f;
             }
 
-            if (nk_button_label(ctx, display_str.c_str())) {
+            // Tiles show up once the worker has them, the name alone until then
+            SDL_Texture* thumbnail = thumbnails_get(files->path(i));
+            bool pressed = thumbnail ? nk_button_image_label(ctx, nk_image_ptr(thumbnail), display_str.c_str(), NK_TEXT_CENTERED)
+                                     : nk_button_label(ctx, display_str.c_str());
+
+            if (pressed) {
                 selected_index = i;
                 dest_rect_initialised = false;
                 SDL_SetRenderDrawColor(ui_renderer, 0, 0, 0, 255);
@@ -263,7 +484,7 @@ void ui_render_player_hud(bool state, double current_time, double total_time) {
         nk_layout_row_dynamic(ctx, hud_height / 2, 1);
         size_t max_filename_length = 50;
 
-        std::string filename = truncate_filename(get_media_files()[selected_index].c_str(), max_filename_length);
+        std::string filename = truncate_filename(media_display_name(playing_name), max_filename_length);
         std::string hud_str = state ? "> " : "|| ";
         hud_str += format_time(current_time);
         hud_str += " / ";
@@ -278,21 +499,18 @@ void ui_render_player_hud(bool state, double current_time, double total_time) {
 
 void ui_render_video_player() {
     SDL_RenderClear(ui_renderer);
-    uint64_t test_ticks = OSGetSystemTime();
-    video_player_update(ui_renderer);
-    uint64_t decoding_time = OSTicksToMicroseconds(OSGetSystemTime() - test_ticks);
+    {
+        // Presenting a pooled frame only unlocks its texture, copies upload the planes
+        perf_scope upload_scope(PERF_TIMER_UPLOAD);
+        video_player_update(ui_renderer);
+    }
 
     frame_info* current_frame_info = video_player_get_current_frame_info();
     if (!current_frame_info || !current_frame_info->texture) return;   
 
-    static uint64_t last_decoding_time = 0;
-    static uint64_t last_rendering_time = 0;
-
-    uint64_t rendering_ticks = 0;
-
-    rendering_ticks = OSGetSystemTime();  // Start timing
-
-    if(!dest_rect_initialised) {
+    // Recomputed when the stream changes resolution mid-file
+    if (!dest_rect_initialised || current_frame_info->frame_width != dest_rect_source_width ||
+        current_frame_info->frame_height != dest_rect_source_height) {
         int video_width = current_frame_info->frame_width;
         int video_height = current_frame_info->frame_height;
 
@@ -313,66 +531,133 @@ void ui_render_video_player() {
         dest_rect.y = (screen_height - new_height) / 2;
 
         dest_rect_initialised = true;
+        dest_rect_source_width = video_width;
+        dest_rect_source_height = video_height;
     }
-    SDL_RenderCopy(ui_renderer, current_frame_info->texture, NULL, &dest_rect);
+    // Textures carry decoder padding and cropped borders, only show the picture itself.
+    // Scaling to dest_rect happens on the GPU, nothing is resized on the CPU
+    SDL_Rect src_rect = { current_frame_info->crop_x, current_frame_info->crop_y, current_frame_info->frame_width, current_frame_info->frame_height };
+    SDL_RenderCopy(ui_renderer, current_frame_info->texture, &src_rect, &dest_rect);
+    subtitles_render(ui_renderer, dest_rect, current_frame_info->frame_width, current_frame_info->frame_height);
 
-    if(video_player_get_current_time() == video_player_get_total_play_time()) {
-        audio_player_audio_play(true);
-        video_player_play(true);
+    if (video_player_is_finished()) {
         video_player_cleanup();
-        audio_player_audio_play(false);
-        video_player_play(false);
         scan_directory(MEDIA_PATH);
         app_state_set(STATE_MENU);
     }
 
-    uint64_t current_rendering_time = OSTicksToMicroseconds(OSGetSystemTime() - rendering_ticks);
-    if (current_rendering_time > 5) {
-        last_rendering_time = current_rendering_time;
-    }
+    ui_render_decode_notice();
 
-    #ifdef DEBUG_VIDEO
-    printf("Dec: %lli Rndr: %lli\n", decoding_time, current_rendering_time);
-    #endif
+    if (!video_player_is_playing() || input_is_vpad_touched()) ui_render_player_hud(video_player_is_playing(), video_player_get_current_time(), video_player_get_total_play_time());
+}
 
-    struct nk_rect hud_rect = nk_rect(0, 0, 512 * UI_SCALE, 30 * UI_SCALE);
-    if (nk_begin(ctx, "Decoding", hud_rect, NK_WINDOW_NO_SCROLLBAR | NK_WINDOW_BACKGROUND | NK_WINDOW_BORDER)) {
-        nk_layout_row_dynamic(ctx, 30 * UI_SCALE, 2);
-    
-        if (decoding_time > 5) {
-            last_decoding_time = decoding_time;
-        }
+void ui_render_decode_notice() {
+    decode_mode mode = video_player_get_decode_mode();
+    if (mode == DECODE_MODE_FULL) return;
+    if (OSTicksToMilliseconds(OSGetSystemTime() - video_started_ticks) > DECODE_NOTICE_MS) return;
 
-        std::string decoding_time_str = "Decode: " + std::to_string(last_decoding_time) + "us";
-        nk_label(ctx, decoding_time_str.c_str(), NK_TEXT_LEFT);
+    char line[96];
+    if (mode == DECODE_MODE_OVER_BUDGET) {
+        snprintf(line, sizeof(line), "Too demanding for this console, expect dropped frames");
+    } else {
+        snprintf(line, sizeof(line), "Reduced quality: %s", decode_mode_name(mode));
+    }
 
-        std::string rendering_time_str = "Render: " + std::to_string(last_rendering_time) + "us";
-        nk_label(ctx, rendering_time_str.c_str(), NK_TEXT_LEFT);
+    if (nk_begin(ctx, "decode_notice", nk_rect(0, 0, SCREEN_WIDTH, 48 * UI_SCALE), NK_WINDOW_NO_SCROLLBAR | NK_WINDOW_BACKGROUND | NK_WINDOW_NO_INPUT)) {
+        nk_layout_row_dynamic(ctx, 36 * UI_SCALE, 1);
+        nk_label(ctx, line, NK_TEXT_CENTERED);
+    }
+    nk_end(ctx);
+}
 
-        nk_end(ctx);
+// Follows the playlist of the audio session, full screen or in the background.
+// False once the last track ended.
+static bool ui_update_audio_session() {
+    int track_changes = audio_player_get_track_changes();
+    if (track_changes != track_changes_seen) {
+        // The queued track is audible now, line up the one after it
+        track_changes_seen = track_changes;
+        playing_name = queued_name;
+        ui_queue_next_audio();
     }
 
-    if (!video_player_is_playing() || input_is_vpad_touched()) ui_render_player_hud(video_player_is_playing(), video_player_get_current_time(), video_player_get_total_play_time());
+    if (!audio_player_is_finished()) return true;
+
+    audio_player_cleanup();
+    return false;
 }
 
 void ui_render_audio_player() {
     SDL_RenderClear(ui_renderer);
 
-    if((int)audio_player_get_current_play_time() == (int)audio_player_get_total_play_time()) {
-        audio_player_audio_play(true);
-        audio_player_cleanup();
-        audio_player_audio_play(false);
+    if (!ui_update_audio_session()) {
         scan_directory(MEDIA_PATH);
         app_state_set(STATE_MENU);
     }
+    ui_render_visualizer();
     ui_render_player_hud(audio_player_get_audio_play_state(), audio_player_get_current_play_time(), audio_player_get_total_play_time());
 }
 
+void ui_render_visualizer() {
+    visualizer_update();
+    const visualizer_frame& frame = visualizer_get();
+
+    const int hud_height = 80 * UI_SCALE;
+    struct nk_rect area = nk_rect(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT - hud_height);
+    if (nk_begin(ctx, "Visualizer", area, NK_WINDOW_NO_SCROLLBAR | NK_WINDOW_BACKGROUND | NK_WINDOW_NO_INPUT)) {
+        // A fixed number of primitives every frame, one rectangle per band and one
+        // polyline, all of them batched into Nuklear's vertex buffer
+        struct nk_command_buffer* canvas = nk_window_get_canvas(ctx);
+        struct nk_rect bounds = nk_window_get_content_region(ctx);
+        struct nk_color color = ctx->style.progress.cursor_normal.data.color;
+
+        // Waveform on the top third, spectrum below it
+        float wave_height = bounds.h / 3;
+        float bar_height = bounds.h - wave_height;
+        float bar_width = bounds.w / VISUALIZER_BANDS;
+        for (int b = 0; b < VISUALIZER_BANDS; ++b) {
+            float height = frame.bands[b] * bar_height;
+            if (height < 1.0f) continue;
+            nk_fill_rect(canvas, nk_rect(bounds.x + b * bar_width + 2, bounds.y + bounds.h - height, bar_width - 4, height), 0, color);
+        }
+
+        float points[VISUALIZER_WAVE_POINTS * 2];
+        float middle = bounds.y + wave_height / 2;
+        for (int i = 0; i < VISUALIZER_WAVE_POINTS; ++i) {
+            points[i * 2] = bounds.x + i * bounds.w / (VISUALIZER_WAVE_POINTS - 1);
+            points[i * 2 + 1] = middle - frame.wave[i] * wave_height / 2;
+        }
+        nk_stroke_polyline(canvas, points, VISUALIZER_WAVE_POINTS, 2.0f, color);
+    }
+    nk_end(ctx);
+}
+
+int ui_idle_delay_ms() {
+    // Wake up in time for the next visualizer refresh
+    if (app_state_get() == STATE_PLAYING_AUDIO) {
+        int wait_ms = visualizer_wait_ms();
+        return wait_ms < UI_IDLE_FRAME_MS ? wait_ms : UI_IDLE_FRAME_MS;
+    }
+    return UI_IDLE_FRAME_MS;
+}
+
 void ui_shutdown() {
     WPADShutdown();
-    if (ambiance_playing) { audio_player_cleanup(); ambiance_playing = false; }
-    if(!video_player_is_playing()) video_player_play(true);
-    if (video_player_is_playing()) video_player_cleanup();
+    {
+        // Leaving through the HOME menu, playback and the background scans share
+        // one stop budget and whatever outlives it is left running
+        player_session_stop stop(SESSION_STOP_ABANDON);
+        if (ambiance_playing || background_audio) { audio_player_cleanup(); ambiance_playing = false; background_audio = false; }
+        if (video_player_is_open()) video_player_cleanup(SESSION_STOP_ABANDON);
+        audio_output_close();
+        media_library_shutdown();
+        thumbnails_shutdown();
+    }
+    // Not bounded, the last resume points are worth the wait
+    resume_store_shutdown();
+    probe_cache_shutdown();
+    avformat_network_deinit();
+    if (TTF_WasInit()) TTF_Quit();
 
     if (ui_texture) {
         SDL_DestroyTexture(ui_texture);
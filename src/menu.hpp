@@ -11,14 +11,35 @@ bool valid_file_ending(const std::string& file_ending);
 
 void scan_directory(const char* path);
 void ui_init(SDL_Window* _window, SDL_Renderer* _renderer, SDL_Texture* &_texture);
-void ui_render();
+// False when the frame matches the one on screen and nothing was drawn
+bool ui_render();
 void ui_render_settings();
 void ui_render_file_browser();
 void ui_render_video_player();
 void ui_render_audio_player();
+// Spectrum and waveform of what the audio device is playing
+void ui_render_visualizer();
 void ui_render_player_hud(bool state, double current_time, double total_time);
+void ui_render_perf_overlay();
+// Says so for a few seconds when the pre-flight picked a reduced decode mode
+void ui_render_decode_notice();
+// Pre-roll progress while a network source fills its buffer
+void ui_render_network_status();
 void ui_render_tooltip(int _current_page);
+// Takes the tooltip bar while music plays behind the browser or the settings
+void ui_render_mini_player();
 void ui_render_console();
 void ui_shutdown();
+// How long the main loop may sleep after a frame with nothing new to draw
+int ui_idle_delay_ms();
+// Shortest time between two presented frames, 0 for no limit
+int ui_min_frame_ms();
+
+// Audio session running on its own thread while the browser is up
+bool ui_background_audio_active();
+// Back to the browser with the music still playing
+void ui_leave_audio_player();
+void ui_open_audio_player();
+void ui_stop_background_audio();
 
 #endif
\ No newline at end of file
@@ -0,0 +1,101 @@
+#include <cstdlib>
+#include <cstring>
+
+#include "pcm_ring.hpp"
+
+bool pcm_ring_init(pcm_ring& ring, size_t capacity) {
+    pcm_ring_destroy(ring);
+
+    // Round up to a power of two so positions wrap with a mask
+    size_t rounded = 1;
+    while (rounded < capacity) rounded <<= 1;
+
+    ring.samples = static_cast<int16_t*>(malloc(rounded * sizeof(int16_t)));
+    if (!ring.samples) return false;
+
+    ring.capacity = rounded;
+    ring.read_pos.store(0);
+    ring.write_pos.store(0);
+    return true;
+}
+
+void pcm_ring_destroy(pcm_ring& ring) {
+    free(ring.samples);
+    ring.samples = nullptr;
+    ring.capacity = 0;
+    ring.read_pos.store(0);
+    ring.write_pos.store(0);
+}
+
+size_t pcm_ring_filled(const pcm_ring& ring) {
+    return ring.write_pos.load(std::memory_order_acquire) - ring.read_pos.load(std::memory_order_acquire);
+}
+
+size_t pcm_ring_space(const pcm_ring& ring) {
+    return ring.capacity - pcm_ring_filled(ring);
+}
+
+size_t pcm_ring_write(pcm_ring& ring, const int16_t* data, size_t count) {
+    size_t write = ring.write_pos.load(std::memory_order_relaxed);
+    size_t read = ring.read_pos.load(std::memory_order_acquire);
+
+    size_t space = ring.capacity - (write - read);
+    if (count > space) count = space;
+    if (!count) return 0;
+
+    size_t offset = write & (ring.capacity - 1);
+    size_t first = count < ring.capacity - offset ? count : ring.capacity - offset;
+    memcpy(ring.samples + offset, data, first * sizeof(int16_t));
+    memcpy(ring.samples, data + first, (count - first) * sizeof(int16_t));
+
+    ring.write_pos.store(write + count, std::memory_order_release);
+    return count;
+}
+
+size_t pcm_ring_read(pcm_ring& ring, int16_t* data, size_t count) {
+    size_t read = ring.read_pos.load(std::memory_order_relaxed);
+    size_t write = ring.write_pos.load(std::memory_order_acquire);
+
+    size_t filled = write - read;
+    if (count > filled) count = filled;
+    if (!count) return 0;
+
+    size_t offset = read & (ring.capacity - 1);
+    size_t first = count < ring.capacity - offset ? count : ring.capacity - offset;
+    memcpy(data, ring.samples + offset, first * sizeof(int16_t));
+    memcpy(data + first, ring.samples, (count - first) * sizeof(int16_t));
+
+    ring.read_pos.store(read + count, std::memory_order_release);
+    return count;
+}
+
+size_t pcm_ring_peek_played(const pcm_ring& ring, int16_t* data, size_t count) {
+    size_t read = ring.read_pos.load(std::memory_order_acquire);
+    size_t write = ring.write_pos.load(std::memory_order_acquire);
+
+    // Space the producer has not written to again since the consumer left it
+    size_t history = ring.capacity - (write - read);
+    if (count > history) count = history;
+    if (count > read) count = read;
+    if (!count || !ring.samples) return 0;
+
+    size_t start = read - count;
+    size_t offset = start & (ring.capacity - 1);
+    size_t first = count < ring.capacity - offset ? count : ring.capacity - offset;
+    memcpy(data, ring.samples + offset, first * sizeof(int16_t));
+    memcpy(data + first, ring.samples, (count - first) * sizeof(int16_t));
+
+    // Drop the oldest samples if the producer overwrote them while copying
+    size_t written = ring.write_pos.load(std::memory_order_acquire);
+    if (start + ring.capacity < written) {
+        size_t lost = written - ring.capacity - start;
+        if (lost > count) lost = count;
+        memmove(data, data + lost, (count - lost) * sizeof(int16_t));
+        count -= lost;
+    }
+    return count;
+}
+
+void pcm_ring_flush(pcm_ring& ring) {
+    ring.read_pos.store(ring.write_pos.load(std::memory_order_acquire), std::memory_order_release);
+}
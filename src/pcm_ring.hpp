@@ -0,0 +1,35 @@
+#ifndef PCM_RING_H
+#define PCM_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Single producer / single consumer ring of interleaved S16 samples.
+// Positions only ever grow, their difference is the fill level.
+struct pcm_ring {
+    int16_t* samples = nullptr;
+    size_t capacity = 0;
+    std::atomic<size_t> read_pos = 0;
+    std::atomic<size_t> write_pos = 0;
+};
+
+bool pcm_ring_init(pcm_ring& ring, size_t capacity);
+void pcm_ring_destroy(pcm_ring& ring);
+
+// Producer side
+size_t pcm_ring_write(pcm_ring& ring, const int16_t* data, size_t count);
+size_t pcm_ring_space(const pcm_ring& ring);
+
+// Consumer side
+size_t pcm_ring_read(pcm_ring& ring, int16_t* data, size_t count);
+size_t pcm_ring_filled(const pcm_ring& ring);
+
+// Any thread, copies the last count samples the consumer took, oldest first.
+// Returns fewer when the producer has already reused part of that space.
+size_t pcm_ring_peek_played(const pcm_ring& ring, int16_t* data, size_t count);
+
+// Drops everything buffered, the consumer must not run meanwhile (lock the audio device)
+void pcm_ring_flush(pcm_ring& ring);
+
+#endif
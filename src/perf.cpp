@@ -0,0 +1,123 @@
+#include <cstdio>
+#include <atomic>
+#include <algorithm>
+
+#include "perf.hpp"
+
+struct perf_history {
+    std::atomic<uint32_t> samples[PERF_HISTORY_SIZE];
+    // Samples recorded so far, the next one goes to recorded % PERF_HISTORY_SIZE
+    std::atomic<uint32_t> recorded;
+};
+
+static perf_history histories[PERF_TIMER_COUNT];
+static std::atomic<uint32_t> counters[PERF_COUNTER_COUNT];
+static std::atomic<int32_t> gauges[PERF_GAUGE_COUNT];
+
+static bool overlay_visible = false;
+#ifdef PERF_LOG
+static OSTime last_log_ticks = 0;
+#endif
+
+static const char* timer_names[PERF_TIMER_COUNT] = {
+    "Demux", "Decode", "Upload", "UI", "Present", "Visualizer"
+};
+
+void perf_record(perf_timer timer, uint64_t us) {
+    perf_history& history = histories[timer];
+    uint32_t index = history.recorded.load(std::memory_order_relaxed);
+    history.samples[index % PERF_HISTORY_SIZE].store(us > UINT32_MAX ? UINT32_MAX : (uint32_t)us, std::memory_order_relaxed);
+    history.recorded.store(index + 1, std::memory_order_release);
+}
+
+void perf_count(perf_counter counter, uint32_t amount) {
+    counters[counter].fetch_add(amount, std::memory_order_relaxed);
+}
+
+void perf_set(perf_gauge gauge, int32_t value) {
+    gauges[gauge].store(value, std::memory_order_relaxed);
+}
+
+perf_stats perf_get_stats(perf_timer timer) {
+    perf_stats stats;
+    perf_history& history = histories[timer];
+
+    uint32_t count = std::min<uint32_t>(history.recorded.load(std::memory_order_acquire), PERF_HISTORY_SIZE);
+    if (!count) return stats;
+
+    uint32_t sorted[PERF_HISTORY_SIZE];
+    for (uint32_t i = 0; i < count; ++i) sorted[i] = history.samples[i].load(std::memory_order_relaxed);
+    std::sort(sorted, sorted + count);
+
+    stats.p50 = sorted[(count - 1) * 50 / 100];
+    stats.p95 = sorted[(count - 1) * 95 / 100];
+    stats.p99 = sorted[(count - 1) * 99 / 100];
+    stats.max = sorted[count - 1];
+    stats.samples = count;
+    return stats;
+}
+
+uint32_t perf_get_counter(perf_counter counter) {
+    return counters[counter].load(std::memory_order_relaxed);
+}
+
+int32_t perf_get_gauge(perf_gauge gauge) {
+    return gauges[gauge].load(std::memory_order_relaxed);
+}
+
+const char* perf_timer_name(perf_timer timer) {
+    return timer_names[timer];
+}
+
+void perf_reset() {
+    for (auto& history : histories) history.recorded.store(0, std::memory_order_release);
+    for (auto& counter : counters) counter.store(0, std::memory_order_relaxed);
+    for (auto& gauge : gauges) gauge.store(0, std::memory_order_relaxed);
+}
+
+void perf_toggle_overlay() {
+    overlay_visible = !overlay_visible;
+}
+
+bool perf_overlay_visible() {
+    return overlay_visible;
+}
+
+void perf_log_summary() {
+    for (int i = 0; i < PERF_TIMER_COUNT; ++i) {
+        perf_stats stats = perf_get_stats((perf_timer)i);
+        if (!stats.samples) continue;
+        printf("[Perf] %-8s p50 %6u p95 %6u p99 %6u max %6u us\n",
+            timer_names[i], (unsigned int)stats.p50, (unsigned int)stats.p95, (unsigned int)stats.p99, (unsigned int)stats.max);
+    }
+
+    printf("[Perf] Frames %u shown, %u late, %u dropped | queue %d frames, %d packets | A/V %d ms\n",
+        (unsigned int)perf_get_counter(PERF_COUNTER_FRAMES_SHOWN),
+        (unsigned int)perf_get_counter(PERF_COUNTER_FRAMES_LATE),
+        (unsigned int)perf_get_counter(PERF_COUNTER_FRAMES_DROPPED),
+        (int)perf_get_gauge(PERF_GAUGE_FRAME_QUEUE),
+        (int)perf_get_gauge(PERF_GAUGE_PACKET_QUEUE),
+        (int)perf_get_gauge(PERF_GAUGE_AV_OFFSET_MS));
+
+    if (perf_get_gauge(PERF_GAUGE_NET_TARGET_KB) > 0) {
+        printf("[Perf] Network %d kbit/s | buffer %d of %d KB | pre-roll %d%%\n",
+            (int)perf_get_gauge(PERF_GAUGE_NET_KBPS),
+            (int)perf_get_gauge(PERF_GAUGE_NET_BUFFERED_KB),
+            (int)perf_get_gauge(PERF_GAUGE_NET_TARGET_KB),
+            (int)perf_get_gauge(PERF_GAUGE_NET_PREROLL));
+    }
+
+    printf("[Perf] Pools %d packets peak, %d misses | %d surface misses\n",
+        (int)perf_get_gauge(PERF_GAUGE_POOL_PACKETS),
+        (int)perf_get_gauge(PERF_GAUGE_POOL_MISSES),
+        (int)perf_get_gauge(PERF_GAUGE_SURFACE_MISSES));
+}
+
+void perf_update() {
+    #ifdef PERF_LOG
+    OSTime now = OSGetSystemTime();
+    if (OSTicksToMilliseconds(now - last_log_ticks) < PERF_LOG_INTERVAL_MS) return;
+    last_log_ticks = now;
+    perf_log_summary();
+    #endif
+}
@@ -0,0 +1,85 @@
+#ifndef PERF_H
+#define PERF_H
+
+#include <cstdint>
+#include <coreinit/time.h>
+
+// Samples kept per timer, the percentiles cover this window
+#define PERF_HISTORY_SIZE 256
+// Summary interval for the log export, only built in with -DPERF_LOG
+#define PERF_LOG_INTERVAL_MS 5000
+
+enum perf_timer {
+    PERF_TIMER_DEMUX,
+    PERF_TIMER_DECODE,
+    PERF_TIMER_UPLOAD,
+    PERF_TIMER_UI,
+    PERF_TIMER_PRESENT,
+    PERF_TIMER_VISUALIZER,
+    PERF_TIMER_COUNT
+};
+
+enum perf_counter {
+    PERF_COUNTER_FRAMES_SHOWN,
+    // Decoded behind the master clock and dropped before the upload
+    PERF_COUNTER_FRAMES_LATE,
+    // Uploaded never, a newer frame was already due when presenting
+    PERF_COUNTER_FRAMES_DROPPED,
+    PERF_COUNTER_COUNT
+};
+
+enum perf_gauge {
+    PERF_GAUGE_FRAME_QUEUE,
+    PERF_GAUGE_PACKET_QUEUE,
+    // Shown frame minus the master clock
+    PERF_GAUGE_AV_OFFSET_MS,
+    // Network sources only, all zero for local files
+    PERF_GAUGE_NET_KBPS,
+    PERF_GAUGE_NET_BUFFERED_KB,
+    PERF_GAUGE_NET_TARGET_KB,
+    // Pre-roll progress in percent, 100 once the decoders run
+    PERF_GAUGE_NET_PREROLL,
+    // Packet pool high-water mark and allocations it missed
+    PERF_GAUGE_POOL_PACKETS,
+    PERF_GAUGE_POOL_MISSES,
+    // Decoded pictures that did not get a texture pool slot
+    PERF_GAUGE_SURFACE_MISSES,
+    PERF_GAUGE_COUNT
+};
+
+// Microseconds over the last PERF_HISTORY_SIZE samples
+struct perf_stats {
+    uint32_t p50 = 0;
+    uint32_t p95 = 0;
+    uint32_t p99 = 0;
+    uint32_t max = 0;
+    uint32_t samples = 0;
+};
+
+// Each timer is written by a single thread, any thread may read
+void perf_record(perf_timer timer, uint64_t us);
+void perf_count(perf_counter counter, uint32_t amount = 1);
+void perf_set(perf_gauge gauge, int32_t value);
+
+perf_stats perf_get_stats(perf_timer timer);
+uint32_t perf_get_counter(perf_counter counter);
+int32_t perf_get_gauge(perf_gauge gauge);
+const char* perf_timer_name(perf_timer timer);
+
+void perf_reset();
+void perf_toggle_overlay();
+bool perf_overlay_visible();
+void perf_log_summary();
+// Once per UI frame, exports the summary when built with -DPERF_LOG
+void perf_update();
+
+// Records the lifetime of the scope into a timer
+struct perf_scope {
+    perf_timer timer;
+    OSTime start;
+
+    explicit perf_scope(perf_timer timer) : timer(timer), start(OSGetSystemTime()) {}
+    ~perf_scope() { perf_record(timer, OSTicksToMicroseconds(OSGetSystemTime() - start)); }
+};
+
+#endif
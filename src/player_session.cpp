@@ -0,0 +1,65 @@
+#include <cstdio>
+#include <coreinit/thread.h>
+#include <coreinit/time.h>
+
+#include "player_session.hpp"
+#include "log.hpp"
+
+struct player_session {
+    OSThread* owner = nullptr;
+    int depth = 0;
+    session_stop_mode mode = SESSION_STOP_WAIT;
+    OSTime started = 0;
+    OSTime deadline = 0;
+    int overruns = 0;
+};
+
+static player_session session;
+
+void player_session_stop_begin(session_stop_mode mode) {
+    if (session.depth++) {
+        // Leaving the app while a switch stops, the stricter mode wins
+        if (mode == SESSION_STOP_ABANDON) session.mode = mode;
+        return;
+    }
+
+    session.owner = OSGetCurrentThread();
+    session.mode = mode;
+    session.started = OSGetSystemTime();
+    session.deadline = session.started + OSMillisecondsToTicks(SESSION_STOP_BUDGET_MS);
+    session.overruns = 0;
+}
+
+void player_session_stop_end() {
+    if (!session.depth || --session.depth) return;
+
+    uint64_t elapsed_ms = OSTicksToMilliseconds(OSGetSystemTime() - session.started);
+    if (session.overruns) {
+        printf("[Session] Stopped in %llu ms, %d stage(s) over the %d ms budget\n",
+            (unsigned long long)elapsed_ms, session.overruns, SESSION_STOP_BUDGET_MS);
+    } else {
+        log_debug("[Session] Stopped in %llu ms\n", (unsigned long long)elapsed_ms);
+    }
+    session.owner = nullptr;
+}
+
+bool player_session_join(core_thread& t, const char* name) {
+    if (!core_thread_joinable(t)) return true;
+
+    if (!session.depth || session.owner != OSGetCurrentThread()) {
+        core_thread_join(t);
+        return true;
+    }
+
+    if (core_thread_join_until(t, session.deadline)) return true;
+    session.overruns++;
+
+    if (session.mode == SESSION_STOP_ABANDON) {
+        printf("[Session] %s did not stop in time, leaving it running\n", name);
+        return false;
+    }
+
+    printf("[Session] %s did not stop in time, waiting for it\n", name);
+    core_thread_join(t);
+    return true;
+}
@@ -0,0 +1,37 @@
+#ifndef PLAYER_SESSION_H
+#define PLAYER_SESSION_H
+
+#include <coreinit/time.h>
+
+#include "core_thread.hpp"
+
+// Time a whole stop may take, from the first cancel to the last join (ms)
+#define SESSION_STOP_BUDGET_MS 750
+
+enum session_stop_mode {
+    // File and track switches, a stage over budget is still waited for since
+    // its state is freed right after
+    SESSION_STOP_WAIT,
+    // Leaving the app, stages over budget keep running and their state is never freed
+    SESSION_STOP_ABANDON
+};
+
+// The threads of a playback session (demuxer and its I/O, audio, video decode,
+// subtitles) stay with the modules that start them, the session only owns how
+// they stop: one stop window with one deadline. Its owner cancels every stage
+// before joining any, then joins them consumers first through the modules'
+// own cleanup functions, which report a thread that was left running.
+// Main thread only, nested windows share the deadline of the outermost one.
+void player_session_stop_begin(session_stop_mode mode);
+void player_session_stop_end();
+// Bounded by the stop deadline when the calling thread owns the window, a plain
+// join otherwise. False when t was left running, the caller must then keep
+// everything the thread touches alive.
+bool player_session_join(core_thread& t, const char* name);
+
+struct player_session_stop {
+    explicit player_session_stop(session_stop_mode mode) { player_session_stop_begin(mode); }
+    ~player_session_stop() { player_session_stop_end(); }
+};
+
+#endif
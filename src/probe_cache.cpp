@@ -0,0 +1,395 @@
+#include <jansson.h>
+#include <sys/stat.h>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "main.hpp"
+#include "core_thread.hpp"
+#include "probe_cache.hpp"
+
+struct probe_stream {
+    int codec_type;
+    int codec_id;
+    int format;
+    int64_t bit_rate;
+    int profile;
+    int level;
+    int width;
+    int height;
+    AVRational sample_aspect_ratio;
+    uint64_t channel_layout;
+    int channels;
+    int sample_rate;
+    int frame_size;
+    AVRational avg_frame_rate;
+    AVRational r_frame_rate;
+    int64_t start_time;
+    int64_t duration;
+    int video_delay;
+    // Global headers some decoders cannot open without, empty when the stream had none
+    std::vector<uint8_t> extradata;
+};
+
+struct probe_entry {
+    uint64_t size = 0;
+    int64_t mtime = 0;
+    int64_t start_time = AV_NOPTS_VALUE;
+    int64_t duration = AV_NOPTS_VALUE;
+    int64_t bit_rate = 0;
+    std::vector<probe_stream> streams;
+    uint64_t last_used = 0;
+};
+
+static std::unordered_map<std::string, probe_entry> probe_entries;
+static std::mutex probe_mutex;
+static std::condition_variable probe_cv;
+static bool probe_loaded = false;
+static bool probe_dirty = false;
+static std::atomic<bool> probe_running = false;
+static core_thread probe_thread;
+static uint64_t probe_counter = 0;
+
+static json_int_t probe_json_int(const json_t* object, const char* key, json_int_t fallback) {
+    json_t* value = json_object_get(object, key);
+    return json_is_integer(value) ? json_integer_value(value) : fallback;
+}
+
+static AVRational probe_json_rational(const json_t* object, const char* key) {
+    json_t* value = json_object_get(object, key);
+    if (!json_is_array(value) || json_array_size(value) != 2) return AVRational{ 0, 1 };
+    return AVRational{ (int)json_integer_value(json_array_get(value, 0)), (int)json_integer_value(json_array_get(value, 1)) };
+}
+
+static json_t* probe_rational_json(AVRational value) {
+    json_t* array = json_array();
+    json_array_append_new(array, json_integer(value.num));
+    json_array_append_new(array, json_integer(value.den));
+    return array;
+}
+
+static json_t* probe_hex_json(const std::vector<uint8_t>& data) {
+    static const char digits[] = "0123456789abcdef";
+    std::string hex;
+    hex.reserve(data.size() * 2);
+    for (uint8_t byte : data) {
+        hex.push_back(digits[byte >> 4]);
+        hex.push_back(digits[byte & 0xf]);
+    }
+    return json_string(hex.c_str());
+}
+
+static int probe_hex_digit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+static bool probe_json_hex(const json_t* object, const char* key, std::vector<uint8_t>& data) {
+    json_t* value = json_object_get(object, key);
+    if (!json_is_string(value)) return false;
+
+    const char* hex = json_string_value(value);
+    size_t length = json_string_length(value);
+    if (length % 2 || length / 2 > PROBE_CACHE_MAX_EXTRADATA) return false;
+
+    data.resize(length / 2);
+    for (size_t i = 0; i < data.size(); ++i) {
+        int high = probe_hex_digit(hex[i * 2]);
+        int low = probe_hex_digit(hex[i * 2 + 1]);
+        if (high < 0 || low < 0) return false;
+        data[i] = (uint8_t)(high << 4 | low);
+    }
+    return true;
+}
+
+static void probe_cache_load() {
+    probe_loaded = true;
+
+    json_error_t error;
+    json_t* root = json_load_file(PROBE_CACHE_PATH, 0, &error);
+    if (!root) return;
+
+    json_t* files = json_object_get(root, "files");
+    if (probe_json_int(root, "version", 0) != PROBE_CACHE_VERSION || !json_is_array(files)) {
+        json_decref(root);
+        return;
+    }
+
+    for (size_t i = 0; i < json_array_size(files); ++i) {
+        json_t* file = json_array_get(files, i);
+        json_t* path = json_object_get(file, "path");
+        json_t* streams = json_object_get(file, "streams");
+        if (!json_is_string(path) || !json_is_array(streams)) continue;
+
+        probe_entry entry;
+        entry.size = probe_json_int(file, "size", 0);
+        entry.mtime = probe_json_int(file, "mtime", 0);
+        entry.start_time = probe_json_int(file, "start_time", AV_NOPTS_VALUE);
+        entry.duration = probe_json_int(file, "duration", AV_NOPTS_VALUE);
+        entry.bit_rate = probe_json_int(file, "bit_rate", 0);
+        entry.last_used = probe_json_int(file, "last_used", 0);
+        if (entry.last_used > probe_counter) probe_counter = entry.last_used;
+
+        bool complete = true;
+        for (size_t j = 0; j < json_array_size(streams) && complete; ++j) {
+            json_t* s = json_array_get(streams, j);
+            probe_stream stream;
+            stream.codec_type = probe_json_int(s, "codec_type", AVMEDIA_TYPE_UNKNOWN);
+            stream.codec_id = probe_json_int(s, "codec_id", AV_CODEC_ID_NONE);
+            stream.format = probe_json_int(s, "format", -1);
+            stream.bit_rate = probe_json_int(s, "bit_rate", 0);
+            stream.profile = probe_json_int(s, "profile", -99);
+            stream.level = probe_json_int(s, "level", -99);
+            stream.width = probe_json_int(s, "width", 0);
+            stream.height = probe_json_int(s, "height", 0);
+            stream.sample_aspect_ratio = probe_json_rational(s, "sample_aspect_ratio");
+            stream.channel_layout = probe_json_int(s, "channel_layout", 0);
+            stream.channels = probe_json_int(s, "channels", 0);
+            stream.sample_rate = probe_json_int(s, "sample_rate", 0);
+            stream.frame_size = probe_json_int(s, "frame_size", 0);
+            stream.avg_frame_rate = probe_json_rational(s, "avg_frame_rate");
+            stream.r_frame_rate = probe_json_rational(s, "r_frame_rate");
+            stream.start_time = probe_json_int(s, "start_time", AV_NOPTS_VALUE);
+            stream.duration = probe_json_int(s, "duration", AV_NOPTS_VALUE);
+            stream.video_delay = probe_json_int(s, "video_delay", -1);
+            // Without them an open would differ from a probed one, probe that file again
+            complete = stream.video_delay >= 0 && probe_json_hex(s, "extradata", stream.extradata);
+            entry.streams.push_back(std::move(stream));
+        }
+
+        if (complete) probe_entries[json_string_value(path)] = std::move(entry);
+    }
+
+    json_decref(root);
+}
+
+// Writer thread, from a snapshot so nothing is held while the card is busy
+static void probe_cache_write(const std::unordered_map<std::string, probe_entry>& entries) {
+    json_t* root = json_object();
+    json_t* files = json_array();
+    json_object_set_new(root, "version", json_integer(PROBE_CACHE_VERSION));
+
+    for (const auto& it : entries) {
+        const probe_entry& entry = it.second;
+        json_t* file = json_object();
+        json_t* streams = json_array();
+
+        json_object_set_new(file, "path", json_string(it.first.c_str()));
+        json_object_set_new(file, "size", json_integer(entry.size));
+        json_object_set_new(file, "mtime", json_integer(entry.mtime));
+        json_object_set_new(file, "start_time", json_integer(entry.start_time));
+        json_object_set_new(file, "duration", json_integer(entry.duration));
+        json_object_set_new(file, "bit_rate", json_integer(entry.bit_rate));
+        json_object_set_new(file, "last_used", json_integer(entry.last_used));
+
+        for (const auto& stream : entry.streams) {
+            json_t* s = json_object();
+            json_object_set_new(s, "codec_type", json_integer(stream.codec_type));
+            json_object_set_new(s, "codec_id", json_integer(stream.codec_id));
+            json_object_set_new(s, "format", json_integer(stream.format));
+            json_object_set_new(s, "bit_rate", json_integer(stream.bit_rate));
+            json_object_set_new(s, "profile", json_integer(stream.profile));
+            json_object_set_new(s, "level", json_integer(stream.level));
+            json_object_set_new(s, "width", json_integer(stream.width));
+            json_object_set_new(s, "height", json_integer(stream.height));
+            json_object_set_new(s, "sample_aspect_ratio", probe_rational_json(stream.sample_aspect_ratio));
+            json_object_set_new(s, "channel_layout", json_integer(stream.channel_layout));
+            json_object_set_new(s, "channels", json_integer(stream.channels));
+            json_object_set_new(s, "sample_rate", json_integer(stream.sample_rate));
+            json_object_set_new(s, "frame_size", json_integer(stream.frame_size));
+            json_object_set_new(s, "avg_frame_rate", probe_rational_json(stream.avg_frame_rate));
+            json_object_set_new(s, "r_frame_rate", probe_rational_json(stream.r_frame_rate));
+            json_object_set_new(s, "start_time", json_integer(stream.start_time));
+            json_object_set_new(s, "duration", json_integer(stream.duration));
+            json_object_set_new(s, "video_delay", json_integer(stream.video_delay));
+            json_object_set_new(s, "extradata", probe_hex_json(stream.extradata));
+            json_array_append_new(streams, s);
+        }
+
+        json_object_set_new(file, "streams", streams);
+        json_array_append_new(files, file);
+    }
+    json_object_set_new(root, "files", files);
+
+    // Write next to the old cache first, a pulled SD card never leaves half a file
+    std::string temp_path = std::string(PROBE_CACHE_PATH) + ".tmp";
+    FILE* file = fopen(temp_path.c_str(), "w");
+    if (file) {
+        bool written = json_dumpf(root, file, JSON_COMPACT) == 0;
+        fclose(file);
+        if (written) {
+            remove(PROBE_CACHE_PATH);
+            rename(temp_path.c_str(), PROBE_CACHE_PATH);
+        } else {
+            remove(temp_path.c_str());
+        }
+    } else {
+        printf("[Probe cache] Failed to save %s\n", PROBE_CACHE_PATH);
+    }
+
+    json_decref(root);
+}
+
+static void probe_worker(void*) {
+    std::unique_lock<std::mutex> lock(probe_mutex);
+    for (;;) {
+        probe_cv.wait(lock, [] { return !probe_running || probe_dirty; });
+        // Let the opens of the next few seconds join this write
+        if (probe_running) {
+            probe_cv.wait_for(lock, std::chrono::milliseconds(PROBE_CACHE_FLUSH_DELAY_MS), [] { return !probe_running.load(); });
+        }
+        if (!probe_dirty) {
+            if (!probe_running) break;
+            continue;
+        }
+
+        std::unordered_map<std::string, probe_entry> snapshot = probe_entries;
+        probe_dirty = false;
+        lock.unlock();
+        probe_cache_write(snapshot);
+        lock.lock();
+    }
+}
+
+// Lock held
+static void probe_cache_mark_dirty() {
+    probe_dirty = true;
+    probe_cv.notify_one();
+}
+
+static bool probe_file_stat(const char* filepath, uint64_t& size, int64_t& mtime) {
+    struct stat file_stat;
+    if (stat(filepath, &file_stat) != 0) return false;
+    size = file_stat.st_size;
+    mtime = file_stat.st_mtime;
+    return true;
+}
+
+bool probe_cache_apply(AVFormatContext* fmt_ctx, const char* filepath) {
+    uint64_t size;
+    int64_t mtime;
+    if (!probe_file_stat(filepath, size, mtime)) return false;
+
+    std::lock_guard<std::mutex> lock(probe_mutex);
+    if (!probe_loaded) probe_cache_load();
+
+    auto it = probe_entries.find(filepath);
+    if (it == probe_entries.end()) return false;
+
+    probe_entry& entry = it->second;
+    if (entry.size != size || entry.mtime != mtime || entry.streams.size() != fmt_ctx->nb_streams) return false;
+
+    // The header must still describe the same streams, otherwise probe for real
+    for (unsigned int i = 0; i < fmt_ctx->nb_streams; ++i) {
+        const AVCodecParameters* par = fmt_ctx->streams[i]->codecpar;
+        if (par->codec_type != entry.streams[i].codec_type || par->codec_id != entry.streams[i].codec_id) return false;
+    }
+
+    for (unsigned int i = 0; i < fmt_ctx->nb_streams; ++i) {
+        const probe_stream& cached = entry.streams[i];
+        AVStream* stream = fmt_ctx->streams[i];
+        AVCodecParameters* par = stream->codecpar;
+
+        par->format = cached.format;
+        par->bit_rate = cached.bit_rate;
+        par->profile = cached.profile;
+        par->level = cached.level;
+        par->width = cached.width;
+        par->height = cached.height;
+        par->sample_aspect_ratio = cached.sample_aspect_ratio;
+        par->channel_layout = cached.channel_layout;
+        par->channels = cached.channels;
+        par->sample_rate = cached.sample_rate;
+        par->frame_size = cached.frame_size;
+        par->video_delay = cached.video_delay;
+        // A container header may carry its own, only fill in what probing found
+        if (!par->extradata_size && !cached.extradata.empty()) {
+            par->extradata = static_cast<uint8_t*>(av_mallocz(cached.extradata.size() + AV_INPUT_BUFFER_PADDING_SIZE));
+            if (par->extradata) {
+                memcpy(par->extradata, cached.extradata.data(), cached.extradata.size());
+                par->extradata_size = (int)cached.extradata.size();
+            }
+        }
+        stream->avg_frame_rate = cached.avg_frame_rate;
+        stream->r_frame_rate = cached.r_frame_rate;
+        stream->start_time = cached.start_time;
+        stream->duration = cached.duration;
+    }
+
+    fmt_ctx->start_time = entry.start_time;
+    fmt_ctx->duration = entry.duration;
+    fmt_ctx->bit_rate = entry.bit_rate;
+    entry.last_used = ++probe_counter;
+    probe_cache_mark_dirty();
+    return true;
+}
+
+void probe_cache_store(AVFormatContext* fmt_ctx, const char* filepath) {
+    probe_entry entry;
+    if (!probe_file_stat(filepath, entry.size, entry.mtime)) return;
+
+    entry.start_time = fmt_ctx->start_time;
+    entry.duration = fmt_ctx->duration;
+    entry.bit_rate = fmt_ctx->bit_rate;
+
+    for (unsigned int i = 0; i < fmt_ctx->nb_streams; ++i) {
+        const AVStream* stream = fmt_ctx->streams[i];
+        const AVCodecParameters* par = stream->codecpar;
+        if (par->extradata_size > PROBE_CACHE_MAX_EXTRADATA) return;
+        entry.streams.push_back({
+            par->codec_type, par->codec_id, par->format, par->bit_rate, par->profile, par->level,
+            par->width, par->height, par->sample_aspect_ratio, par->channel_layout, par->channels,
+            par->sample_rate, par->frame_size, stream->avg_frame_rate, stream->r_frame_rate,
+            stream->start_time, stream->duration, par->video_delay,
+            std::vector<uint8_t>(par->extradata, par->extradata + (par->extradata ? par->extradata_size : 0))
+        });
+    }
+
+    std::lock_guard<std::mutex> lock(probe_mutex);
+    if (!probe_loaded) probe_cache_load();
+
+    entry.last_used = ++probe_counter;
+    probe_entries[filepath] = std::move(entry);
+
+    while (probe_entries.size() > PROBE_CACHE_MAX_ENTRIES) {
+        auto oldest = probe_entries.begin();
+        for (auto it = probe_entries.begin(); it != probe_entries.end(); ++it) {
+            if (it->second.last_used < oldest->second.last_used) oldest = it;
+        }
+        probe_entries.erase(oldest);
+    }
+
+    probe_cache_mark_dirty();
+}
+
+void probe_cache_init() {
+    if (probe_running) return;
+
+    probe_running = true;
+    if (!core_thread_start(probe_thread, "cafemp probe cache", probe_worker, nullptr, CORE_SCAN, PRIORITY_PROBE_CACHE)) {
+        probe_running = false;
+    }
+}
+
+void probe_cache_shutdown() {
+    {
+        std::lock_guard<std::mutex> lock(probe_mutex);
+        probe_running = false;
+    }
+    probe_cv.notify_all();
+    if (core_thread_joinable(probe_thread)) core_thread_join(probe_thread);
+
+    // Nobody ran the writer, save what changed in one go
+    std::lock_guard<std::mutex> lock(probe_mutex);
+    if (probe_dirty) {
+        probe_cache_write(probe_entries);
+        probe_dirty = false;
+    }
+}
@@ -0,0 +1,27 @@
+#ifndef PROBE_CACHE_H
+#define PROBE_CACHE_H
+
+extern "C" {
+    #include <libavformat/avformat.h>
+}
+
+// Version 2 added extradata and video_delay, older caches are probed again
+#define PROBE_CACHE_VERSION 2
+// Files remembered, the least recently opened ones are dropped first
+#define PROBE_CACHE_MAX_ENTRIES 256
+// Files with bigger codec headers than this (bytes) are always probed
+#define PROBE_CACHE_MAX_EXTRADATA 4096
+// Changes within this window (milliseconds) go to the SD card in one write
+#define PROBE_CACHE_FLUSH_DELAY_MS 5000
+
+// Starts the writer. Without it changes only reach the card on shutdown.
+void probe_cache_init();
+// Writes what is still pending before returning
+void probe_cache_shutdown();
+
+// Fills in what avformat_find_stream_info would have found last time the file
+// was opened. Returns false when the file changed or was never probed.
+bool probe_cache_apply(AVFormatContext* fmt_ctx, const char* filepath);
+void probe_cache_store(AVFormatContext* fmt_ctx, const char* filepath);
+
+#endif
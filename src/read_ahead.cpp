@@ -0,0 +1,183 @@
+#include <cstdio>
+#include <cerrno>
+#include <cstring>
+#include <malloc.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "read_ahead.hpp"
+#include "log.hpp"
+#include "player_session.hpp"
+
+static bool read_ahead_has_room(read_ahead* io) {
+    // Oldest bytes may go once they fell far enough behind the reader
+    int64_t keep_from = io->read_pos - READ_AHEAD_KEEP_BEHIND;
+    if (keep_from > io->data_start) io->data_start = keep_from < io->write_pos ? keep_from : io->write_pos;
+    return io->write_pos - io->data_start + READ_AHEAD_CHUNK_SIZE <= READ_AHEAD_BUFFER_SIZE;
+}
+
+static void read_ahead_thread(void* arg) {
+    read_ahead* io = static_cast<read_ahead*>(arg);
+    int64_t file_pos = -1;
+
+    while (true) {
+        int64_t write_pos;
+        int generation;
+        {
+            std::unique_lock<std::mutex> lock(io->mutex);
+            io->cv.wait(lock, [io] { return io->abort || (!io->eof && !io->error && read_ahead_has_room(io)); });
+            if (io->abort) break;
+
+            write_pos = io->write_pos;
+            generation = io->generation;
+        }
+
+        // Chunks never straddle the end of the ring, it is a multiple of the chunk size
+        size_t offset = write_pos % READ_AHEAD_BUFFER_SIZE;
+        size_t length = READ_AHEAD_CHUNK_SIZE - (offset % READ_AHEAD_CHUNK_SIZE);
+
+        if (file_pos != write_pos && lseek(io->fd, write_pos, SEEK_SET) < 0) file_pos = -1;
+        else file_pos = write_pos;
+
+        ssize_t got = file_pos < 0 ? -1 : read(io->fd, io->ring + offset, length);
+        if (got > 0) file_pos += got;
+
+        {
+            std::lock_guard<std::mutex> lock(io->mutex);
+            // The reader moved elsewhere meanwhile, these bytes belong to no window
+            if (generation != io->generation) continue;
+
+            if (got < 0) {
+                printf("[Read ahead] Read at %lld failed\n", (long long)write_pos);
+                io->error = true;
+            } else if (got == 0) {
+                io->eof = true;
+            } else {
+                io->write_pos += got;
+                io->refills++;
+            }
+        }
+        io->cv.notify_all();
+    }
+}
+
+static int read_ahead_read_packet(void* opaque, uint8_t* buf, int buf_size) {
+    read_ahead* io = static_cast<read_ahead*>(opaque);
+    std::unique_lock<std::mutex> lock(io->mutex);
+
+    // Behind the window or beyond what the next chunk brings, start over there
+    if (io->read_pos < io->data_start || io->read_pos > io->write_pos + READ_AHEAD_CHUNK_SIZE) {
+        io->generation++;
+        io->data_start = io->read_pos & ~(int64_t)(READ_AHEAD_ALIGNMENT - 1);
+        io->write_pos = io->data_start;
+        io->eof = false;
+        io->error = false;
+        io->cv.notify_all();
+    }
+
+    io->cv.wait(lock, [io] { return io->abort || io->read_pos < io->write_pos || io->eof || io->error; });
+    if (io->abort) return AVERROR_EXIT;
+
+    int64_t available = io->write_pos - io->read_pos;
+    if (available <= 0) return io->error ? AVERROR(EIO) : AVERROR_EOF;
+
+    // Copy up to the end of the ring, libavformat asks again for the rest
+    size_t offset = io->read_pos % READ_AHEAD_BUFFER_SIZE;
+    size_t length = buf_size;
+    if ((int64_t)length > available) length = available;
+    if (length > READ_AHEAD_BUFFER_SIZE - offset) length = READ_AHEAD_BUFFER_SIZE - offset;
+
+    memcpy(buf, io->ring + offset, length);
+    io->read_pos += length;
+
+    // Freed ring space, the I/O thread may continue
+    io->cv.notify_all();
+    return length;
+}
+
+static int64_t read_ahead_seek(void* opaque, int64_t offset, int whence) {
+    read_ahead* io = static_cast<read_ahead*>(opaque);
+    if (whence & AVSEEK_SIZE) return io->file_size;
+
+    std::lock_guard<std::mutex> lock(io->mutex);
+    int64_t target;
+    switch (whence & ~AVSEEK_FORCE) {
+        case SEEK_SET: target = offset; break;
+        case SEEK_CUR: target = io->read_pos + offset; break;
+        case SEEK_END: target = io->file_size + offset; break;
+        default: return AVERROR(EINVAL);
+    }
+    if (target < 0) return AVERROR(EINVAL);
+
+    // The next read decides whether the window still covers it
+    io->read_pos = target;
+    io->cv.notify_all();
+    return target;
+}
+
+read_ahead* read_ahead_open(const char* filepath) {
+    read_ahead* io = new read_ahead;
+
+    io->fd = open(filepath, O_RDONLY);
+    if (io->fd < 0) {
+        delete io;
+        return nullptr;
+    }
+    io->file_size = lseek(io->fd, 0, SEEK_END);
+    lseek(io->fd, 0, SEEK_SET);
+
+    io->ring = static_cast<uint8_t*>(memalign(READ_AHEAD_ALIGNMENT, READ_AHEAD_BUFFER_SIZE));
+    uint8_t* avio_buffer = static_cast<uint8_t*>(av_malloc(READ_AHEAD_AVIO_BUFFER_SIZE));
+    if (io->ring && avio_buffer) {
+        io->avio = avio_alloc_context(avio_buffer, READ_AHEAD_AVIO_BUFFER_SIZE, 0, io,
+                                      read_ahead_read_packet, nullptr, read_ahead_seek);
+    }
+
+    if (!io->avio || !core_thread_start(io->thread, "cafemp read ahead", read_ahead_thread, io, CORE_IO, PRIORITY_IO)) {
+        printf("[Read ahead] Falling back to direct reads for %s\n", filepath);
+        if (io->avio) avio_context_free(&io->avio);
+        else av_free(avio_buffer);
+        free(io->ring);
+        close(io->fd);
+        delete io;
+        return nullptr;
+    }
+
+    return io;
+}
+
+void read_ahead_abort(read_ahead* io) {
+    if (!io) return;
+
+    {
+        std::lock_guard<std::mutex> lock(io->mutex);
+        io->abort = true;
+    }
+    io->cv.notify_all();
+}
+
+void read_ahead_close(read_ahead*& io) {
+    if (!io) return;
+
+    read_ahead_abort(io);
+    if (!player_session_join(io->thread, "Read ahead")) {
+        // A card read that outlived the exit budget, the ring stays with it
+        io = nullptr;
+        return;
+    }
+
+    #ifdef DEBUG_VIDEO
+    log_debug("[Read ahead] %llu chunk reads\n", (unsigned long long)io->refills);
+    #endif
+
+    // libavformat may have swapped the buffer, free whatever it holds now
+    if (io->avio) {
+        av_freep(&io->avio->buffer);
+        avio_context_free(&io->avio);
+    }
+    free(io->ring);
+    close(io->fd);
+
+    delete io;
+    io = nullptr;
+}
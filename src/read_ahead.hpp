@@ -0,0 +1,53 @@
+#ifndef READ_AHEAD_H
+#define READ_AHEAD_H
+
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <condition_variable>
+extern "C" {
+    #include <libavformat/avformat.h>
+}
+
+#include "core_thread.hpp"
+
+// Bytes of the file kept in memory around the read position
+#define READ_AHEAD_BUFFER_SIZE (4 * 1024 * 1024)
+// One sequential SD card read, the ring size must be a multiple of it
+#define READ_AHEAD_CHUNK_SIZE (256 * 1024)
+// Already consumed bytes kept for the small backward seeks demuxers do
+#define READ_AHEAD_KEEP_BEHIND (512 * 1024)
+// The SD card DMAs straight into buffers and file offsets aligned to this
+#define READ_AHEAD_ALIGNMENT 0x40
+// Buffer between the ring and libavformat
+#define READ_AHEAD_AVIO_BUFFER_SIZE (64 * 1024)
+
+// The I/O thread fills the ring with file range [data_start, write_pos),
+// libavformat consumes it from read_pos. A read outside that range starts
+// a new window at the requested position.
+struct read_ahead {
+    int fd = -1;
+    int64_t file_size = 0;
+    uint8_t* ring = nullptr;
+    AVIOContext* avio = nullptr;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    int64_t data_start = 0;
+    int64_t write_pos = 0;
+    int64_t read_pos = 0;
+    int generation = 0;
+    bool eof = false;
+    bool error = false;
+    bool abort = false;
+
+    core_thread thread;
+    uint64_t refills = 0;
+};
+
+// Returns nullptr when the file cannot be opened, callers fall back to libavformat's own I/O
+read_ahead* read_ahead_open(const char* filepath);
+void read_ahead_abort(read_ahead* io);
+void read_ahead_close(read_ahead*& io);
+
+#endif
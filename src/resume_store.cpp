@@ -0,0 +1,240 @@
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <unordered_map>
+#include <sys/stat.h>
+
+#include "main.hpp"
+#include "utils.hpp"
+#include "core_thread.hpp"
+#include "resume_store.hpp"
+
+struct resume_header {
+    char magic[4];
+    uint16_t version;
+    uint16_t reserved;
+};
+
+// Followed by the path
+struct resume_record {
+    uint16_t path_length;
+    uint16_t reserved;
+    uint32_t position_ms;
+    uint32_t duration_ms;
+    uint32_t last_used;
+    uint64_t size;
+    int64_t mtime;
+};
+
+struct resume_entry {
+    uint32_t position_ms = 0;
+    uint32_t duration_ms = 0;
+    uint32_t last_used = 0;
+    // 0 for streams, those only have the duration to tell them apart
+    uint64_t size = 0;
+    int64_t mtime = 0;
+};
+
+// Shared between the main thread and the writer
+static std::unordered_map<std::string, resume_entry> resume_entries;
+static std::mutex resume_mutex;
+static std::condition_variable resume_cv;
+static bool resume_dirty = false;
+static std::atomic<bool> resume_running = false;
+static core_thread resume_thread;
+static uint32_t resume_counter = 0;
+
+// Main thread only, the video that is playing
+static std::string current_path;
+static resume_entry current_entry;
+static double current_stored = 0.0;
+static bool current_open = false;
+
+static void resume_store_load() {
+    FILE* file = fopen(RESUME_STORE_PATH, "rb");
+    if (!file) return;
+
+    resume_header header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, "CMPR", 4) || header.version != RESUME_STORE_VERSION) {
+        fclose(file);
+        return;
+    }
+
+    resume_record record;
+    while (fread(&record, sizeof(record), 1, file) == 1) {
+        std::string path(record.path_length, '\0');
+        if (fread(&path[0], 1, record.path_length, file) != record.path_length) break;
+
+        resume_entry& entry = resume_entries[path];
+        entry.position_ms = record.position_ms;
+        entry.duration_ms = record.duration_ms;
+        entry.last_used = record.last_used;
+        entry.size = record.size;
+        entry.mtime = record.mtime;
+        if (entry.last_used > resume_counter) resume_counter = entry.last_used;
+    }
+    fclose(file);
+
+    printf("[Resume] %d resume points\n", (int)resume_entries.size());
+}
+
+// Writer thread, the whole store is a few KB so it is rewritten every time
+static void resume_store_write(const std::unordered_map<std::string, resume_entry>& entries) {
+    std::vector<uint8_t> data;
+    data.reserve(sizeof(resume_header) + entries.size() * (sizeof(resume_record) + 64));
+
+    resume_header header = { { 'C', 'M', 'P', 'R' }, RESUME_STORE_VERSION, 0 };
+    data.insert(data.end(), reinterpret_cast<uint8_t*>(&header), reinterpret_cast<uint8_t*>(&header) + sizeof(header));
+    for (const auto& it : entries) {
+        resume_record record = { (uint16_t)it.first.size(), 0, it.second.position_ms, it.second.duration_ms,
+                                 it.second.last_used, it.second.size, it.second.mtime };
+        data.insert(data.end(), reinterpret_cast<uint8_t*>(&record), reinterpret_cast<uint8_t*>(&record) + sizeof(record));
+        data.insert(data.end(), it.first.begin(), it.first.end());
+    }
+
+    // Write next to the old store first, a pulled SD card never leaves half a file
+    std::string temp_path = std::string(RESUME_STORE_PATH) + ".tmp";
+    FILE* file = fopen(temp_path.c_str(), "wb");
+    if (!file) {
+        printf("[Resume] Failed to save %s\n", RESUME_STORE_PATH);
+        return;
+    }
+    bool written = fwrite(data.data(), 1, data.size(), file) == data.size();
+    fclose(file);
+    if (!written) {
+        remove(temp_path.c_str());
+        return;
+    }
+    remove(RESUME_STORE_PATH);
+    rename(temp_path.c_str(), RESUME_STORE_PATH);
+}
+
+static void resume_worker(void*) {
+    std::unique_lock<std::mutex> lock(resume_mutex);
+    for (;;) {
+        resume_cv.wait(lock, [] { return !resume_running || resume_dirty; });
+        // Let the updates of the next few seconds join this write
+        if (resume_running) {
+            resume_cv.wait_for(lock, std::chrono::milliseconds(RESUME_FLUSH_DELAY_MS), [] { return !resume_running.load(); });
+        }
+        if (!resume_dirty) {
+            if (!resume_running) break;
+            continue;
+        }
+
+        std::unordered_map<std::string, resume_entry> snapshot = resume_entries;
+        resume_dirty = false;
+        lock.unlock();
+        resume_store_write(snapshot);
+        lock.lock();
+    }
+}
+
+// Lock held
+static void resume_store_trim() {
+    while (resume_entries.size() > RESUME_MAX_ENTRIES) {
+        auto oldest = resume_entries.begin();
+        for (auto it = resume_entries.begin(); it != resume_entries.end(); ++it) {
+            if (it->second.last_used < oldest->second.last_used) oldest = it;
+        }
+        resume_entries.erase(oldest);
+    }
+}
+
+static void resume_store_save(double position) {
+    if (!current_open) return;
+    current_stored = position;
+
+    // A barely started or finished video opens from the start next time
+    double duration = current_entry.duration_ms / 1000.0;
+    bool keep = position >= RESUME_MIN_POSITION && position < duration - RESUME_END_MARGIN;
+
+    {
+        std::lock_guard<std::mutex> lock(resume_mutex);
+        if (keep) {
+            current_entry.position_ms = (uint32_t)(position * 1000.0);
+            current_entry.last_used = ++resume_counter;
+            resume_entries[current_path] = current_entry;
+            resume_store_trim();
+        } else if (!resume_entries.erase(current_path)) {
+            return;
+        }
+        resume_dirty = true;
+    }
+    resume_cv.notify_one();
+}
+
+void resume_store_init() {
+    if (resume_running) return;
+
+    {
+        std::lock_guard<std::mutex> lock(resume_mutex);
+        resume_store_load();
+    }
+    resume_running = true;
+    if (!core_thread_start(resume_thread, "cafemp resume", resume_worker, nullptr, CORE_SCAN, PRIORITY_RESUME)) {
+        resume_running = false;
+    }
+}
+
+void resume_store_shutdown() {
+    {
+        std::lock_guard<std::mutex> lock(resume_mutex);
+        resume_running = false;
+    }
+    resume_cv.notify_all();
+    if (core_thread_joinable(resume_thread)) core_thread_join(resume_thread);
+
+    std::lock_guard<std::mutex> lock(resume_mutex);
+    resume_entries.clear();
+    resume_dirty = false;
+    current_open = false;
+}
+
+double resume_store_open(const char* path, double duration) {
+    current_open = false;
+    // Live streams have nowhere to come back to
+    if (!resume_running || duration <= RESUME_MIN_POSITION + RESUME_END_MARGIN) return 0.0;
+
+    current_path = path;
+    current_entry = resume_entry();
+    current_entry.duration_ms = (uint32_t)(duration * 1000.0);
+    struct stat file_stat;
+    if (!is_network_path(current_path) && stat(path, &file_stat) == 0) {
+        current_entry.size = file_stat.st_size;
+        current_entry.mtime = file_stat.st_mtime;
+    }
+    current_open = true;
+    current_stored = 0.0;
+
+    std::lock_guard<std::mutex> lock(resume_mutex);
+    auto it = resume_entries.find(current_path);
+    if (it == resume_entries.end()) return 0.0;
+
+    // Replaced or re-encoded since, the old position means nothing
+    const resume_entry& entry = it->second;
+    if (entry.size != current_entry.size || entry.mtime != current_entry.mtime ||
+        std::abs((double)entry.duration_ms - current_entry.duration_ms) > 1000.0) {
+        return 0.0;
+    }
+
+    current_stored = entry.position_ms / 1000.0;
+    printf("[Resume] %s from %.1f\n", media_display_name(current_path).c_str(), current_stored);
+    return current_stored;
+}
+
+void resume_store_update(double position) {
+    if (!current_open || std::abs(position - current_stored) < RESUME_UPDATE_INTERVAL) return;
+    resume_store_save(position);
+}
+
+void resume_store_finish(double position) {
+    resume_store_save(position);
+    current_open = false;
+}
@@ -0,0 +1,26 @@
+#ifndef RESUME_STORE_H
+#define RESUME_STORE_H
+
+#define RESUME_STORE_VERSION 1
+// Files remembered, the least recently played ones are dropped first
+#define RESUME_MAX_ENTRIES 256
+// Closer than this to either end (seconds) the next open starts from the beginning
+#define RESUME_MIN_POSITION 15.0
+#define RESUME_END_MARGIN 30.0
+// Playback moves the stored position at most this often (seconds)
+#define RESUME_UPDATE_INTERVAL 10.0
+// Updates within this window (milliseconds) go to the SD card in one write
+#define RESUME_FLUSH_DELAY_MS 5000
+
+void resume_store_init();
+// Writes what is still pending before returning
+void resume_store_shutdown();
+
+// Main thread, when a video opens. Returns where to resume in seconds, 0 to start over.
+double resume_store_open(const char* path, double duration);
+// Main thread, cheap enough to call for every presented frame
+void resume_store_update(double position);
+// Main thread, when the video closes
+void resume_store_finish(double position);
+
+#endif
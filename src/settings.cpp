@@ -5,15 +5,69 @@
 
 #include "main.hpp"
 #include "settings.hpp"
+#include "log.hpp"
+#include "core_thread.hpp"
+#include "demuxer.hpp"
+#include "video_player.hpp"
+#include "audio_player.hpp"
+#include "frame_queue.hpp"
 
-static settings_struct settings;
+static const char* const decode_mode_choices[] = { "auto", "full", "skip_loop_filter", "skip_nonref", "lowres" };
+static const char* const log_level_choices[] = { "info", "debug" };
+
+// In settings_keys order. Defaults are the values the player was tuned with.
+static const settings_entry settings_table[SETTINGS_COUNT] = {
+    { SETTINGS_VERSION,              "version",                   SETTINGS_TYPE_INT,    0, 0, 1 << 30, nullptr },
+    { SETTINGS_BKG_MUSIC_ENABLED,    "background_music_enabled",  SETTINGS_TYPE_BOOL,   1, 0, 1, nullptr },
+    { SETTINGS_VIDEO_FRAME_QUEUE,    "video_frame_queue",         SETTINGS_TYPE_INT,    VIDEO_FRAME_QUEUE_SIZE, 2, FRAME_QUEUE_MAX_SIZE, nullptr },
+    { SETTINGS_PACKET_QUEUE_MB,      "packet_queue_mb",           SETTINGS_TYPE_INT,    DEMUXER_MAX_QUEUE_BYTES / (1024 * 1024), 1, 32, nullptr },
+    { SETTINGS_DECODE_THREADS,       "decode_threads",            SETTINGS_TYPE_INT,    VIDEO_DECODE_THREADS, 1, 4, nullptr },
+    { SETTINGS_DECODE_MODE,          "decode_mode",               SETTINGS_TYPE_CHOICE, SETTINGS_DECODE_MODE_AUTO, 0, 4, decode_mode_choices },
+    { SETTINGS_PROBE_SIZE,           "probe_size",                SETTINGS_TYPE_INT,    10000, 2048, 5000000, nullptr },
+    { SETTINGS_AUDIO_SAMPLE_RATE,    "audio_sample_rate",         SETTINGS_TYPE_INT,    AUDIO_OUTPUT_SAMPLE_RATE, 22050, 48000, nullptr },
+    { SETTINGS_AUDIO_DEVICE_SAMPLES, "audio_device_samples",      SETTINGS_TYPE_INT,    AUDIO_DEVICE_SAMPLES, 256, 8192, nullptr },
+    { SETTINGS_UI_ANTI_ALIASING,     "ui_anti_aliasing",          SETTINGS_TYPE_BOOL,   1, 0, 1, nullptr },
+    { SETTINGS_LOG_LEVEL,            "log_level",                 SETTINGS_TYPE_CHOICE, LOG_LEVEL_INFO, 0, 1, log_level_choices }
+};
+
+static int settings_values[SETTINGS_COUNT];
+static bool settings_defaults_set = false;
+
+static void settings_init_defaults() {
+    if (settings_defaults_set) return;
+    for (int i = 0; i < SETTINGS_COUNT; ++i) settings_values[i] = settings_table[i].default_value;
+    settings_defaults_set = true;
+}
+
+static int settings_clamp(const settings_entry& entry, int value) {
+    if (value < entry.min_value) return entry.min_value;
+    if (value > entry.max_value) return entry.max_value;
+    return value;
+}
+
+// Some settings take effect as soon as they change
+static void settings_apply(settings_keys key) {
+    if (key == SETTINGS_LOG_LEVEL) log_set_level((log_level)settings_values[key]);
+}
 
 void settings_save() {
+    settings_init_defaults();
     json_t *root = json_object();
 
-    json_object_set_new(root, "version", json_integer(settings.version));
-    json_object_set_new(root, "background_music_enabled", json_boolean(settings.background_music_enabled));
-    //json_object_set_new(root, "path", json_string(settings.path));
+    for (const settings_entry& entry : settings_table) {
+        int value = settings_values[entry.key];
+        switch (entry.type) {
+            case SETTINGS_TYPE_BOOL:
+                json_object_set_new(root, entry.name, json_boolean(value));
+                break;
+            case SETTINGS_TYPE_INT:
+                json_object_set_new(root, entry.name, json_integer(value));
+                break;
+            case SETTINGS_TYPE_CHOICE:
+                json_object_set_new(root, entry.name, json_string(entry.choices[value]));
+                break;
+        }
+    }
 
     FILE *file = fopen(SETTINGS_PATH, "w");
     if (file) {
@@ -26,7 +80,32 @@ void settings_save() {
     json_decref(root);
 }
 
+static bool settings_parse(const settings_entry& entry, json_t* value, int& out) {
+    switch (entry.type) {
+        case SETTINGS_TYPE_BOOL:
+            if (!json_is_boolean(value)) return false;
+            out = json_is_true(value);
+            return true;
+        case SETTINGS_TYPE_INT:
+            if (!json_is_integer(value)) return false;
+            out = settings_clamp(entry, (int)json_integer_value(value));
+            return true;
+        case SETTINGS_TYPE_CHOICE:
+            if (!json_is_string(value)) return false;
+            for (int i = 0; i <= entry.max_value; ++i) {
+                if (!strcmp(json_string_value(value), entry.choices[i])) {
+                    out = i;
+                    return true;
+                }
+            }
+            return false;
+    }
+    return false;
+}
+
 void settings_load() {
+    settings_init_defaults();
+
     FILE *file = fopen(SETTINGS_PATH, "r");
     if (file) {
         json_error_t error;
@@ -34,22 +113,14 @@ void settings_load() {
         fclose(file);
 
         if (root) {
-            json_t *version = json_object_get(root, "version");
-            if (json_is_integer(version)) {
-                settings.version = json_integer_value(version);
-            }
-
-            json_t *bg_music = json_object_get(root, "background_music_enabled");
-            if (json_is_boolean(bg_music)) {
-                settings.background_music_enabled = json_is_true(bg_music);
+            // Missing keys keep their defaults, files from older versions load as they are
+            for (const settings_entry& entry : settings_table) {
+                json_t* value = json_object_get(root, entry.name);
+                if (!value) continue;
+                if (!settings_parse(entry, value, settings_values[entry.key])) {
+                    printf("[Settings] Ignoring invalid value for %s\n", entry.name);
+                }
             }
-            /*
-            json_t *path = json_object_get(root, "path");
-            if (json_is_string(path)) {
-                free((void*)settings.path);
-                settings.path = strdup(json_string_value(path));
-            }
-            */
             json_decref(root);
         } else {
             printf("[Settings] Failed to load settings: %s\n", error.text);
@@ -57,38 +128,20 @@ void settings_load() {
     } else {
         printf("[Settings] No settings file found, using default settings.\n");
     }
-}
 
-void settings_set(settings_keys key, void* value) {
-    switch (key) {
-        case SETTINGS_VERSION:
-            settings.version = *reinterpret_cast<int*>(value);
-            break;
-        case SETTINGS_BKG_MUSIC_ENABLED:
-            settings.background_music_enabled = *reinterpret_cast<int*>(value);
-            break;
-        /*
-        case SETTINGS_PATH:
-            free((void*)settings.path);
-            settings.path = strdup(reinterpret_cast<const char*>(value));
-            break;
-        */
-    }
+    for (int i = 0; i < SETTINGS_COUNT; ++i) settings_apply((settings_keys)i);
 }
 
-const settings_struct& settings_get() {
-    return settings;
+void settings_set(settings_keys key, int value) {
+    if (key < 0 || key >= SETTINGS_COUNT) return;
+    settings_init_defaults();
+
+    settings_values[key] = settings_clamp(settings_table[key], value);
+    settings_apply(key);
 }
 
-void* settings_get_value(settings_keys key) {
-    switch (key) {
-        case SETTINGS_VERSION:
-            return (void*)&settings.version;
-        case SETTINGS_BKG_MUSIC_ENABLED:
-            return (void*)&settings.background_music_enabled;
-        // case SETTINGS_PATH:
-        //    return (void*)settings.path;
-        default:
-            return nullptr;
-    }
+int settings_get(settings_keys key) {
+    if (key < 0 || key >= SETTINGS_COUNT) return 0;
+    settings_init_defaults();
+    return settings_values[key];
 }
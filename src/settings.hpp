@@ -1,22 +1,49 @@
 #ifndef SETTINGS_H
 #define SETTINGS_H
 
-struct settings_struct {
-    int version = 0;
-    int background_music_enabled = 1;
-//    const char* path = "/vol/external01/settings.json";
+enum settings_type {
+    SETTINGS_TYPE_BOOL,
+    SETTINGS_TYPE_INT,
+    // Stored by name in settings.json, the value is the index into choices
+    SETTINGS_TYPE_CHOICE
 };
 
 enum settings_keys {
     SETTINGS_VERSION,
     SETTINGS_BKG_MUSIC_ENABLED,
-//    SETTINGS_PATH
+    // Read when playback starts
+    SETTINGS_VIDEO_FRAME_QUEUE,
+    SETTINGS_PACKET_QUEUE_MB,
+    SETTINGS_DECODE_THREADS,
+    SETTINGS_DECODE_MODE,
+    SETTINGS_PROBE_SIZE,
+    // Read when the shared audio output opens at startup
+    SETTINGS_AUDIO_SAMPLE_RATE,
+    SETTINGS_AUDIO_DEVICE_SAMPLES,
+    // Read every frame
+    SETTINGS_UI_ANTI_ALIASING,
+    SETTINGS_LOG_LEVEL,
+    SETTINGS_COUNT
+};
+
+// SETTINGS_DECODE_MODE, every other choice is a decode_mode one below it
+#define SETTINGS_DECODE_MODE_AUTO 0
+
+struct settings_entry {
+    settings_keys key;
+    const char* name; // Key in settings.json
+    settings_type type;
+    int default_value;
+    int min_value;
+    int max_value;
+    // SETTINGS_TYPE_CHOICE only, max_value + 1 names
+    const char* const* choices;
 };
 
 void settings_save();
 void settings_load();
-void settings_set(settings_keys key, void* value);
-const settings_struct& settings_get();
-void* settings_get_value(settings_keys key);
+// Clamped to the range of the entry
+void settings_set(settings_keys key, int value);
+int settings_get(settings_keys key);
 
 #endif
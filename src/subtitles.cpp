@@ -0,0 +1,513 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <algorithm>
+#include <SDL2/SDL_ttf.h>
+#include <coreinit/thread.h>
+#include <coreinit/time.h>
+
+#include "main.hpp"
+#include "utils.hpp"
+#include "subtitles.hpp"
+#include "media_clock.hpp"
+#include "core_thread.hpp"
+#include "player_session.hpp"
+
+struct subtitle_cue {
+    uint32_t id = 0;
+    double start = 0.0;
+    double end = 0.0;
+    // Embedded cues whose end comes with the next cue
+    bool open_ended = false;
+    // Empty for bitmap cues, those are rasterized by the decoder already
+    std::string text;
+    // Bitmap cues only, position on the subtitle canvas
+    SDL_Rect placement = {};
+    // Rasterized by the worker, turned into the texture by the main thread
+    SDL_Surface* surface = nullptr;
+    SDL_Texture* texture = nullptr;
+    int width = 0;
+    int height = 0;
+};
+
+// Sorted by start. Textures are only created and destroyed on the main thread,
+// the worker hands the ones it drops over through stale_textures.
+static std::vector<subtitle_cue> cues;
+static std::vector<SDL_Texture*> stale_textures;
+static std::mutex subtitle_mutex;
+// Wakes the worker out of its poll interval when the session stops
+static std::condition_variable subtitle_cv;
+static uint32_t next_cue_id = 1;
+
+static core_thread subtitle_thread;
+static std::atomic<bool> subtitle_running = false;
+static bool subtitles_active = false;
+static bool subtitles_visible = true;
+
+// Embedded stream, worker thread only once started
+static demuxer* subtitle_demux = nullptr;
+static AVCodecContext* subtitle_codec_ctx = nullptr;
+static AVRational subtitle_time_base = { 1, AV_TIME_BASE };
+
+// Worker thread only, SDL_ttf is not shared with anything else
+static TTF_Font* fill_font = nullptr;
+static TTF_Font* outline_font = nullptr;
+
+// Lock held
+static void subtitle_insert(subtitle_cue&& cue) {
+    cue.id = next_cue_id++;
+    auto it = std::upper_bound(cues.begin(), cues.end(), cue.start,
+        [](double start, const subtitle_cue& other) { return start < other.start; });
+    cues.insert(it, std::move(cue));
+}
+
+// Lock held
+static void subtitle_release(subtitle_cue& cue) {
+    if (cue.surface) SDL_FreeSurface(cue.surface);
+    if (cue.texture) stale_textures.push_back(cue.texture);
+    cue.surface = nullptr;
+    cue.texture = nullptr;
+}
+
+// Drops SRT/HTML style <tags> and ASS {override} blocks, turns ASS breaks into newlines
+static std::string subtitle_clean_text(const std::string& raw) {
+    std::string text;
+    text.reserve(raw.size());
+
+    for (size_t i = 0; i < raw.size(); ++i) {
+        char c = raw[i];
+        if (c == '<' || c == '{') {
+            size_t close = raw.find(c == '<' ? '>' : '}', i);
+            if (close != std::string::npos) {
+                i = close;
+                continue;
+            }
+        }
+        if (c == '\\' && i + 1 < raw.size() && (raw[i + 1] == 'N' || raw[i + 1] == 'n')) {
+            text += '\n';
+            ++i;
+            continue;
+        }
+        if (c == '\\' && i + 1 < raw.size() && raw[i + 1] == 'h') {
+            text += ' ';
+            ++i;
+            continue;
+        }
+        if (c != '\r') text += c;
+    }
+
+    while (!text.empty() && (text.back() == '\n' || text.back() == ' ')) text.pop_back();
+    return text;
+}
+
+// "ReadOrder,Layer,Style,Name,MarginL,MarginR,MarginV,Effect,Text", the text may hold commas
+static std::string subtitle_ass_text(const char* ass) {
+    const char* text = ass;
+    for (int fields = 0; fields < 8 && text; ++fields) {
+        text = strchr(text, ',');
+        if (text) ++text;
+    }
+    return subtitle_clean_text(text ? text : ass);
+}
+
+static bool subtitle_parse_srt_time(const char* str, double& seconds) {
+    int hours = 0, minutes = 0, secs = 0, millis = 0;
+    if (sscanf(str, "%d:%d:%d%*[,.]%d", &hours, &minutes, &secs, &millis) != 4) return false;
+    seconds = hours * 3600.0 + minutes * 60.0 + secs + millis / 1000.0;
+    return true;
+}
+
+static bool subtitles_load_srt(const std::string& path) {
+    FILE* file = fopen(path.c_str(), "r");
+    if (!file) return false;
+
+    std::vector<subtitle_cue> loaded;
+    subtitle_cue cue;
+    bool in_cue = false;
+    char line[1024];
+
+    while (fgets(line, sizeof(line), file)) {
+        std::string text(line);
+        // UTF-8 byte order mark on the first line
+        if (text.compare(0, 3, "\xEF\xBB\xBF") == 0) text.erase(0, 3);
+        while (!text.empty() && (text.back() == '\n' || text.back() == '\r')) text.pop_back();
+
+        size_t arrow = text.find("-->");
+        if (!in_cue && arrow != std::string::npos) {
+            double start = 0.0, end = 0.0;
+            if (subtitle_parse_srt_time(text.c_str(), start) && subtitle_parse_srt_time(text.c_str() + arrow + 3, end)) {
+                cue = subtitle_cue();
+                cue.start = start;
+                cue.end = end;
+                in_cue = true;
+            }
+            continue;
+        }
+
+        if (!in_cue) continue;
+        if (text.empty()) {
+            cue.text = subtitle_clean_text(cue.text);
+            if (!cue.text.empty()) loaded.push_back(std::move(cue));
+            in_cue = false;
+            continue;
+        }
+        if (!cue.text.empty()) cue.text += '\n';
+        cue.text += text;
+    }
+    if (in_cue) {
+        cue.text = subtitle_clean_text(cue.text);
+        if (!cue.text.empty()) loaded.push_back(std::move(cue));
+    }
+    fclose(file);
+
+    std::lock_guard<std::mutex> lock(subtitle_mutex);
+    for (auto& entry : loaded) subtitle_insert(std::move(entry));
+    printf("[Subtitles] %d cues from %s\n", (int)cues.size(), path.c_str());
+    return !cues.empty();
+}
+
+static bool subtitles_open_stream(demuxer* demux, int video_stream_index) {
+    AVFormatContext* fmt_ctx = demux->fmt_ctx;
+    int index = av_find_best_stream(fmt_ctx, AVMEDIA_TYPE_SUBTITLE, -1, video_stream_index, nullptr, 0);
+    if (index < 0) return false;
+
+    AVStream* stream = fmt_ctx->streams[index];
+    const AVCodec* codec = avcodec_find_decoder(stream->codecpar->codec_id);
+    if (!codec) {
+        printf("[Subtitles] No decoder for %s\n", avcodec_get_name(stream->codecpar->codec_id));
+        return false;
+    }
+
+    AVCodecContext* codec_ctx = avcodec_alloc_context3(codec);
+    avcodec_parameters_to_context(codec_ctx, stream->codecpar);
+    // Lets the decoder hand out pts in AV_TIME_BASE units
+    codec_ctx->pkt_timebase = stream->time_base;
+    if (avcodec_open2(codec_ctx, codec, nullptr) < 0) {
+        printf("[Subtitles] Could not open the %s decoder\n", codec->name);
+        avcodec_free_context(&codec_ctx);
+        return false;
+    }
+
+    subtitle_codec_ctx = codec_ctx;
+    subtitle_time_base = stream->time_base;
+    subtitle_demux = demux;
+    demuxer_enable_stream(demux, AVMEDIA_TYPE_SUBTITLE, index);
+    printf("[Subtitles] Decoding %s stream %d\n", codec->name, index);
+    return true;
+}
+
+// Worker thread. Each line gets a black outline with the white text on top.
+static SDL_Surface* subtitle_rasterize_text(const std::string& text) {
+    if (!fill_font || !outline_font) return nullptr;
+
+    std::vector<SDL_Surface*> outlines;
+    std::vector<SDL_Surface*> fills;
+    int width = 0;
+    int height = 0;
+
+    size_t begin = 0;
+    while (begin <= text.size()) {
+        size_t end = text.find('\n', begin);
+        if (end == std::string::npos) end = text.size();
+        std::string line = text.substr(begin, end - begin);
+        begin = end + 1;
+
+        SDL_Surface* outline = line.empty() ? nullptr : TTF_RenderUTF8_Blended(outline_font, line.c_str(), { 0, 0, 0, 255 });
+        SDL_Surface* fill = line.empty() ? nullptr : TTF_RenderUTF8_Blended(fill_font, line.c_str(), { 255, 255, 255, 255 });
+        outlines.push_back(outline);
+        fills.push_back(fill);
+
+        width = std::max(width, outline ? outline->w : 0);
+        height += outline ? outline->h : TTF_FontHeight(fill_font);
+    }
+
+    SDL_Surface* surface = width > 0 ? SDL_CreateRGBSurfaceWithFormat(0, width, height, 32, SDL_PIXELFORMAT_ARGB8888) : nullptr;
+    if (surface) SDL_FillRect(surface, NULL, 0);
+
+    int y = 0;
+    for (size_t i = 0; i < outlines.size(); ++i) {
+        int line_height = outlines[i] ? outlines[i]->h : TTF_FontHeight(fill_font);
+        if (surface && outlines[i] && fills[i]) {
+            SDL_Rect outline_rect = { (width - outlines[i]->w) / 2, y, outlines[i]->w, outlines[i]->h };
+            SDL_Rect fill_rect = { outline_rect.x + SUBTITLE_OUTLINE, y + SUBTITLE_OUTLINE, fills[i]->w, fills[i]->h };
+            SDL_BlitSurface(outlines[i], NULL, surface, &outline_rect);
+            SDL_BlitSurface(fills[i], NULL, surface, &fill_rect);
+        }
+        if (outlines[i]) SDL_FreeSurface(outlines[i]);
+        if (fills[i]) SDL_FreeSurface(fills[i]);
+        y += line_height;
+    }
+    return surface;
+}
+
+// Worker thread, palettized decoder output to ARGB
+static SDL_Surface* subtitle_rasterize_bitmap(const AVSubtitleRect* rect) {
+    if (rect->w <= 0 || rect->h <= 0 || !rect->data[0] || !rect->data[1]) return nullptr;
+
+    SDL_Surface* surface = SDL_CreateRGBSurfaceWithFormat(0, rect->w, rect->h, 32, SDL_PIXELFORMAT_ARGB8888);
+    if (!surface) return nullptr;
+
+    // The palette is native endian 0xAARRGGBB, same as ARGB8888
+    const uint32_t* palette = reinterpret_cast<const uint32_t*>(rect->data[1]);
+    for (int y = 0; y < rect->h; ++y) {
+        const uint8_t* src = rect->data[0] + y * rect->linesize[0];
+        uint32_t* dst = reinterpret_cast<uint32_t*>(static_cast<uint8_t*>(surface->pixels) + y * surface->pitch);
+        for (int x = 0; x < rect->w; ++x) dst[x] = palette[src[x]];
+    }
+    return surface;
+}
+
+// Worker thread
+static void subtitle_add_decoded(const AVSubtitle& sub, const AVPacket* pkt) {
+    double base = sub.pts != AV_NOPTS_VALUE ? sub.pts / (double)AV_TIME_BASE :
+                  pkt->pts != AV_NOPTS_VALUE ? pkt->pts * av_q2d(subtitle_time_base) : media_clock_get_master_time();
+    double start = base + sub.start_display_time / 1000.0;
+    bool open_ended = sub.end_display_time <= sub.start_display_time || sub.end_display_time == UINT32_MAX;
+    double end = open_ended ? start + SUBTITLE_DEFAULT_DURATION : base + sub.end_display_time / 1000.0;
+
+    std::vector<subtitle_cue> decoded;
+    for (unsigned int i = 0; i < sub.num_rects; ++i) {
+        const AVSubtitleRect* rect = sub.rects[i];
+        subtitle_cue cue;
+        cue.start = start;
+        cue.end = end;
+        cue.open_ended = open_ended;
+
+        if (rect->type == SUBTITLE_BITMAP) {
+            cue.surface = subtitle_rasterize_bitmap(rect);
+            cue.placement = { rect->x, rect->y, rect->w, rect->h };
+            if (!cue.surface) continue;
+        } else {
+            cue.text = rect->ass ? subtitle_ass_text(rect->ass) : subtitle_clean_text(rect->text ? rect->text : "");
+            if (cue.text.empty()) continue;
+        }
+        decoded.push_back(std::move(cue));
+    }
+
+    std::lock_guard<std::mutex> lock(subtitle_mutex);
+    // A new cue, or an empty one (bitmap formats clear the screen that way), ends the open ones
+    for (auto& cue : cues) {
+        if (cue.open_ended && cue.end > start) {
+            cue.end = std::max(cue.start, start);
+            cue.open_ended = false;
+        }
+    }
+    for (auto& cue : decoded) subtitle_insert(std::move(cue));
+}
+
+// Worker thread
+static void subtitle_decode_pending(AVPacket* pkt, int& serial) {
+    int packet_serial = 0;
+    while (packet_queue_pop(subtitle_demux, subtitle_demux->subtitle_queue, pkt, &packet_serial, false) == PACKET_QUEUE_OK) {
+        if (packet_serial != serial) {
+            // After a seek the demuxer sends the cues again from the keyframe on
+            if (serial >= 0) {
+                avcodec_flush_buffers(subtitle_codec_ctx);
+                std::lock_guard<std::mutex> lock(subtitle_mutex);
+                for (auto& cue : cues) subtitle_release(cue);
+                cues.clear();
+            }
+            serial = packet_serial;
+        }
+
+        AVSubtitle sub;
+        int got_subtitle = 0;
+        if (avcodec_decode_subtitle2(subtitle_codec_ctx, &sub, &got_subtitle, pkt) >= 0 && got_subtitle) {
+            subtitle_add_decoded(sub, pkt);
+            avsubtitle_free(&sub);
+        }
+        av_packet_unref(pkt);
+    }
+}
+
+// Worker thread, rasterizes what is about to show and frees what is far away
+static void subtitle_prepare(double now) {
+    for (;;) {
+        uint32_t id = 0;
+        std::string text;
+        {
+            std::lock_guard<std::mutex> lock(subtitle_mutex);
+            for (auto it = cues.begin(); it != cues.end();) {
+                // Embedded cues are gone for good once shown, sidecar cues may come back after a seek
+                if (subtitle_demux && it->end < now - 1.0) {
+                    subtitle_release(*it);
+                    it = cues.erase(it);
+                    continue;
+                }
+
+                bool in_window = it->end > now && it->start <= now + SUBTITLE_PREPARE_AHEAD;
+                if (!it->text.empty() && !in_window && it->surface) {
+                    SDL_FreeSurface(it->surface);
+                    it->surface = nullptr;
+                }
+                if (!id && in_window && !it->text.empty() && !it->surface && !it->texture) {
+                    id = it->id;
+                    text = it->text;
+                }
+                ++it;
+            }
+        }
+        if (!id) return;
+
+        SDL_Surface* surface = subtitle_rasterize_text(text);
+
+        std::lock_guard<std::mutex> lock(subtitle_mutex);
+        auto it = std::find_if(cues.begin(), cues.end(), [id](const subtitle_cue& cue) { return cue.id == id; });
+        if (it == cues.end() || it->surface || it->texture || !surface) {
+            if (surface) SDL_FreeSurface(surface);
+            // Nothing to draw, do not try this cue again
+            if (it != cues.end() && !surface) it->text.clear();
+            continue;
+        }
+        it->surface = surface;
+    }
+}
+
+static void subtitle_worker(void*) {
+    fill_font = TTF_OpenFont(FONT_PATH, SUBTITLE_FONT_SIZE);
+    outline_font = TTF_OpenFont(FONT_PATH, SUBTITLE_FONT_SIZE);
+    if (outline_font) TTF_SetFontOutline(outline_font, SUBTITLE_OUTLINE);
+    if (!fill_font || !outline_font) printf("[Subtitles] Could not open %s, text cues stay hidden\n", FONT_PATH);
+
+    AVPacket* pkt = av_packet_alloc();
+    int serial = -1;
+
+    while (subtitle_running) {
+        if (subtitle_demux && pkt) subtitle_decode_pending(pkt, serial);
+        subtitle_prepare(media_clock_get_master_time());
+
+        std::unique_lock<std::mutex> lock(subtitle_mutex);
+        subtitle_cv.wait_for(lock, std::chrono::milliseconds(SUBTITLE_POLL_MS), [] { return !subtitle_running.load(); });
+    }
+
+    av_packet_free(&pkt);
+    if (fill_font) TTF_CloseFont(fill_font);
+    if (outline_font) TTF_CloseFont(outline_font);
+    fill_font = nullptr;
+    outline_font = nullptr;
+}
+
+bool subtitles_open(const char* filepath, demuxer* demux, int video_stream_index) {
+    subtitles_close();
+
+    // A sidecar file wins, whoever put it there wants it over the embedded track
+    std::string path(filepath);
+    bool loaded = false;
+    size_t dot = path.find_last_of('.');
+    size_t slash = path.find_last_of('/');
+    if (!is_network_path(path) && dot != std::string::npos && (slash == std::string::npos || dot > slash)) {
+        loaded = subtitles_load_srt(path.substr(0, dot) + ".srt");
+    }
+    if (!loaded && demux) loaded = subtitles_open_stream(demux, video_stream_index);
+    if (!loaded) return false;
+
+    subtitle_running = true;
+    if (!core_thread_start(subtitle_thread, "cafemp subtitles", subtitle_worker, nullptr, CORE_SUBTITLES, PRIORITY_SUBTITLES)) {
+        subtitle_running = false;
+        subtitles_close();
+        return false;
+    }
+    subtitles_active = true;
+    return true;
+}
+
+void subtitles_render(SDL_Renderer* renderer, const SDL_Rect& video_rect, int video_width, int video_height) {
+    if (!subtitles_active) return;
+
+    double now = media_clock_get_master_time();
+    std::lock_guard<std::mutex> lock(subtitle_mutex);
+
+    for (SDL_Texture* texture : stale_textures) SDL_DestroyTexture(texture);
+    stale_textures.clear();
+    if (!subtitles_visible) return;
+
+    // Bitmap cues are placed on the decoder's canvas, which is usually the video size
+    int canvas_width = subtitle_codec_ctx && subtitle_codec_ctx->width > 0 ? subtitle_codec_ctx->width : video_width;
+    int canvas_height = subtitle_codec_ctx && subtitle_codec_ctx->height > 0 ? subtitle_codec_ctx->height : video_height;
+    int bottom = video_rect.y + video_rect.h - SUBTITLE_MARGIN_BOTTOM;
+    bool uploaded = false;
+
+    for (auto& cue : cues) {
+        if (cue.start > now + SUBTITLE_PREPARE_AHEAD) break;
+        if (cue.end <= now) {
+            if (cue.texture) {
+                SDL_DestroyTexture(cue.texture);
+                cue.texture = nullptr;
+            }
+            continue;
+        }
+
+        // One upload per frame ahead of time, a cue that becomes active is only blitted
+        bool active = cue.start <= now;
+        if (!cue.texture && cue.surface && (active || !uploaded)) {
+            cue.texture = SDL_CreateTextureFromSurface(renderer, cue.surface);
+            if (cue.texture) SDL_SetTextureBlendMode(cue.texture, SDL_BLENDMODE_BLEND);
+            cue.width = cue.surface->w;
+            cue.height = cue.surface->h;
+            SDL_FreeSurface(cue.surface);
+            cue.surface = nullptr;
+            uploaded = true;
+        }
+        if (!active || !cue.texture) continue;
+
+        SDL_Rect dst;
+        if (cue.text.empty()) {
+            if (canvas_width <= 0 || canvas_height <= 0) continue;
+            dst.x = video_rect.x + cue.placement.x * video_rect.w / canvas_width;
+            dst.y = video_rect.y + cue.placement.y * video_rect.h / canvas_height;
+            dst.w = cue.placement.w * video_rect.w / canvas_width;
+            dst.h = cue.placement.h * video_rect.h / canvas_height;
+        } else {
+            // Lines wider than the picture shrink instead of wrapping again
+            dst.w = cue.width;
+            dst.h = cue.height;
+            int max_width = video_rect.w * 95 / 100;
+            if (dst.w > max_width) {
+                dst.h = dst.h * max_width / dst.w;
+                dst.w = max_width;
+            }
+            dst.x = video_rect.x + (video_rect.w - dst.w) / 2;
+            dst.y = bottom - dst.h;
+            // Cues showing at the same time stack upwards
+            bottom = dst.y;
+        }
+        SDL_RenderCopy(renderer, cue.texture, NULL, &dst);
+    }
+}
+
+void subtitles_toggle() {
+    subtitles_visible = !subtitles_visible;
+}
+
+void subtitles_abort() {
+    {
+        std::lock_guard<std::mutex> lock(subtitle_mutex);
+        subtitle_running = false;
+    }
+    subtitle_cv.notify_all();
+}
+
+bool subtitles_close() {
+    subtitles_abort();
+    // The worker holds the fonts and the decoder until it returns
+    if (!player_session_join(subtitle_thread, "Subtitles")) return false;
+
+    {
+        std::lock_guard<std::mutex> lock(subtitle_mutex);
+        for (auto& cue : cues) subtitle_release(cue);
+        cues.clear();
+        for (SDL_Texture* texture : stale_textures) SDL_DestroyTexture(texture);
+        stale_textures.clear();
+    }
+
+    if (subtitle_codec_ctx) avcodec_free_context(&subtitle_codec_ctx);
+    subtitle_demux = nullptr;
+    subtitle_time_base = { 1, AV_TIME_BASE };
+    subtitles_active = false;
+    return true;
+}
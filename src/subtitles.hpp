@@ -0,0 +1,32 @@
+#ifndef SUBTITLES_H
+#define SUBTITLES_H
+
+#include <SDL2/SDL.h>
+
+#include "demuxer.hpp"
+
+// Text cues are rasterized at this point size and drawn 1:1 on the screen
+#define SUBTITLE_FONT_SIZE 34
+#define SUBTITLE_OUTLINE 2
+// Cues starting within this many seconds are rasterized and uploaded ahead
+#define SUBTITLE_PREPARE_AHEAD 2.0
+// Embedded cues without an end stay up this long or until the next one
+#define SUBTITLE_DEFAULT_DURATION 5.0
+// Space between the bottom of the picture and the last line
+#define SUBTITLE_MARGIN_BOTTOM 36
+// Worker wake-up interval, cues are prepared seconds ahead so this can be coarse
+#define SUBTITLE_POLL_MS 20
+
+// Loads the .srt next to the file, or decodes the best embedded subtitle stream of
+// demux when there is none. Call before demuxer_start. False without subtitles.
+bool subtitles_open(const char* filepath, demuxer* demux, int video_stream_index);
+// Main thread, blits the active cues over the picture drawn at video_rect
+void subtitles_render(SDL_Renderer* renderer, const SDL_Rect& video_rect, int video_width, int video_height);
+void subtitles_toggle();
+// Any thread, lets the worker wind down without waiting for it
+void subtitles_abort();
+// Main thread, before the demuxer closes. False when the worker was left
+// running at exit, it may still read the demuxer then.
+bool subtitles_close();
+
+#endif
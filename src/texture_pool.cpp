@@ -0,0 +1,209 @@
+#include <cstdio>
+
+#include "texture_pool.hpp"
+
+// Spare rows below the picture, the decoder may touch a little past its last plane
+#define TEXTURE_POOL_PADDING_ROWS 16
+
+static bool texture_pool_lock_slot(texture_slot& slot, int height) {
+    void* pixels = nullptr;
+    int pitch = 0;
+    if (SDL_LockTexture(slot.texture, NULL, &pixels, &pitch) != 0) return false;
+
+    // SDL keeps IYUV textures as three packed planes with halved chroma pitch
+    int chroma_pitch = (pitch + 1) / 2;
+    int chroma_height = (height + 1) / 2;
+
+    slot.planes[0] = static_cast<uint8_t*>(pixels);
+    slot.planes[1] = slot.planes[0] + pitch * height;
+    slot.planes[2] = slot.planes[1] + chroma_pitch * chroma_height;
+    slot.pitches[0] = pitch;
+    slot.pitches[1] = chroma_pitch;
+    slot.pitches[2] = chroma_pitch;
+    slot.size = pitch * height + 2 * chroma_pitch * chroma_height;
+    return true;
+}
+
+static bool texture_pool_is_yuv420(int format) {
+    return format == AV_PIX_FMT_YUV420P || format == AV_PIX_FMT_YUVJ420P;
+}
+
+// Slot size for a picture, what the codec needs plus padding
+static void texture_pool_dimensions(AVCodecContext* codec_ctx, int& width, int& height, int linesize_align[AV_NUM_DATA_POINTERS]) {
+    avcodec_align_dimensions2(codec_ctx, &width, &height, linesize_align);
+
+    // 64 byte luma pitch keeps every plane aligned for the decoder's SIMD paths
+    width = FFALIGN(width, 64);
+    height = FFALIGN(height, 16) + TEXTURE_POOL_PADDING_ROWS;
+}
+
+// Pool mutex held
+static void texture_pool_free_slots(texture_pool& pool) {
+    for (int i = 0; i < pool.count; ++i) {
+        texture_slot& slot = pool.slots[i];
+        if (slot.texture) SDL_DestroyTexture(slot.texture);
+        slot = texture_slot();
+    }
+
+    pool.count = 0;
+    pool.width = 0;
+    pool.height = 0;
+    pool.ready = false;
+}
+
+// Pool mutex held
+static bool texture_pool_create_slots(texture_pool& pool, int width, int height) {
+    for (int i = 0; i < pool.capacity; ++i) {
+        texture_slot& slot = pool.slots[i];
+        slot.pool = &pool;
+        slot.in_use = false;
+        slot.texture = SDL_CreateTexture(pool.renderer, SDL_PIXELFORMAT_IYUV, SDL_TEXTUREACCESS_STREAMING, width, height);
+        if (!slot.texture || !texture_pool_lock_slot(slot, height) || slot.pitches[0] != width) {
+            printf("[Texture pool] Could not create locked texture %d: %s\n", i, SDL_GetError());
+            if (slot.texture) SDL_DestroyTexture(slot.texture);
+            slot.texture = nullptr;
+            break;
+        }
+        // Scaled to the screen on the GPU when drawn, filter it
+        SDL_SetTextureScaleMode(slot.texture, SDL_ScaleModeLinear);
+        pool.count++;
+    }
+
+    pool.width = width;
+    pool.height = height;
+    pool.ready = pool.count > 0;
+    return pool.ready;
+}
+
+bool texture_pool_init(texture_pool& pool, SDL_Renderer* renderer, AVCodecContext* codec_ctx, int count) {
+    texture_pool_destroy(pool);
+
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    pool.renderer = renderer;
+    pool.capacity = count > TEXTURE_POOL_MAX_SLOTS ? TEXTURE_POOL_MAX_SLOTS : count;
+    pool.misses = 0;
+    if (!texture_pool_is_yuv420(codec_ctx->pix_fmt)) return false;
+
+    int width = codec_ctx->width;
+    int height = codec_ctx->height;
+    int linesize_align[AV_NUM_DATA_POINTERS];
+    texture_pool_dimensions(codec_ctx, width, height, linesize_align);
+    return texture_pool_create_slots(pool, width, height);
+}
+
+void texture_pool_destroy(texture_pool& pool) {
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    texture_pool_free_slots(pool);
+    pool.renderer = nullptr;
+    pool.capacity = 0;
+    pool.pending_width = 0;
+    pool.pending_height = 0;
+}
+
+bool texture_pool_update(texture_pool& pool) {
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    if (!pool.pending_width || !pool.renderer) return false;
+
+    // Queued frames and decoder references still point into the old slots
+    for (int i = 0; i < pool.count; ++i) {
+        if (pool.slots[i].in_use) return false;
+    }
+
+    int width = pool.pending_width;
+    int height = pool.pending_height;
+    pool.pending_width = 0;
+    pool.pending_height = 0;
+
+    texture_pool_free_slots(pool);
+    bool created = texture_pool_create_slots(pool, width, height);
+    printf("[Texture pool] Reallocated %d slots at %dx%d\n", pool.count, width, height);
+    return created;
+}
+
+static void texture_pool_release(void* opaque, uint8_t*) {
+    texture_slot* slot = static_cast<texture_slot*>(opaque);
+    std::lock_guard<std::mutex> lock(slot->pool->mutex);
+    slot->in_use = false;
+}
+
+int texture_pool_get_buffer2(AVCodecContext* codec_ctx, AVFrame* frame, int flags) {
+    texture_pool* pool = static_cast<texture_pool*>(codec_ctx->opaque);
+    if (!pool || (frame->format != AV_PIX_FMT_YUV420P && frame->format != AV_PIX_FMT_YUVJ420P)) {
+        return avcodec_default_get_buffer2(codec_ctx, frame, flags);
+    }
+
+    int width = frame->width;
+    int height = frame->height;
+    int linesize_align[AV_NUM_DATA_POINTERS];
+    texture_pool_dimensions(codec_ctx, width, height, linesize_align);
+
+    texture_slot* slot = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(pool->mutex);
+        // Bigger pictures do not fit, much smaller ones would waste most of each slot
+        bool fits = width <= pool->width && height <= pool->height;
+        bool wasteful = width * 2 <= pool->width || height * 2 <= pool->height;
+        if (pool->capacity > 0 && (!fits || wasteful)) {
+            pool->pending_width = width;
+            pool->pending_height = height;
+        }
+
+        // Nothing new goes into slots about to be reallocated, so they all come back
+        if (pool->ready && fits && !pool->pending_width) {
+            for (int i = 0; i < pool->count; ++i) {
+                texture_slot& candidate = pool->slots[i];
+                if (candidate.in_use) continue;
+                if (candidate.pitches[0] % linesize_align[0] || candidate.pitches[1] % linesize_align[1]) break;
+                candidate.in_use = true;
+                slot = &candidate;
+                break;
+            }
+        }
+        if (!slot) pool->misses++;
+    }
+
+    // Exhausted or unsuitable, the presenter copies these frames instead
+    if (!slot) return avcodec_default_get_buffer2(codec_ctx, frame, flags);
+
+    frame->buf[0] = av_buffer_create(slot->planes[0], slot->size, texture_pool_release, slot, 0);
+    if (!frame->buf[0]) {
+        std::lock_guard<std::mutex> lock(pool->mutex);
+        slot->in_use = false;
+        return AVERROR(ENOMEM);
+    }
+
+    for (int i = 0; i < 3; ++i) {
+        frame->data[i] = slot->planes[i];
+        frame->linesize[i] = slot->pitches[i];
+    }
+    frame->extended_data = frame->data;
+    return 0;
+}
+
+SDL_Texture* texture_pool_present(texture_pool& pool, const AVFrame* frame) {
+    if (!frame->buf[0] || frame->buf[1]) return nullptr;
+
+    void* opaque = av_buffer_get_opaque(frame->buf[0]);
+    texture_slot* slot = nullptr;
+    for (int i = 0; i < pool.count; ++i) {
+        if (opaque == &pool.slots[i]) {
+            slot = &pool.slots[i];
+            break;
+        }
+    }
+    if (!slot) return nullptr;
+
+    // Unlocking hands the planes to SDL for upload, lock again right away so the
+    // slot stays writeable once the decoder gets it back
+    SDL_UnlockTexture(slot->texture);
+
+    void* pixels = nullptr;
+    int pitch = 0;
+    if (SDL_LockTexture(slot->texture, NULL, &pixels, &pitch) != 0 || pixels != slot->planes[0]) {
+        printf("[Texture pool] Texture memory moved, falling back to copies\n");
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        pool.ready = false;
+    }
+
+    return slot->texture;
+}
@@ -0,0 +1,51 @@
+#ifndef TEXTURE_POOL_H
+#define TEXTURE_POOL_H
+
+#include <mutex>
+#include <SDL2/SDL.h>
+extern "C" {
+    #include <libavcodec/avcodec.h>
+}
+
+#define TEXTURE_POOL_MAX_SLOTS 24
+
+struct texture_pool;
+
+struct texture_slot {
+    texture_pool* pool = nullptr;
+    SDL_Texture* texture = nullptr;
+    uint8_t* planes[3] = {};
+    int pitches[3] = {};
+    size_t size = 0;
+    bool in_use = false;
+};
+
+// Persistently locked IYUV streaming textures the decoder renders into directly.
+// Only the main thread touches SDL; decoder threads just hand out plane pointers.
+// One pool lives for a whole playback session, seeks keep it as it is.
+struct texture_pool {
+    texture_slot slots[TEXTURE_POOL_MAX_SLOTS];
+    SDL_Renderer* renderer = nullptr;
+    int count = 0;
+    int capacity = 0; // Slots asked for, count is what could be created
+    int width = 0;
+    int height = 0;
+    // Slot size the decoder needs after a geometry or format change, the main
+    // thread reallocates once every slot is back. 0 when nothing is pending.
+    int pending_width = 0;
+    int pending_height = 0;
+    bool ready = false;
+    uint64_t misses = 0;
+    std::mutex mutex;
+};
+
+// Sizes the pool for the codec's picture. A codec without a 4:2:0 format yet
+// gets its slots from texture_pool_update once the first frame asks for them.
+bool texture_pool_init(texture_pool& pool, SDL_Renderer* renderer, AVCodecContext* codec_ctx, int count);
+void texture_pool_destroy(texture_pool& pool);
+int texture_pool_get_buffer2(AVCodecContext* codec_ctx, AVFrame* frame, int flags);
+// Main thread, once per presented frame. True when the slots were reallocated.
+bool texture_pool_update(texture_pool& pool);
+SDL_Texture* texture_pool_present(texture_pool& pool, const AVFrame* frame);
+
+#endif
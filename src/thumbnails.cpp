@@ -0,0 +1,443 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <unordered_map>
+#include <sys/stat.h>
+extern "C" {
+    #include <libavformat/avformat.h>
+    #include <libavcodec/avcodec.h>
+    #include <libswscale/swscale.h>
+}
+
+#include "main.hpp"
+#include "app_state.hpp"
+#include "core_thread.hpp"
+#include "player_session.hpp"
+#include "thumbnails.hpp"
+
+#define THUMBNAIL_BYTES (THUMBNAIL_WIDTH * THUMBNAIL_HEIGHT * 4)
+
+struct atlas_header {
+    char magic[4];
+    uint16_t version;
+    uint16_t width;
+    uint16_t height;
+    uint16_t reserved;
+};
+
+// Followed by the path and, when has_pixels is set, one RGBA tile
+struct atlas_record {
+    uint16_t path_length;
+    uint8_t has_pixels;
+    uint8_t reserved;
+    int64_t mtime;
+    uint64_t size;
+};
+
+struct atlas_entry {
+    long offset; // Of the pixels
+    int64_t mtime;
+    uint64_t size;
+    bool has_pixels;
+};
+
+struct thumbnail_result {
+    std::string path;
+    std::vector<uint8_t> pixels; // Empty when there is nothing to show
+};
+
+struct thumbnail_tile {
+    SDL_Texture* texture = nullptr;
+    uint64_t last_used = 0;
+    bool requested = false;
+    bool failed = false;
+};
+
+// Worker side, only touched by the worker thread once it runs
+static FILE* atlas_file = nullptr;
+static std::unordered_map<std::string, atlas_entry> atlas_index;
+
+// Shared between the worker and the main thread
+static std::mutex thumbnail_mutex;
+static std::condition_variable thumbnail_cv;
+static std::deque<std::string> pending;
+static std::vector<thumbnail_result> ready;
+static std::atomic<bool> thumbnail_running = false;
+static core_thread thumbnail_thread;
+
+// Main thread only
+static std::unordered_map<std::string, thumbnail_tile> tiles;
+static uint64_t thumbnail_frame = 0;
+static int texture_count = 0;
+
+static bool atlas_open() {
+    atlas_file = fopen(THUMBNAIL_ATLAS_PATH, "r+b");
+
+    atlas_header header;
+    bool valid = atlas_file && fread(&header, sizeof(header), 1, atlas_file) == 1 &&
+                 !memcmp(header.magic, "CMPT", 4) && header.version == THUMBNAIL_ATLAS_VERSION &&
+                 header.width == THUMBNAIL_WIDTH && header.height == THUMBNAIL_HEIGHT;
+
+    if (valid) {
+        fseek(atlas_file, 0, SEEK_END);
+        valid = ftell(atlas_file) < THUMBNAIL_ATLAS_MAX_BYTES;
+    }
+
+    if (!valid) {
+        // Missing, outdated or too big, start a fresh atlas
+        if (atlas_file) fclose(atlas_file);
+        atlas_file = fopen(THUMBNAIL_ATLAS_PATH, "w+b");
+        if (!atlas_file) {
+            printf("[Thumbnails] Could not create %s\n", THUMBNAIL_ATLAS_PATH);
+            return false;
+        }
+
+        atlas_header fresh = { { 'C', 'M', 'P', 'T' }, THUMBNAIL_ATLAS_VERSION, THUMBNAIL_WIDTH, THUMBNAIL_HEIGHT, 0 };
+        fwrite(&fresh, sizeof(fresh), 1, atlas_file);
+        fflush(atlas_file);
+        return true;
+    }
+
+    // Walk the record headers only, later records replace earlier ones
+    fseek(atlas_file, sizeof(atlas_header), SEEK_SET);
+    atlas_record record;
+    while (fread(&record, sizeof(record), 1, atlas_file) == 1) {
+        std::string path(record.path_length, '\0');
+        if (fread(&path[0], 1, record.path_length, atlas_file) != record.path_length) break;
+
+        atlas_entry entry = { ftell(atlas_file), record.mtime, record.size, record.has_pixels != 0 };
+        if (record.has_pixels && fseek(atlas_file, THUMBNAIL_BYTES, SEEK_CUR) != 0) break;
+        atlas_index[path] = entry;
+    }
+
+    printf("[Thumbnails] %d thumbnails in the atlas\n", (int)atlas_index.size());
+    return true;
+}
+
+static void atlas_append(const std::string& path, const struct stat& file_stat, const std::vector<uint8_t>& pixels) {
+    if (!atlas_file) return;
+
+    fseek(atlas_file, 0, SEEK_END);
+    atlas_record record = { (uint16_t)path.size(), (uint8_t)!pixels.empty(), 0, (int64_t)file_stat.st_mtime, (uint64_t)file_stat.st_size };
+    fwrite(&record, sizeof(record), 1, atlas_file);
+    fwrite(path.data(), 1, path.size(), atlas_file);
+
+    atlas_entry entry = { ftell(atlas_file), record.mtime, record.size, record.has_pixels != 0 };
+    if (!pixels.empty()) fwrite(pixels.data(), 1, THUMBNAIL_BYTES, atlas_file);
+    fflush(atlas_file);
+
+    atlas_index[path] = entry;
+}
+
+static bool atlas_read(const atlas_entry& entry, std::vector<uint8_t>& pixels) {
+    pixels.resize(THUMBNAIL_BYTES);
+    if (fseek(atlas_file, entry.offset, SEEK_SET) != 0 || fread(pixels.data(), 1, THUMBNAIL_BYTES, atlas_file) != THUMBNAIL_BYTES) {
+        pixels.clear();
+        return false;
+    }
+    return true;
+}
+
+// Scales into the middle of a black tile, keeping the aspect ratio
+static bool thumbnail_scale(const AVFrame* frame, std::vector<uint8_t>& pixels) {
+    if (frame->width <= 0 || frame->height <= 0) return false;
+
+    int width = THUMBNAIL_WIDTH;
+    int height = frame->height * THUMBNAIL_WIDTH / frame->width;
+    if (height > THUMBNAIL_HEIGHT) {
+        height = THUMBNAIL_HEIGHT;
+        width = frame->width * THUMBNAIL_HEIGHT / frame->height;
+    }
+    if (width < 1 || height < 1) return false;
+
+    SwsContext* sws = sws_getContext(frame->width, frame->height, (AVPixelFormat)frame->format,
+                                     width, height, AV_PIX_FMT_RGBA, SWS_FAST_BILINEAR, nullptr, nullptr, nullptr);
+    if (!sws) return false;
+
+    pixels.assign(THUMBNAIL_BYTES, 0);
+    for (size_t i = 3; i < pixels.size(); i += 4) pixels[i] = 255;
+
+    int x = (THUMBNAIL_WIDTH - width) / 2;
+    int y = (THUMBNAIL_HEIGHT - height) / 2;
+    uint8_t* dst[] = { pixels.data() + (y * THUMBNAIL_WIDTH + x) * 4 };
+    int dst_stride[] = { THUMBNAIL_WIDTH * 4 };
+    sws_scale(sws, frame->data, frame->linesize, 0, frame->height, dst, dst_stride);
+    sws_freeContext(sws);
+    return true;
+}
+
+static AVCodecContext* thumbnail_open_codec(AVStream* stream) {
+    const AVCodec* codec = avcodec_find_decoder(stream->codecpar->codec_id);
+    if (!codec) return nullptr;
+
+    AVCodecContext* codec_ctx = avcodec_alloc_context3(codec);
+    if (!codec_ctx || avcodec_parameters_to_context(codec_ctx, stream->codecpar) < 0) {
+        avcodec_free_context(&codec_ctx);
+        return nullptr;
+    }
+
+    // Decode at reduced resolution where the codec can, only keyframes are needed
+    int lowres = 0;
+    while (lowres < codec->max_lowres && (codec_ctx->width >> (lowres + 1)) >= THUMBNAIL_WIDTH) lowres++;
+    codec_ctx->lowres = lowres;
+    codec_ctx->skip_frame = AVDISCARD_NONKEY;
+    codec_ctx->thread_count = 1;
+
+    if (avcodec_open2(codec_ctx, codec, nullptr) < 0) {
+        avcodec_free_context(&codec_ctx);
+        return nullptr;
+    }
+    return codec_ctx;
+}
+
+// Decodes the cover art packet alone, or the first keyframe read from the stream
+static bool thumbnail_decode(AVFormatContext* fmt_ctx, AVStream* stream, std::vector<uint8_t>& pixels) {
+    AVCodecContext* codec_ctx = thumbnail_open_codec(stream);
+    if (!codec_ctx) return false;
+
+    AVPacket* pkt = av_packet_alloc();
+    AVFrame* frame = av_frame_alloc();
+    bool cover = stream->disposition & AV_DISPOSITION_ATTACHED_PIC;
+    bool done = false;
+
+    for (int i = 0; i < THUMBNAIL_MAX_PACKETS && !done && thumbnail_running; ++i) {
+        if (cover) {
+            if (i > 0) break;
+            av_packet_ref(pkt, &stream->attached_pic);
+        } else if (av_read_frame(fmt_ctx, pkt) < 0) {
+            break;
+        }
+
+        if (pkt->stream_index == stream->index && avcodec_send_packet(codec_ctx, pkt) == 0) {
+            if (cover) avcodec_send_packet(codec_ctx, nullptr);
+            if (avcodec_receive_frame(codec_ctx, frame) == 0) {
+                done = thumbnail_scale(frame, pixels);
+                av_frame_unref(frame);
+            }
+        }
+        av_packet_unref(pkt);
+    }
+
+    // Decoders that reorder hold the keyframe back until they are drained
+    if (!done && thumbnail_running && avcodec_send_packet(codec_ctx, nullptr) == 0) {
+        while (!done && avcodec_receive_frame(codec_ctx, frame) == 0) {
+            done = thumbnail_scale(frame, pixels);
+            av_frame_unref(frame);
+        }
+    }
+
+    av_frame_free(&frame);
+    av_packet_free(&pkt);
+    avcodec_free_context(&codec_ctx);
+    return done;
+}
+
+static bool thumbnail_extract(const std::string& full_path, std::vector<uint8_t>& pixels) {
+    AVFormatContext* fmt_ctx = nullptr;
+    if (avformat_open_input(&fmt_ctx, full_path.c_str(), nullptr, nullptr) != 0) return false;
+    if (avformat_find_stream_info(fmt_ctx, nullptr) < 0) {
+        avformat_close_input(&fmt_ctx);
+        return false;
+    }
+
+    AVStream* stream = nullptr;
+    for (unsigned int i = 0; i < fmt_ctx->nb_streams; ++i) {
+        if (fmt_ctx->streams[i]->disposition & AV_DISPOSITION_ATTACHED_PIC) {
+            stream = fmt_ctx->streams[i];
+            break;
+        }
+    }
+
+    if (!stream) {
+        int index = av_find_best_stream(fmt_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+        if (index >= 0) {
+            stream = fmt_ctx->streams[index];
+            // A tenth in skips black intros, the seek lands on the keyframe before
+            if (fmt_ctx->duration > 0) {
+                int64_t target = (fmt_ctx->start_time != AV_NOPTS_VALUE ? fmt_ctx->start_time : 0) + fmt_ctx->duration / 10;
+                avformat_seek_file(fmt_ctx, -1, INT64_MIN, target, target, 0);
+            }
+        }
+    }
+
+    bool done = false;
+    if (stream) {
+        for (unsigned int i = 0; i < fmt_ctx->nb_streams; ++i) {
+            if (fmt_ctx->streams[i] != stream) fmt_ctx->streams[i]->discard = AVDISCARD_ALL;
+        }
+        done = thumbnail_decode(fmt_ctx, stream, pixels);
+    }
+
+    avformat_close_input(&fmt_ctx);
+    return done;
+}
+
+static void thumbnail_worker(void*) {
+    bool atlas_ready = atlas_open();
+
+    while (thumbnail_running) {
+        // Leave the SD card and the CPU to playback
+        if (app_state_get() != STATE_MENU) {
+            SDL_Delay(100);
+            continue;
+        }
+
+        std::string path;
+        {
+            std::unique_lock<std::mutex> lock(thumbnail_mutex);
+            thumbnail_cv.wait(lock, [] { return !thumbnail_running || !pending.empty(); });
+            if (!thumbnail_running) break;
+            path = pending.front();
+            pending.pop_front();
+        }
+
+        thumbnail_result result;
+        result.path = path;
+
+        std::string full_path = std::string(MEDIA_PATH) + path;
+        struct stat file_stat;
+        if (stat(full_path.c_str(), &file_stat) == 0) {
+            auto cached = atlas_ready ? atlas_index.find(path) : atlas_index.end();
+            if (cached != atlas_index.end() && cached->second.mtime == (int64_t)file_stat.st_mtime &&
+                cached->second.size == (uint64_t)file_stat.st_size) {
+                if (cached->second.has_pixels) atlas_read(cached->second, result.pixels);
+            } else {
+                if (!thumbnail_extract(full_path, result.pixels)) result.pixels.clear();
+                // Failures are stored too, they are not retried until the file changes
+                if (atlas_ready) atlas_append(path, file_stat, result.pixels);
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(thumbnail_mutex);
+        ready.push_back(std::move(result));
+    }
+
+    if (atlas_file) {
+        fclose(atlas_file);
+        atlas_file = nullptr;
+    }
+    atlas_index.clear();
+}
+
+void thumbnails_init() {
+    if (thumbnail_running) return;
+
+    thumbnail_running = true;
+    if (!core_thread_start(thumbnail_thread, "cafemp thumbnails", thumbnail_worker, nullptr, CORE_SCAN, PRIORITY_THUMBNAILS)) {
+        thumbnail_running = false;
+    }
+}
+
+void thumbnails_shutdown() {
+    {
+        std::lock_guard<std::mutex> lock(thumbnail_mutex);
+        thumbnail_running = false;
+        pending.clear();
+        ready.clear();
+    }
+    thumbnail_cv.notify_all();
+    // The worker never touches the tiles, they can go even if it is left running
+    player_session_join(thumbnail_thread, "Thumbnails");
+
+    for (auto& it : tiles) {
+        if (it.second.texture) SDL_DestroyTexture(it.second.texture);
+    }
+    tiles.clear();
+    texture_count = 0;
+}
+
+static void thumbnails_evict() {
+    while (texture_count > THUMBNAIL_MAX_TEXTURES) {
+        auto oldest = tiles.end();
+        for (auto it = tiles.begin(); it != tiles.end(); ++it) {
+            if (it->second.texture && (oldest == tiles.end() || it->second.last_used < oldest->second.last_used)) oldest = it;
+        }
+        if (oldest == tiles.end()) return;
+
+        // Dropping the whole tile lets it come back from the atlas when visible again
+        SDL_DestroyTexture(oldest->second.texture);
+        tiles.erase(oldest);
+        texture_count--;
+    }
+
+    // Failed and pending tiles hold no texture but still add up over a long session,
+    // drop the ones off screen. Failures come back from the atlas cheaply.
+    if (tiles.size() <= THUMBNAIL_MAX_TILES) return;
+    for (auto it = tiles.begin(); it != tiles.end();) {
+        if (!it->second.texture && it->second.last_used + 1 < thumbnail_frame) {
+            it = tiles.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void thumbnails_update(SDL_Renderer* renderer) {
+    thumbnail_frame++;
+
+    std::vector<thumbnail_result> finished;
+    {
+        std::lock_guard<std::mutex> lock(thumbnail_mutex);
+
+        // Only the page on screen is worth decoding, forget requests scrolled away
+        for (auto it = pending.begin(); it != pending.end();) {
+            auto tile = tiles.find(*it);
+            if (tile == tiles.end() || tile->second.last_used + 1 < thumbnail_frame) {
+                if (tile != tiles.end()) tile->second.requested = false;
+                it = pending.erase(it);
+            } else {
+                ++it;
+            }
+        }
+
+        size_t count = ready.size() < THUMBNAIL_UPLOADS_PER_FRAME ? ready.size() : THUMBNAIL_UPLOADS_PER_FRAME;
+        finished.assign(std::make_move_iterator(ready.begin()), std::make_move_iterator(ready.begin() + count));
+        ready.erase(ready.begin(), ready.begin() + count);
+    }
+
+    for (auto& result : finished) {
+        thumbnail_tile& tile = tiles[result.path];
+        tile.requested = false;
+
+        if (result.pixels.empty()) {
+            tile.failed = true;
+            continue;
+        }
+
+        if (!tile.texture) {
+            tile.texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STATIC, THUMBNAIL_WIDTH, THUMBNAIL_HEIGHT);
+            if (!tile.texture) {
+                tile.failed = true;
+                continue;
+            }
+            texture_count++;
+        }
+        SDL_UpdateTexture(tile.texture, NULL, result.pixels.data(), THUMBNAIL_WIDTH * 4);
+        tile.last_used = thumbnail_frame;
+    }
+
+    thumbnails_evict();
+}
+
+SDL_Texture* thumbnails_get(const char* path) {
+    if (!path || !thumbnail_running) return nullptr;
+
+    thumbnail_tile& tile = tiles[path];
+    tile.last_used = thumbnail_frame;
+    if (tile.texture || tile.failed) return tile.texture;
+
+    if (!tile.requested) {
+        tile.requested = true;
+        {
+            std::lock_guard<std::mutex> lock(thumbnail_mutex);
+            pending.push_back(path);
+        }
+        thumbnail_cv.notify_one();
+    }
+    return nullptr;
+}
@@ -0,0 +1,27 @@
+#ifndef THUMBNAILS_H
+#define THUMBNAILS_H
+
+#include <SDL2/SDL.h>
+
+#define THUMBNAIL_WIDTH 128
+#define THUMBNAIL_HEIGHT 72
+#define THUMBNAIL_ATLAS_VERSION 1
+// Thumbnail textures kept on the GPU, about three pages of the file browser
+#define THUMBNAIL_MAX_TEXTURES 36
+// Tiles remembered in total, past this the off screen ones without a texture are dropped
+#define THUMBNAIL_MAX_TILES 256
+// Textures created per frame, keeps page flips from stalling the render loop
+#define THUMBNAIL_UPLOADS_PER_FRAME 2
+// The atlas is append only, start over once it grows past this
+#define THUMBNAIL_ATLAS_MAX_BYTES (64 * 1024 * 1024)
+// Packets read looking for a decodable keyframe before giving up
+#define THUMBNAIL_MAX_PACKETS 256
+
+void thumbnails_init();
+void thumbnails_shutdown();
+// Main thread, once per frame: uploads finished tiles and evicts old ones
+void thumbnails_update(SDL_Renderer* renderer);
+// Main thread, returns nullptr until the tile is ready and queues it if needed
+SDL_Texture* thumbnails_get(const char* path);
+
+#endif
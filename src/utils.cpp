@@ -1,11 +1,13 @@
 #include <string>
 #include <vector>
-#include <dirent.h>
 #include <unordered_set>
+#include <cctype>
 
 #include "utils.hpp"
+#include "main.hpp"
 #include "app_state.hpp"
 #include "media_files.hpp"
+#include "media_library.hpp"
 #include "audio_player.hpp"
 #include "video_player.hpp"
 
@@ -28,22 +30,36 @@ bool valid_file_ending(const std::string& file_ending) {
     return valid_video_endings.count(file_ending) > 0 || valid_audio_endings.count(file_ending) > 0;
 }
 
+bool is_network_path(const std::string& name) {
+    return name.find("://") != std::string::npos;
+}
+
+std::string media_full_path(const std::string& name) {
+    return is_network_path(name) ? name : std::string(MEDIA_PATH) + name;
+}
+
+std::string media_extension(const std::string& name) {
+    std::string path = name.substr(0, name.find_first_of("?#"));
+    size_t slash = path.find_last_of('/');
+    size_t dot = path.find_last_of('.');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) return "";
+
+    std::string extension = path.substr(dot + 1);
+    for (auto& c : extension) c = std::tolower(c);
+    return extension;
+}
+
+std::string media_display_name(const std::string& name) {
+    if (!is_network_path(name)) return name;
+
+    std::string path = name.substr(0, name.find_first_of("?#"));
+    while (!path.empty() && path.back() == '/') path.pop_back();
+    size_t slash = path.find_last_of('/');
+    std::string segment = slash == std::string::npos ? path : path.substr(slash + 1);
+    return segment.empty() ? name : segment;
+}
+
 void scan_directory(const char* path) {
-    get_media_files().clear();
-    printf("[Menu] Opening folder %s\n", path);
-    DIR* dir = opendir(path);
-    if (!dir) return;
-
-    struct dirent* ent;
-    while ((ent = readdir(dir)) != NULL) {
-        std::string name(ent->d_name);
-        if (name.length() > 4) {
-            std::string ext = name.substr(name.find_last_of(".") + 1);
-            for (auto& c : ext) c = std::tolower(c);
-            if (valid_file_ending(ext)) {
-                add_media_file(name);
-            }
-        }
-    }    
-    closedir(dir);
+    // Runs in the background, the menu keeps showing the last list meanwhile
+    media_library_scan(path);
 }
@@ -16,6 +16,13 @@ static const std::unordered_set<std::string> valid_audio_endings = {
 std::string format_time(int seconds);
 std::string truncate_filename(const std::string& name, size_t max_length);
 bool valid_file_ending(const std::string& file_ending);
+// Streams listed in streams.m3u are URLs, everything else is relative to MEDIA_PATH
+bool is_network_path(const std::string& name);
+std::string media_full_path(const std::string& name);
+// Lower case extension, ignores a URL's query string
+std::string media_extension(const std::string& name);
+// What the browser shows, the last path segment for URLs
+std::string media_display_name(const std::string& name);
 void scan_directory(const char* path);
 void start_file(int index);
 void start_selected_video(int selected_index);
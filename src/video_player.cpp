@@ -6,100 +6,188 @@ extern "C" {
     #include <libavformat/avformat.h>
     #include <libavcodec/avcodec.h>
     #include <libswresample/swresample.h>
-    #include <libswscale/swscale.h>
     #include <libavutil/imgutils.h>
     #include <libavutil/frame.h>
 }
 
-#include <queue>
-#include <thread>
 #include <mutex>
+#include <atomic>
 #include <condition_variable>
 
 #include "app_state.hpp"
 #include "main.hpp"
 #include "video_player.hpp"
 #include "audio_player.hpp"
+#include "demuxer.hpp"
+#include "media_clock.hpp"
+#include "core_thread.hpp"
+#include "frame_queue.hpp"
+#include "texture_pool.hpp"
+#include "perf.hpp"
+#include "decode_preflight.hpp"
+#include "subtitles.hpp"
+#include "resume_store.hpp"
+#include "settings.hpp"
+#include "log.hpp"
+#include "player_session.hpp"
 
 int video_stream_index = -1;
+demuxer* demux = NULL;
 AVFormatContext* fmt_ctx = NULL;
 AVCodecContext* video_codec_ctx = NULL;
 SwrContext* swr_ctx = NULL;
 AVPacket* pkt = NULL;
-AVFrame* frame = NULL;
+// Reference to the picture on screen, keeps its pool slot from being decoded into
+AVFrame* displayed_frame = NULL;
 AVRational framerate;
+AVRational video_time_base;
 
-frame_info* current_frame_info;
+// What the UI draws, texture is null until the first frame of a file shows
+frame_info current_frame_info = {};
+texture_pool video_texture_pool;
+SDL_Texture* copy_textures[VIDEO_COPY_TEXTURES] = {};
+int copy_texture_index = 0;
+SDL_Renderer* video_renderer = NULL;
+SDL_YUV_CONVERSION_MODE video_conversion_mode = SDL_YUV_CONVERSION_AUTOMATIC;
 
-int64_t current_pts_seconds = 0;
+// Picked before the codec opens, skip_frame falls back to the plan's level, not the default
+decode_plan video_decode_plan;
+AVDiscard video_skip_frame = AVDISCARD_DEFAULT;
+
+double current_pts_seconds = 0;
 uint64_t ticks_per_frame = 0;
-int64_t start_time = 0;
+uint64_t video_dropped_frames = 0;
 
 bool playing_video = false;
 
-std::queue<AVFrame*> video_frame_queue;
-std::mutex video_frame_mutex;
-std::condition_variable video_frame_cv;
+// Bumped by every seek, queued frames carry the generation they were decoded for
+std::atomic<int> video_seek_generation = 0;
+// Main thread only, the clock stays paused until the first frame after a seek shows
+bool video_seek_pending = false;
+
+// Time to first frame, reported once per file
+uint64_t video_start_ticks = 0;
+uint64_t video_codec_open_us = 0;
+bool video_first_frame_shown = false;
+
+frame_queue video_frames;
+// Generation whose last frame the decoder put in the queue, the file is
+// finished once that one is still current and the queue ran empty
+std::atomic<int> video_finished_generation = -1;
 bool video_thread_running = true;
-std::thread video_thread;
+core_thread video_thread;
 std::mutex playback_mutex;
 std::condition_variable playback_cv;
-int64_t pause_start_time = 0;
-int64_t total_paused_duration = 0;
 
-AVCodecContext* video_player_create_codec_context(AVFormatContext* fmt_ctx, int stream_index) {
+AVCodecContext* video_player_create_codec_context(AVFormatContext* fmt_ctx, int stream_index, const decode_plan* plan) {
     AVCodecParameters* codecpar = fmt_ctx->streams[stream_index]->codecpar;
     const AVCodec* codec = avcodec_find_decoder(codecpar->codec_id);
+    if (!codec) {
+        printf("Unsupported codec: %s\n", avcodec_get_name(codecpar->codec_id));
+        return NULL;
+    }
     AVCodecContext* codec_ctx = avcodec_alloc_context3(codec);
+    if (!codec_ctx) return NULL;
     avcodec_parameters_to_context(codec_ctx, codecpar);
 
+    // Frame threading overlaps whole pictures, slice threading helps streams
+    // with few reference frames, let libavcodec pick what the codec supports
+    codec_ctx->thread_count = settings_get(SETTINGS_DECODE_THREADS);
+    codec_ctx->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+
+    // Decode straight into the texture pool, it falls back to regular buffers on its own
+    if (codec->capabilities & AV_CODEC_CAP_DR1) {
+        codec_ctx->get_buffer2 = texture_pool_get_buffer2;
+        codec_ctx->opaque = &video_texture_pool;
+    }
+
+    if (plan) decode_preflight_apply(codec_ctx, *plan);
+
+    // Cropping moves the plane pointers, the presenter crops with the source rect instead
+    codec_ctx->apply_cropping = 0;
+
     if (avcodec_open2(codec_ctx, codec, NULL) < 0) {
         printf("Failed to open codec.\n");
+        avcodec_free_context(&codec_ctx);
         return NULL;
     }
     return codec_ctx;
 }
 
-void clear_video_frames() {
-    std::lock_guard<std::mutex> lock(video_frame_mutex);
-    while (!video_frame_queue.empty()) {
-        AVFrame* f = video_frame_queue.front();
-        av_frame_free(&f);
-        video_frame_queue.pop();
+// Uploads the planes into the next copy texture. Rotating them keeps this
+// upload from landing in the one the GPU still reads
+static SDL_Texture* video_copy_frame(const AVFrame* frame) {
+    copy_texture_index = (copy_texture_index + 1) % VIDEO_COPY_TEXTURES;
+    SDL_Texture*& copy_texture = copy_textures[copy_texture_index];
+
+    int copy_width = 0, copy_height = 0;
+    if (copy_texture) SDL_QueryTexture(copy_texture, NULL, NULL, &copy_width, &copy_height);
+    if (!copy_texture || copy_width != frame->width || copy_height != frame->height) {
+        if (copy_texture) SDL_DestroyTexture(copy_texture);
+        copy_texture = SDL_CreateTexture(video_renderer, SDL_PIXELFORMAT_IYUV, SDL_TEXTUREACCESS_STREAMING, frame->width, frame->height);
+        if (copy_texture) SDL_SetTextureScaleMode(copy_texture, SDL_ScaleModeLinear);
     }
-}
-
-void video_player_seek(float delta_seconds) {
-    if (!fmt_ctx || video_stream_index < 0) return;
-
-    int64_t current_time = static_cast<int64_t>(current_pts_seconds * AV_TIME_BASE);
-    int64_t target_time = current_time + static_cast<int64_t>(delta_seconds * AV_TIME_BASE);
 
-    // Clamp target_time
-    if (target_time < 0) target_time = 0;
-    if (target_time > fmt_ctx->duration) target_time = fmt_ctx->duration;
-
-    if (av_seek_frame(fmt_ctx, video_stream_index, target_time, AVSEEK_FLAG_BACKWARD) < 0) {
-        printf("Seek failed!\n");
-        return;
+    if (copy_texture) {
+        SDL_UpdateYUVTexture(copy_texture, NULL,
+            frame->data[0], frame->linesize[0],
+            frame->data[1], frame->linesize[1],
+            frame->data[2], frame->linesize[2]);
     }
-    printf("Seek success!\n");
-
-    avcodec_flush_buffers(video_codec_ctx);
-
-    clear_video_frames();
+    return copy_texture;
+}
 
-    if (current_frame_info) {
-        SDL_DestroyTexture(current_frame_info->texture);
-        delete current_frame_info;
-        current_frame_info = nullptr;
+// Hands the shown picture's pool slot back to the decoder. A pool texture on
+// screen is copied first so the picture stays up until the next one shows
+static void video_release_displayed_frame() {
+    if (!displayed_frame || !displayed_frame->buf[0]) return;
+    bool copied = false;
+    for (int i = 0; i < VIDEO_COPY_TEXTURES; ++i) {
+        if (current_frame_info.texture == copy_textures[i]) copied = true;
+    }
+    if (current_frame_info.texture && !copied) {
+        current_frame_info.texture = video_copy_frame(displayed_frame);
     }
+    av_frame_unref(displayed_frame);
+}
 
-    start_time = av_gettime_relative() - target_time;
+static void video_player_seek_to(int64_t target_time, bool to_keyframe) {
+    // Clamp target_time
+    int64_t start_time = fmt_ctx->start_time != AV_NOPTS_VALUE ? fmt_ctx->start_time : 0;
+    if (target_time < start_time) target_time = start_time;
+    if (fmt_ctx->duration > 0 && target_time > start_time + fmt_ctx->duration) target_time = start_time + fmt_ctx->duration;
+
+    // Bumped before the demuxer moves, the first packet of the new serial must
+    // already see the new generation or all its frames count as stale
+    video_seek_generation++;
+    frame_queue_flush(video_frames);
+    video_release_displayed_frame();
+    // The demuxer jumps to the preceding keyframe, the decoders flush once its
+    // packets arrive and fast-forward to the target without presenting
+    demuxer_seek(demux, target_time, to_keyframe);
+
+    // Hold the clock until the target frame is on screen
+    video_seek_pending = true;
+    media_clock_set(target_time / (double)AV_TIME_BASE);
+    media_clock_set_paused(true);
     current_pts_seconds = target_time / (double)AV_TIME_BASE;
+    #ifdef DEBUG_VIDEO
+    log_debug("[Video player] Seeking to %.2f\n", target_time / (double)AV_TIME_BASE);
+    #endif
+}
 
-    audio_player_seek(current_pts_seconds);
-    printf("Seek done!\n");
+void video_player_seek(float delta_seconds) {
+    if (!fmt_ctx || video_stream_index < 0) return;
+
+    // Scrub from where the last seek aimed while it is still in flight
+    double base_time = video_seek_pending ? current_pts_seconds : media_clock_get_master_time();
+    video_player_seek_to(static_cast<int64_t>((base_time + delta_seconds) * AV_TIME_BASE), false);
+}
+
+bool video_player_is_finished() {
+    return video_frames.capacity &&
+        video_finished_generation.load() == video_seek_generation.load() &&
+        frame_queue_size(video_frames) == 0;
 }
 
 bool video_player_is_playing() {
@@ -109,14 +197,10 @@ bool video_player_is_playing() {
 void video_player_play(bool new_state) {
     std::lock_guard<std::mutex> lock(playback_mutex);
 
+    // A pending seek keeps the clock held, the target frame restarts it
+    media_clock_set_paused(!new_state || video_seek_pending);
     if (!playing_video && new_state) {
-        int64_t now = av_gettime_relative();
-        int64_t pause_duration = now - pause_start_time;
-        start_time += pause_duration; // Shift start_time forward
         playback_cv.notify_one();
-    } else if (playing_video && !new_state) {
-        // We are pausing
-        pause_start_time = av_gettime_relative();
     }
 
     playing_video = new_state;
@@ -127,103 +211,166 @@ int64_t video_player_get_current_time() {
 }
 
 frame_info* video_player_get_current_frame_info() {
-    if (!current_frame_info) {
-        printf("No current_frame_info\n");
-        return NULL;
-    }
-    return current_frame_info;
+    return current_frame_info.texture ? &current_frame_info : NULL;
 }
 
-int video_player_init(const char* filepath, SDL_Renderer* renderer, SDL_Texture*& texture) {
+int video_player_init(const char* filepath, SDL_Renderer* renderer) {
     #ifdef DEBUG_VIDEO
-    printf("[Video player] Starting Video Player...\n");
-    printf("[Video player] Opening file %s\n", filepath);
+    log_debug("[Video player] Starting Video Player...\n");
+    log_debug("[Video player] Opening file %s\n", filepath);
     #endif
 
     AVDictionary *options = NULL;
-    av_dict_set(&options, "probesize", "10000", 0);
-    av_dict_set(&options, "fpsprobesize", "10000", 0);
-    av_dict_set(&options, "formatprobesize", "10000", 0);
-    if (avformat_open_input(&fmt_ctx, filepath, NULL, &options) != 0) {
+    int probe_size = settings_get(SETTINGS_PROBE_SIZE);
+    av_dict_set_int(&options, "probesize", probe_size, 0);
+    av_dict_set_int(&options, "fpsprobesize", probe_size, 0);
+    av_dict_set_int(&options, "formatprobesize", probe_size, 0);
+    demux = demuxer_open(filepath, &options);
+    av_dict_free(&options);
+    if (!demux) {
     #ifdef DEBUG_VIDEO
-        printf("[Video player] Could not open file: %s\n", filepath);
+        log_debug("[Video player] Could not open file: %s\n", filepath);
     #endif
         return -1;
     }
-
-    avformat_find_stream_info(fmt_ctx, NULL);
+    fmt_ctx = demux->fmt_ctx;
 
     video_stream_index = av_find_best_stream(fmt_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
 
     if (video_stream_index < 0) {
     #ifdef DEBUG_VIDEO
-        printf("[Video player] Could not find video stream.\n");
+        log_debug("[Video player] Could not find video stream.\n");
     #endif
         return -1;
     }
 
     #ifdef DEBUG_VIDEO
-    printf("[Video player] Video stream found: index %d\n", video_stream_index);
+    log_debug("[Video player] Video stream found: index %d\n", video_stream_index);
     #endif
+    demuxer_enable_stream(demux, AVMEDIA_TYPE_VIDEO, video_stream_index);
 
-    video_codec_ctx = video_player_create_codec_context(fmt_ctx, video_stream_index);
-    if (!video_codec_ctx) return -1;
+    // Files the console cannot decode in time play in reduced quality instead of drifting
+    video_decode_plan = decode_preflight(fmt_ctx, video_stream_index);
+    int forced_mode = settings_get(SETTINGS_DECODE_MODE);
+    if (forced_mode != SETTINGS_DECODE_MODE_AUTO) {
+        decode_preflight_force(video_decode_plan, fmt_ctx->streams[video_stream_index]->codecpar, (decode_mode)(forced_mode - 1));
+    }
+    video_skip_frame = video_decode_plan.skip_nonref ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
 
-    SDL_DestroyTexture(texture);
-    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_IYUV, SDL_TEXTUREACCESS_STREAMING,
-                                 video_codec_ctx->width, video_codec_ctx->height);
+    uint64_t codec_ticks = OSGetSystemTime();
+    video_codec_ctx = video_player_create_codec_context(fmt_ctx, video_stream_index, &video_decode_plan);
+    if (!video_codec_ctx) return -1;
+    video_codec_open_us = OSTicksToMicroseconds(OSGetSystemTime() - codec_ticks);
 
     framerate = fmt_ctx->streams[video_stream_index]->r_frame_rate;
+    video_time_base = fmt_ctx->streams[video_stream_index]->time_base;
     double frameRate = av_q2d(framerate);
     #ifdef DEBUG_VIDEO
-    printf("[Video player] FPS: %f\n", frameRate);
+    log_debug("[Video player] FPS: %f\n", frameRate);
     #endif
     ticks_per_frame = frameRate * OSMillisecondsToTicks(1000);
 
     pkt = av_packet_alloc();
-    frame = av_frame_alloc();
+    displayed_frame = av_frame_alloc();
+    video_renderer = renderer;
+    int frame_queue_size = settings_get(SETTINGS_VIDEO_FRAME_QUEUE);
+    if (!frame_queue_init(video_frames, frame_queue_size)) return -1;
+
+    // Queued frames, decoder references and the picture on screen all hold a slot
+    if (!texture_pool_init(video_texture_pool, renderer, video_codec_ctx, frame_queue_size + VIDEO_TEXTURE_POOL_EXTRA)) {
+    #ifdef DEBUG_VIDEO
+        log_debug("[Video player] No texture pool, copying every frame\n");
+    #endif
+    }
 
     #ifdef DEBUG_VIDEO
-    printf("[Video player] Codec, packet, and frame initialized\n");
+    log_debug("[Video player] Codec, packet, and frame initialized (%d decode threads)\n", video_codec_ctx->thread_count);
     #endif
 
-    audio_player_init(filepath);
+    // Sidecar or embedded, the stream has to be enabled before the demuxer starts
+    subtitles_open(filepath, demux, video_stream_index);
+    // Unplayable audio leaves its stream disabled, the video plays without it
+    if (audio_player_attach(demux) < 0) printf("[Video player] Audio track could not be opened, playing without sound\n");
+    demuxer_start(demux);
 
     return 0;
 }
 
-void video_player_start(const char* path, SDL_Renderer& renderer, SDL_Texture*& texture) {
+void video_player_start(const char* path, SDL_Renderer& renderer) {
     #ifdef DEBUG_VIDEO
-    printf("[Video player] Starting video playback\n");
+    log_debug("[Video player] Starting video playback\n");
     #endif
 
     current_pts_seconds = 0;
+    video_finished_generation = -1;
     video_thread_running = true;
+    video_start_ticks = OSGetSystemTime();
+    video_first_frame_shown = false;
+    perf_reset();
 
-    if (current_frame_info) {
-        SDL_DestroyTexture(current_frame_info->texture);
-        delete current_frame_info;
-        current_frame_info = nullptr;
-    }
+    current_frame_info = frame_info();
 
-    video_player_init(path, &renderer, texture);
+    if (video_player_init(path, &renderer) != 0) {
+        video_player_cleanup();
+        return;
+    }
+    // Network sources pre-roll for a while, start the clock at the first shown frame
+    // instead so nothing buffered during that time counts as late
+    video_seek_pending = demux->network;
+    // Streams rarely start at 0, start the clock where their timestamps do. Set
+    // here, before the resume seek moves it and before the decoder runs
+    media_clock_set(fmt_ctx->start_time != AV_NOPTS_VALUE ? fmt_ctx->start_time / (double)AV_TIME_BASE : 0.0);
+    media_clock_set_paused(true);
+    // Pick up where the video was left, from the keyframe before that point so
+    // nothing has to be decoded and thrown away first
+    double resume_time = resume_store_open(path, fmt_ctx->duration > 0 ? fmt_ctx->duration / (double)AV_TIME_BASE : 0.0);
+    if (resume_time > 0) video_player_seek_to(static_cast<int64_t>(resume_time * AV_TIME_BASE), true);
     start_video_decoding_thread();
     app_state_set(STATE_PLAYING_VIDEO);
 }
 
+static double video_frame_pts_seconds(const AVFrame* f) {
+    int64_t pts = f->best_effort_timestamp != AV_NOPTS_VALUE ? f->best_effort_timestamp : f->pts;
+    if (pts == AV_NOPTS_VALUE) return 0.0;
+    return pts * av_q2d(video_time_base);
+}
+
+static SDL_YUV_CONVERSION_MODE video_frame_conversion_mode(const AVFrame* f) {
+    if (f->color_range == AVCOL_RANGE_JPEG) return SDL_YUV_CONVERSION_JPEG;
+
+    switch (f->colorspace) {
+        case AVCOL_SPC_BT709:
+            return SDL_YUV_CONVERSION_BT709;
+        case AVCOL_SPC_BT470BG:
+        case AVCOL_SPC_SMPTE170M:
+        case AVCOL_SPC_FCC:
+            return SDL_YUV_CONVERSION_BT601;
+        default:
+            // Untagged streams, SDL picks BT.709 for HD and BT.601 below
+            return SDL_YUV_CONVERSION_AUTOMATIC;
+    }
+}
+
+static void video_decoding_thread_entry(void*) {
+    process_video_frame_thread();
+}
+
 void start_video_decoding_thread() {
     #ifdef DEBUG_VIDEO
-    printf("[Video player] Starting video decoding thread...\n");
+    log_debug("[Video player] Starting video decoding thread...\n");
     #endif
-    video_thread = std::thread(process_video_frame_thread);
+    core_thread_start(video_thread, "cafemp video", video_decoding_thread_entry, nullptr, CORE_VIDEO, PRIORITY_VIDEO);
 }
 
 void process_video_frame_thread() {
     AVFrame* local_frame = av_frame_alloc();
-    AVRational time_base = fmt_ctx->streams[video_stream_index]->time_base;
-    start_time = av_gettime_relative();  // microseconds
-    total_paused_duration = 0;
-    pause_start_time = 0;
+    int video_serial = -1;
+    // Serial the decoder was drained for, the end of the file is handled once per serial
+    int drained_serial = -1;
+    int late_frames = 0;
+    int frame_generation = video_seek_generation.load();
+    // Frames before this (seconds) are decoded only to reach the seek target
+    double skip_until = -1.0;
 
     while (video_thread_running) {
         {
@@ -231,36 +378,100 @@ void process_video_frame_thread() {
             playback_cv.wait(lock, [] { return playing_video || !video_thread_running; });
         }
 
-        AVPacket pkt;
-        if (av_read_frame(fmt_ctx, &pkt) >= 0) {
-            if (pkt.stream_index == video_stream_index) {
-                if (!avcodec_send_packet(video_codec_ctx, &pkt)) {
-                    while (!avcodec_receive_frame(video_codec_ctx, local_frame)) {
-                        int64_t pts_us = local_frame->pts * av_q2d(time_base) * 1e6;
-                        int64_t now_us = av_gettime_relative() - start_time;
-                        int64_t delay = pts_us - now_us;
-
-                        if (delay > 0) {
-                            av_usleep(delay);
-                        }
-
-                        current_pts_seconds = local_frame->pts * av_q2d(time_base);
-
-                        {
-                            std::lock_guard<std::mutex> lock(video_frame_mutex);
-                            if (video_frame_queue.size() < 10) { // Buffer limit
-                                video_frame_queue.push(local_frame); // Directly push the frame
-                                local_frame = av_frame_alloc(); // Allocate a new frame to receive next one
-                            } else {
-                                av_frame_unref(local_frame); // Frame too old, discard it
-                            }
-                        }
-                    }
+        int serial = 0;
+        packet_queue_result result = packet_queue_pop(demux, demux->video_queue, pkt, &serial, true);
+        if (result == PACKET_QUEUE_ABORTED) break;
+        bool draining = result == PACKET_QUEUE_EOF && serial != drained_serial;
+        if (result == PACKET_QUEUE_EOF && !draining) {
+            // Stay around, a seek can bring new packets
+            SDL_Delay(10);
+            continue;
+        }
+        if (result != PACKET_QUEUE_OK && !draining) continue;
+
+        if (serial != video_serial) {
+            // First packet after a seek, or its end when nothing was left to read
+            if (video_serial >= 0) avcodec_flush_buffers(video_codec_ctx);
+            video_serial = serial;
+            frame_generation = video_seek_generation.load();
+            late_frames = 0;
+
+            int64_t seek_target = packet_queue_seek_target(demux->video_queue);
+            skip_until = seek_target != AV_NOPTS_VALUE ? seek_target / (double)AV_TIME_BASE : -1.0;
+            // Nothing references non-reference frames, skip them until the target
+            video_codec_ctx->skip_frame = skip_until >= 0 ? AVDISCARD_NONREF : video_skip_frame;
+        }
+
+        OSTime decode_ticks = OSGetSystemTime();
+        // Frame threads hold the last pictures back until an empty packet drains them
+        bool sent = !avcodec_send_packet(video_codec_ctx, draining ? nullptr : pkt);
+        // Only the codec calls count, not the wait for a free queue slot
+        OSTime decode_time = OSGetSystemTime() - decode_ticks;
+
+        while (sent) {
+            decode_ticks = OSGetSystemTime();
+            int received = avcodec_receive_frame(video_codec_ctx, local_frame);
+            decode_time += OSGetSystemTime() - decode_ticks;
+            if (received) break;
+
+            if (frame_generation != video_seek_generation.load()) {
+                // Another seek is on its way, this frame is already stale
+                av_frame_unref(local_frame);
+                continue;
+            }
+
+            double pts = video_frame_pts_seconds(local_frame);
+
+            if (skip_until >= 0) {
+                // Fast-forward from the keyframe, the frame due at the target still shows
+                double frame_duration = framerate.num > 0 ? 1.0 / av_q2d(framerate) : 0.0;
+                if (pts + frame_duration <= skip_until) {
+                    av_frame_unref(local_frame);
+                    continue;
+                }
+                skip_until = -1.0;
+                video_codec_ctx->skip_frame = video_skip_frame;
+            }
+
+            double delay = pts - media_clock_get_master_time();
+
+            if (delay < -VIDEO_LATE_THRESHOLD) {
+                // Behind the master clock, drop the frame before it costs an upload
+                video_dropped_frames++;
+                perf_count(PERF_COUNTER_FRAMES_LATE);
+                if (++late_frames >= VIDEO_SKIP_NONREF_AFTER && video_codec_ctx->skip_frame < AVDISCARD_NONREF) {
+    #ifdef DEBUG_VIDEO
+                    log_debug("[Video player] Falling behind, skipping non-reference frames\n");
+    #endif
+                    video_codec_ctx->skip_frame = AVDISCARD_NONREF;
                 }
+                av_frame_unref(local_frame);
+                continue;
             }
-            av_packet_unref(&pkt);
-        } else {
-            video_thread_running = false;
+
+            if (delay > 0) {
+                late_frames = 0;
+                if (video_codec_ctx->skip_frame != video_skip_frame) {
+                    video_codec_ctx->skip_frame = video_skip_frame;
+                }
+            }
+
+            // No pacing here, the presenter picks frames by PTS. Blocks while the queue is full, decoding stays just ahead of presentation
+            AVFrame* slot = frame_queue_peek_writable(video_frames);
+            if (!slot) {
+                av_frame_unref(local_frame);
+                break;
+            }
+            av_frame_move_ref(slot, local_frame);
+            slot->opaque = reinterpret_cast<void*>(static_cast<intptr_t>(frame_generation));
+            frame_queue_push(video_frames);
+        }
+        perf_record(PERF_TIMER_DECODE, OSTicksToMicroseconds(decode_time));
+        av_packet_unref(pkt);
+
+        if (draining) {
+            drained_serial = serial;
+            video_finished_generation = frame_generation;
         }
     }
 
@@ -284,33 +495,91 @@ int64_t video_player_get_total_play_time() {
 }
 
 void render_video_frame(SDL_Renderer* renderer) {
-    AVFrame* frame = nullptr;
+    double master_time = media_clock_get_master_time();
 
-    {
-        std::lock_guard<std::mutex> lock(video_frame_mutex);
-        if (!video_frame_queue.empty()) {
-            frame = video_frame_queue.front();
-            video_frame_queue.pop();
-        }
+    AVFrame* frame = frame_queue_peek(video_frames);
+    if (!frame) return; // Nothing to render safely
+
+    // Decoded before the last seek, never show it
+    int generation = video_seek_generation.load();
+    while (frame && reinterpret_cast<intptr_t>(frame->opaque) != generation) {
+        frame_queue_pop(video_frames);
+        frame = frame_queue_peek(video_frames);
+    }
+    if (!frame) return;
+
+    if (video_seek_pending) {
+        // First frame at the seek target, restart the clock from it
+        video_seek_pending = false;
+        media_clock_set(video_frame_pts_seconds(frame));
+        media_clock_set_paused(!playing_video);
+        master_time = media_clock_get_master_time();
     }
 
-    if (!frame) return; // Nothing to render safely
+    // Keep showing the current picture until the next one is due
+    if (video_frame_pts_seconds(frame) > master_time + VIDEO_PRESENT_TOLERANCE) return;
+
+    // A newer frame is already due, never upload the stale one
+    for (AVFrame* next = frame_queue_peek_next(video_frames);
+         next && video_frame_pts_seconds(next) <= master_time;
+         next = frame_queue_peek_next(video_frames)) {
+        frame_queue_pop(video_frames);
+        video_dropped_frames++;
+        perf_count(PERF_COUNTER_FRAMES_DROPPED);
+        frame = next;
+    }
 
-    if (!current_frame_info) {
-        current_frame_info = new frame_info;
-        current_frame_info->texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_IYUV, SDL_TEXTUREACCESS_STREAMING, frame->width, frame->height);
-        current_frame_info->frame_width = frame->width;
-        current_frame_info->frame_height = frame->height;
+    // The matrix is applied when the texture converts, follow the stream's tags
+    SDL_YUV_CONVERSION_MODE conversion_mode = video_frame_conversion_mode(frame);
+    if (conversion_mode != video_conversion_mode) {
+        SDL_SetYUVConversionMode(conversion_mode);
+        video_conversion_mode = conversion_mode;
+    #ifdef DEBUG_VIDEO
+        log_debug("[Video player] YUV conversion mode %d\n", conversion_mode);
+    #endif
     }
 
-    if (current_frame_info->texture) {
-        SDL_UpdateYUVTexture(current_frame_info->texture, NULL,
-            frame->data[0], frame->linesize[0],
-            frame->data[1], frame->linesize[1],
-            frame->data[2], frame->linesize[2]);
+    // Geometry changes reallocate the pool here, before this frame's texture is picked
+    texture_pool_update(video_texture_pool);
+
+    // Frames decoded into the pool only need their texture unlocked
+    SDL_Texture* texture = texture_pool_present(video_texture_pool, frame);
+
+    if (!texture) {
+        // Pool exhausted or unsupported format, copy the planes
+        texture = video_copy_frame(frame);
     }
 
-    av_frame_free(&frame); // Free the cloned frame
+    // Textures hold the whole decoded picture including padding and the codec's
+    // cropped border, the renderer only samples the visible part
+    current_frame_info.texture = texture;
+    current_frame_info.crop_x = (int)frame->crop_left;
+    current_frame_info.crop_y = (int)frame->crop_top;
+    current_frame_info.frame_width = frame->width - (int)(frame->crop_left + frame->crop_right);
+    current_frame_info.frame_height = frame->height - (int)(frame->crop_top + frame->crop_bottom);
+
+    current_pts_seconds = video_frame_pts_seconds(frame);
+    resume_store_update(current_pts_seconds);
+
+    perf_count(PERF_COUNTER_FRAMES_SHOWN);
+    perf_set(PERF_GAUGE_FRAME_QUEUE, frame_queue_size(video_frames));
+    perf_set(PERF_GAUGE_PACKET_QUEUE, packet_queue_size(demux->video_queue));
+    perf_set(PERF_GAUGE_AV_OFFSET_MS, (int32_t)((current_pts_seconds - master_time) * 1000.0));
+    perf_set(PERF_GAUGE_SURFACE_MISSES, (int32_t)video_texture_pool.misses);
+
+    if (!video_first_frame_shown) {
+        video_first_frame_shown = true;
+        printf("[Video player] Open %llu ms, probe %llu ms%s, codec %llu ms, first frame after %llu ms\n",
+            (unsigned long long)demux->open_us / 1000,
+            (unsigned long long)demux->probe_us / 1000, demux->probe_cached ? " (cached)" : "",
+            (unsigned long long)video_codec_open_us / 1000,
+            (unsigned long long)OSTicksToMilliseconds(OSGetSystemTime() - video_start_ticks));
+    }
+
+    // Held until the next picture replaces it, the queue slot goes back empty
+    av_frame_unref(displayed_frame);
+    av_frame_move_ref(displayed_frame, frame);
+    frame_queue_pop(video_frames);
 }
 
 void video_player_update(SDL_Renderer* renderer) {
@@ -319,57 +588,71 @@ void video_player_update(SDL_Renderer* renderer) {
     render_video_frame(renderer);
 }
 
-void stop_video_decoding_thread() {
+// Wakes the decode thread from a pause, a full frame queue or an empty packet queue
+static void video_decode_abort() {
+    {
+        std::lock_guard<std::mutex> lock(playback_mutex);
+        video_thread_running = false;
+    }
+    playback_cv.notify_all();
+    frame_queue_abort(video_frames);
+}
+
+bool stop_video_decoding_thread() {
     #ifdef DEBUG_VIDEO
-    printf("[Video player] Stopping video decoding thread...\n");
+    log_debug("[Video player] Stopping video decoding thread...\n");
     #endif
-    video_thread_running = false;
-    playback_cv.notify_all();
-    if (video_thread.joinable()) {
-        video_thread.join();
+    video_decode_abort();
+    if (!player_session_join(video_thread, "Video decode")) return false;
     #ifdef DEBUG_VIDEO
-        printf("[Video player] Video decoding thread joined\n");
+    log_debug("[Video player] Video decoding thread joined\n");
     #endif
-    }
+    return true;
 }
 
 
-int video_player_cleanup() {
+bool video_player_is_open() {
+    return demux != nullptr;
+}
+
+int video_player_cleanup(session_stop_mode mode) {
     #ifdef DEBUG_VIDEO
-    printf("[Video player] Stopping Video Player...\n");
+    log_debug("[Video player] Stopping Video Player...\n");
     #endif
 
-    audio_player_cleanup();
-    stop_video_decoding_thread();
+    resume_store_finish(current_pts_seconds);
 
-    {
-        std::lock_guard<std::mutex> lock(video_frame_mutex);
-        while (!video_frame_queue.empty()) {
-            AVFrame* f = video_frame_queue.front();
-            av_frame_free(&f);
-            video_frame_queue.pop();
-        }
-    #ifdef DEBUG_VIDEO
-        printf("[Video player] Cleared video frame queue\n");
-    #endif
+    // Paused or not, nothing has to play for the threads to see the stop. Every
+    // stage is cancelled before any is joined so they wind down together, the
+    // joins then go consumers first: video decode, audio, subtitles, demuxer.
+    // The presenter is this thread, it draws nothing once playing_video is off.
+    player_session_stop stop(mode);
+    playing_video = false;
+    demuxer_abort(demux);
+    audio_player_abort();
+    video_decode_abort();
+    subtitles_abort();
+
+    bool video_stopped = stop_video_decoding_thread();
+    // Audio pops the shared demuxer's queue, the demuxer must outlive it
+    bool audio_stopped = audio_player_cleanup();
+    if (!video_stopped) {
+        // Left decoding while the app exits, its codec, frames and textures stay
+        return -1;
     }
 
-    if (current_frame_info) {
-        if (current_frame_info->texture) {
-            SDL_DestroyTexture(current_frame_info->texture);
-        }
-        delete current_frame_info;
-        current_frame_info = nullptr;
+    frame_queue_destroy(video_frames);
     #ifdef DEBUG_VIDEO
-        printf("[Video player] Freed current_frame_info\n");
+    log_debug("[Video player] Cleared video frame queue\n");
     #endif
-    }
 
-    if (frame) {
-        av_frame_free(&frame);
-        frame = nullptr;
+    current_frame_info = frame_info();
+
+    if (displayed_frame) {
+        av_frame_free(&displayed_frame);
+        displayed_frame = nullptr;
     #ifdef DEBUG_VIDEO
-        printf("[Video player] Freed last video frame\n");
+        log_debug("[Video player] Freed last video frame\n");
     #endif
     }
 
@@ -377,7 +660,7 @@ int video_player_cleanup() {
         av_packet_free(&pkt);
         pkt = nullptr;
     #ifdef DEBUG_VIDEO
-        printf("[Video player] Freed packet\n");
+        log_debug("[Video player] Freed packet\n");
     #endif
     }
 
@@ -385,27 +668,60 @@ int video_player_cleanup() {
         avcodec_free_context(&video_codec_ctx);
         video_codec_ctx = nullptr;
     #ifdef DEBUG_VIDEO
-        printf("[Video player] Freed codec context\n");
+        log_debug("[Video player] Freed codec context\n");
     #endif
     }
 
-    if (fmt_ctx) {
-        avformat_close_input(&fmt_ctx);
+    // Only after the decoder and the queue dropped their references
+    #ifdef DEBUG_VIDEO
+    log_debug("[Video player] Texture pool misses: %llu\n", (unsigned long long)video_texture_pool.misses);
+    #endif
+    texture_pool_destroy(video_texture_pool);
+    for (int i = 0; i < VIDEO_COPY_TEXTURES; ++i) {
+        if (copy_textures[i]) {
+            SDL_DestroyTexture(copy_textures[i]);
+            copy_textures[i] = NULL;
+        }
+    }
+    copy_texture_index = 0;
+    video_renderer = NULL;
+    // Next video starts from SDL's default matrix again
+    SDL_SetYUVConversionMode(SDL_YUV_CONVERSION_AUTOMATIC);
+    video_conversion_mode = SDL_YUV_CONVERSION_AUTOMATIC;
+
+    bool subtitles_stopped = subtitles_close();
+    if (demux && (!audio_stopped || !subtitles_stopped)) {
+        // A reader of the demuxer was left running while the app exits, leak it
+        demux = nullptr;
+        fmt_ctx = nullptr;
+    } else if (demux) {
+        demuxer_close(demux);
         fmt_ctx = nullptr;
     #ifdef DEBUG_VIDEO
-        printf("[Video player] Closed input file\n");
+        log_debug("[Video player] Closed input file\n");
     #endif
     }
 
+    #ifdef DEBUG_VIDEO
+    log_debug("[Video player] Dropped %llu late frames\n", (unsigned long long)video_dropped_frames);
+    #endif
+
     current_pts_seconds = 0;
+    video_finished_generation = -1;
     video_stream_index = -1;
     playing_video = false;
-    total_paused_duration = 0;
-    pause_start_time = 0;
+    video_seek_pending = false;
+    video_dropped_frames = 0;
+    video_decode_plan = decode_plan();
+    video_skip_frame = AVDISCARD_DEFAULT;
 
     #ifdef DEBUG_VIDEO
-    printf("[Video player] Cleanup complete\n");
+    log_debug("[Video player] Cleanup complete\n");
     #endif
 
     return 0;
 }
+
+decode_mode video_player_get_decode_mode() {
+    return video_decode_plan.mode;
+}
@@ -9,21 +9,49 @@ extern "C" {
     #include <libavutil/time.h>
 }
 #include "main.hpp"
+#include "decode_preflight.hpp"
+#include "player_session.hpp"
 
-AVCodecContext* video_player_create_codec_context(AVFormatContext* fmt_ctx, int stream_index);
+// Decoded frames buffered ahead of presentation, settings.json can change it
+#define VIDEO_FRAME_QUEUE_SIZE 10
+// Frames later than this (seconds) behind the master clock are dropped
+#define VIDEO_LATE_THRESHOLD 0.1
+// Consecutive late frames before non-reference frames are skipped at decode time
+#define VIDEO_SKIP_NONREF_AFTER 3
+// Frames due within this many seconds are presented on the current vsync
+#define VIDEO_PRESENT_TOLERANCE 0.008
+// Texture pool slots on top of the frame queue, for decoder references and the shown frame
+#define VIDEO_TEXTURE_POOL_EXTRA 6
+// Copy path textures kept in rotation so uploads never touch the one being drawn
+#define VIDEO_COPY_TEXTURES 2
+// Seconds jumped per LEFT/RIGHT press
+#define VIDEO_SEEK_STEP 5.0f
+
+// Full decode unless a pre-flight plan says otherwise
+AVCodecContext* video_player_create_codec_context(AVFormatContext* fmt_ctx, int stream_index, const decode_plan* plan = nullptr);
 void video_player_seek(float delta_time);
+// The decoder drained at the end of the file and its last frame was shown,
+// a later seek starts it over
+bool video_player_is_finished();
 bool video_player_is_playing();
 void video_player_play(bool new_state);
 int64_t video_player_get_current_time();
 frame_info* video_player_get_current_frame_info();
-int video_player_init(const char* filepath, SDL_Renderer* renderer, SDL_Texture*& texture);
-void video_player_start(const char* path, SDL_Renderer& renderer, SDL_Texture*& texture);
+int video_player_init(const char* filepath, SDL_Renderer* renderer);
+void video_player_start(const char* path, SDL_Renderer& renderer);
 void start_video_decoding_thread();
 void process_video_frame_thread();
 int64_t video_player_get_total_play_time();
 void render_video_frame(SDL_Renderer* renderer);
 void video_player_update(SDL_Renderer* renderer);
-void stop_video_decoding_thread();
-int video_player_cleanup();
+// False when the thread was left running at exit
+bool stop_video_decoding_thread();
+// True between video_player_start and video_player_cleanup, paused or not
+bool video_player_is_open();
+// Stops every thread of the file within SESSION_STOP_BUDGET_MS and frees it,
+// paused or not. -1 when a thread was abandoned and its state was kept.
+int video_player_cleanup(session_stop_mode mode = SESSION_STOP_WAIT);
+// What the pre-flight picked for the open file
+decode_mode video_player_get_decode_mode();
 
 #endif
\ No newline at end of file
@@ -0,0 +1,151 @@
+#include <cmath>
+#include <cstdint>
+#include <coreinit/time.h>
+
+#include "audio_player.hpp"
+#include "perf.hpp"
+#include "visualizer.hpp"
+
+#define VISUALIZER_WINDOW_FRAMES (VISUALIZER_FFT_SIZE * VISUALIZER_DECIMATION)
+#define VISUALIZER_MAX_CHANNELS 8
+#define VISUALIZER_INTERVAL_US (1000000 / VISUALIZER_RATE_HZ)
+
+// Real and imaginary part next to each other, the layout a paired single
+// register loads and stores in one instruction
+struct fft_pair {
+    float re;
+    float im;
+};
+
+static fft_pair fft_data[VISUALIZER_FFT_SIZE] __attribute__((aligned(8)));
+static fft_pair twiddles[VISUALIZER_FFT_SIZE / 2] __attribute__((aligned(8)));
+static uint16_t bit_reverse[VISUALIZER_FFT_SIZE];
+static float hann[VISUALIZER_FFT_SIZE];
+// First bin of each band, the last entry ends the top band
+static int band_edges[VISUALIZER_BANDS + 1];
+static bool tables_ready = false;
+
+static int16_t pcm[VISUALIZER_WINDOW_FRAMES * VISUALIZER_MAX_CHANNELS];
+static float decimated[VISUALIZER_FFT_SIZE];
+
+static visualizer_frame frame;
+static OSTime last_update = 0;
+static uint32_t interval_us = VISUALIZER_INTERVAL_US;
+
+static void visualizer_init_tables() {
+    const int n = VISUALIZER_FFT_SIZE;
+    for (int i = 0; i < n; ++i) {
+        int reversed = 0;
+        for (int bit = 0; bit < VISUALIZER_FFT_LOG2; ++bit) reversed |= ((i >> bit) & 1) << (VISUALIZER_FFT_LOG2 - 1 - bit);
+        bit_reverse[i] = (uint16_t)reversed;
+        hann[i] = 0.5f - 0.5f * cosf(2.0f * (float)M_PI * i / (n - 1));
+    }
+    for (int k = 0; k < n / 2; ++k) {
+        twiddles[k].re = cosf(-2.0f * (float)M_PI * k / n);
+        twiddles[k].im = sinf(-2.0f * (float)M_PI * k / n);
+    }
+
+    // Log spaced from the first bin to Nyquist, the low bands get one bin each
+    band_edges[0] = 1;
+    for (int b = 1; b <= VISUALIZER_BANDS; ++b) {
+        int edge = (int)powf(n / 2.0f, b / (float)VISUALIZER_BANDS);
+        if (edge <= band_edges[b - 1]) edge = band_edges[b - 1] + 1;
+        band_edges[b] = edge < n / 2 ? edge : n / 2;
+    }
+    tables_ready = true;
+}
+
+// In place over fft_data, which already holds its input in bit reversed order
+static void visualizer_fft() {
+    for (int size = 2, step = VISUALIZER_FFT_SIZE / 2; size <= VISUALIZER_FFT_SIZE; size <<= 1, step >>= 1) {
+        int half = size >> 1;
+        for (int start = 0; start < VISUALIZER_FFT_SIZE; start += size) {
+            for (int k = 0; k < half; ++k) {
+                const fft_pair w = twiddles[k * step];
+                fft_pair& a = fft_data[start + k];
+                fft_pair& b = fft_data[start + k + half];
+                float re = b.re * w.re - b.im * w.im;
+                float im = b.re * w.im + b.im * w.re;
+                b.re = a.re - re;
+                b.im = a.im - im;
+                a.re += re;
+                a.im += im;
+            }
+        }
+    }
+}
+
+static void visualizer_analyze(int frames, int channels) {
+    // Mix to mono and box filter down to the FFT rate, missing history stays silent
+    int missing = VISUALIZER_WINDOW_FRAMES - frames;
+    float scale = 1.0f / (32768.0f * VISUALIZER_DECIMATION * channels);
+    for (int i = 0; i < VISUALIZER_FFT_SIZE; ++i) {
+        int sum = 0;
+        for (int j = 0; j < VISUALIZER_DECIMATION; ++j) {
+            int index = i * VISUALIZER_DECIMATION + j - missing;
+            if (index < 0) continue;
+            const int16_t* samples = pcm + index * channels;
+            for (int c = 0; c < channels; ++c) sum += samples[c];
+        }
+        decimated[i] = sum * scale;
+        fft_data[bit_reverse[i]].re = decimated[i] * hann[i];
+        fft_data[bit_reverse[i]].im = 0.0f;
+    }
+
+    for (int i = 0; i < VISUALIZER_WAVE_POINTS; ++i) {
+        frame.wave[i] = decimated[i * VISUALIZER_FFT_SIZE / VISUALIZER_WAVE_POINTS];
+    }
+
+    visualizer_fft();
+
+    // Hann halves the amplitude and one side of the spectrum holds half of it,
+    // a full scale sine peaks at 1 this way
+    const float normalize = 4.0f / VISUALIZER_FFT_SIZE;
+    for (int b = 0; b < VISUALIZER_BANDS; ++b) {
+        float peak = 0.0f;
+        for (int bin = band_edges[b]; bin < band_edges[b + 1]; ++bin) {
+            float power = fft_data[bin].re * fft_data[bin].re + fft_data[bin].im * fft_data[bin].im;
+            if (power > peak) peak = power;
+        }
+
+        float db = 10.0f * log10f(peak * normalize * normalize + 1e-12f);
+        float level = (db - VISUALIZER_FLOOR_DB) / -VISUALIZER_FLOOR_DB;
+        if (level < 0.0f) level = 0.0f;
+        if (level > 1.0f) level = 1.0f;
+
+        // Rise at once, fall off slowly so the bars stay readable
+        float falling = frame.bands[b] * VISUALIZER_DECAY;
+        frame.bands[b] = level > falling ? level : falling;
+    }
+}
+
+bool visualizer_update() {
+    OSTime now = OSGetSystemTime();
+    if (last_update && OSTicksToMicroseconds(now - last_update) < interval_us) return false;
+    last_update = now;
+
+    int channels = audio_output_channels();
+    if (channels <= 0 || channels > VISUALIZER_MAX_CHANNELS) return false;
+    if (!tables_ready) visualizer_init_tables();
+
+    {
+        perf_scope scope(PERF_TIMER_VISUALIZER);
+        int frames = audio_output_recent(pcm, VISUALIZER_WINDOW_FRAMES);
+        visualizer_analyze(frames, channels);
+    }
+
+    // Over budget, refresh less often so the share of the UI thread stays the same
+    uint64_t cost_us = OSTicksToMicroseconds(OSGetSystemTime() - now);
+    interval_us = cost_us > VISUALIZER_BUDGET_US ? (uint32_t)(VISUALIZER_INTERVAL_US * cost_us / VISUALIZER_BUDGET_US) : VISUALIZER_INTERVAL_US;
+    return true;
+}
+
+int visualizer_wait_ms() {
+    if (!last_update) return 0;
+    uint64_t elapsed_us = OSTicksToMicroseconds(OSGetSystemTime() - last_update);
+    return elapsed_us >= interval_us ? 0 : (int)((interval_us - elapsed_us + 999) / 1000);
+}
+
+const visualizer_frame& visualizer_get() {
+    return frame;
+}
@@ -0,0 +1,31 @@
+#ifndef VISUALIZER_H
+#define VISUALIZER_H
+
+// Fixed radix-2 transform over the decimated window, 256 points at 12kHz
+// cover about 21ms of the 48kHz output
+#define VISUALIZER_FFT_SIZE 256
+#define VISUALIZER_FFT_LOG2 8
+#define VISUALIZER_DECIMATION 4
+#define VISUALIZER_BANDS 32
+#define VISUALIZER_WAVE_POINTS 128
+#define VISUALIZER_RATE_HZ 30
+// Analysis time allowed per refresh, a slower one stretches the interval instead
+#define VISUALIZER_BUDGET_US 1000
+// Band levels span this many dB below full scale
+#define VISUALIZER_FLOOR_DB -72.0f
+// Falling bands keep this much of their level per refresh
+#define VISUALIZER_DECAY 0.85f
+
+struct visualizer_frame {
+    float bands[VISUALIZER_BANDS] = {}; // 0 to 1, low to high frequencies
+    float wave[VISUALIZER_WAVE_POINTS] = {}; // -1 to 1, oldest first
+};
+
+// Main thread, once per UI frame. Reads what the audio device just played and
+// returns true when the frame was refreshed.
+bool visualizer_update();
+// Milliseconds until the next refresh is due
+int visualizer_wait_ms();
+const visualizer_frame& visualizer_get();
+
+#endif